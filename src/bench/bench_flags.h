@@ -0,0 +1,85 @@
+#pragma once
+
+#include <json/json.h>
+
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "util/json_utils.h"
+
+// Benchmark options given on the command line as key=value pairs.
+class BenchFlags {
+public:
+    BenchFlags(int argc, char **argv) {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const size_t eq = arg.find('=');
+            if (eq == std::string::npos) {
+                throw std::runtime_error("Expected key=value, got: " + arg);
+            }
+            values_[arg.substr(0, eq)] = arg.substr(eq + 1);
+        }
+    }
+
+    std::string get_string(const std::string &key,
+                           const std::string &default_value) const {
+        const auto it = values_.find(key);
+        return it == values_.end() ? default_value : it->second;
+    }
+
+    int get_int(const std::string &key, int default_value) const {
+        const auto it = values_.find(key);
+        return it == values_.end() ? default_value : std::stoi(it->second);
+    }
+
+    double get_double(const std::string &key, double default_value) const {
+        const auto it = values_.find(key);
+        return it == values_.end() ? default_value : std::stod(it->second);
+    }
+
+    // Comma-separated list, e.g. modes=quit,drain.
+    std::vector<std::string> get_list(const std::string &key,
+                                      const std::string &default_value) const {
+        std::vector<std::string> list;
+        std::stringstream values(get_string(key, default_value));
+        std::string value;
+        while (std::getline(values, value, ',')) {
+            list.push_back(value);
+        }
+        return list;
+    }
+
+private:
+    std::map<std::string, std::string> values_;
+};
+
+// Print |report|, and also write it to the file of the report flag.
+inline void WriteReport(const BenchFlags &flags, const Json::Value &report) {
+    const std::string report_str = JsonToString(report);
+    std::cout << report_str << std::endl;
+    const std::string report_path = flags.get_string("report", "");
+    if (!report_path.empty()) {
+        std::ofstream(report_path) << report_str << std::endl;
+    }
+}
+
+// Run |run_case| for each case listed in |key| and report the results as
+// one array. Returns the exit code of the benchmark.
+inline int RunListedCases(
+        const BenchFlags &flags,
+        const std::string &key,
+        const std::string &default_list,
+        const std::function<Json::Value(const std::string &)> &run_case) {
+    Json::Value report(Json::arrayValue);
+    for (const std::string &value : flags.get_list(key, default_list)) {
+        report.append(run_case(value));
+    }
+    WriteReport(flags, report);
+    return 0;
+}
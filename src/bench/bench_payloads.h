@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "util/webrtc_manager.h"
+
+// Signaling payloads captured from a client/server handshake, used by the
+// signaling microbenchmarks.
+
+inline std::string SampleOfferSdp() {
+    return "v=0\r\n"
+           "o=- 4611731400430051336 2 IN IP4 127.0.0.1\r\n"
+           "s=-\r\n"
+           "t=0 0\r\n"
+           "a=group:BUNDLE 0\r\n"
+           "a=extmap-allow-mixed\r\n"
+           "a=msid-semantic: WMS\r\n"
+           "m=application 9 UDP/DTLS/SCTP webrtc-datachannel\r\n"
+           "c=IN IP4 0.0.0.0\r\n"
+           "a=ice-ufrag:Qx7Z\r\n"
+           "a=ice-pwd:c4b3vJ0WmhH7s1u9yF5kq3Lr\r\n"
+           "a=ice-options:trickle\r\n"
+           "a=fingerprint:sha-256 "
+           "3C:4A:9F:0B:12:7E:55:D1:A8:6F:2B:90:CE:31:47:8D:"
+           "E2:19:6A:04:BB:73:F5:28:91:0C:D6:3E:A7:58:1F:C2\r\n"
+           "a=setup:actpass\r\n"
+           "a=mid:0\r\n"
+           "a=sctp-port:5000\r\n"
+           "a=max-message-size:262144\r\n";
+}
+
+inline std::string SampleAnswerSdp() {
+    return "v=0\r\n"
+           "o=- 8190283747710294712 2 IN IP4 127.0.0.1\r\n"
+           "s=-\r\n"
+           "t=0 0\r\n"
+           "a=group:BUNDLE 0\r\n"
+           "a=extmap-allow-mixed\r\n"
+           "a=msid-semantic: WMS\r\n"
+           "m=application 9 UDP/DTLS/SCTP webrtc-datachannel\r\n"
+           "c=IN IP4 0.0.0.0\r\n"
+           "a=ice-ufrag:k2Pd\r\n"
+           "a=ice-pwd:Wn8aXy3Qe0r7UoT2bZ6vHs1M\r\n"
+           "a=ice-options:trickle\r\n"
+           "a=fingerprint:sha-256 "
+           "A1:0E:77:C4:5B:2D:98:F3:61:3A:CF:0D:84:E9:12:B7:"
+           "56:F0:2C:9B:4E:A3:D8:71:05:6E:BC:19:F7:8A:23:5D\r\n"
+           "a=setup:active\r\n"
+           "a=mid:0\r\n"
+           "a=sctp-port:5000\r\n"
+           "a=max-message-size:262144\r\n";
+}
+
+// Host, server-reflexive and relay candidates of a multi-homed host.
+inline std::vector<Ice> SampleIceCandidates() {
+    const std::vector<std::string> candidates = {
+            "candidate:842163049 1 udp 2122260223 192.168.1.23 52741 typ host "
+            "generation 0 ufrag Qx7Z network-id 1",
+            "candidate:1510613869 1 udp 2122194687 10.8.0.6 48391 typ host "
+            "generation 0 ufrag Qx7Z network-id 2",
+            "candidate:3422584389 1 udp 2122129151 172.17.0.1 39121 typ host "
+            "generation 0 ufrag Qx7Z network-id 3",
+            "candidate:1876313031 1 tcp 1518280447 192.168.1.23 9 typ host "
+            "tcptype active generation 0 ufrag Qx7Z network-id 1",
+            "candidate:344579997 1 tcp 1518214911 10.8.0.6 9 typ host "
+            "tcptype active generation 0 ufrag Qx7Z network-id 2",
+            "candidate:2999745851 1 udp 1686052607 203.0.113.17 52741 typ "
+            "srflx raddr 192.168.1.23 rport 52741 generation 0 ufrag Qx7Z "
+            "network-id 1",
+            "candidate:4132567890 1 udp 41885439 198.51.100.4 61022 typ relay "
+            "raddr 203.0.113.17 rport 52741 generation 0 ufrag Qx7Z "
+            "network-id 1",
+    };
+    std::vector<Ice> ices;
+    for (const std::string &candidate : candidates) {
+        Ice ice;
+        ice.candidate = candidate;
+        ice.sdp_mid = "0";
+        ice.sdp_mline_index = 0;
+        ices.push_back(ice);
+    }
+    return ices;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Wall clock for the benchmarks, in microseconds.
+inline int64_t NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+// Percentile |p| in [0, 100] of |values|, -1 when empty.
+inline double Percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return -1;
+    }
+    std::sort(values.begin(), values.end());
+    return values[static_cast<size_t>(p / 100 * (values.size() - 1))];
+}
@@ -0,0 +1,154 @@
+#include <json/json.h>
+#include <rtc_base/thread.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_flags.h"
+#include "bench/bench_stats.h"
+#include "bench/peer_pair.h"
+#include "util/busy_poll_socket_server.h"
+#include "util/json_utils.h"
+#include "util/thread_config.h"
+
+// DataChannel ping-pong between two peers on this host with WebRTC's
+// PhysicalSocketServer against the BusyPollSocketServer on the network
+// threads, unpinned and with each network thread pinned to a core of its
+// own. Reports round trip percentiles and a histogram of the round trips.
+//
+// Flags (key=value):
+//   modes         comma-separated modes to run
+//                 (physical,busy_poll,busy_poll_pinned)
+//   spin_us       spin budget of each wait in microseconds (200)
+//   cpus          CPU list of the pinned mode: the offerer's and the
+//                 answerer's network threads take the first two, the worker
+//                 and signaling threads share the rest (1-3)
+//   round_trips   ping-pong round trips per case (5000)
+//   message_size  DataChannel message size in bytes (64)
+//   timeout_ms    timeout of each phase (30000)
+//   report        also write the report to this file
+
+// Round trips per power-of-two bucket of microseconds, keyed by the bucket's
+// upper bound.
+Json::Value Histogram(const std::vector<double> &round_trips_ms) {
+    std::vector<uint64_t> counts;
+    for (double ms : round_trips_ms) {
+        size_t bucket = 0;
+        while ((uint64_t(1) << bucket) < ms * 1000) {
+            ++bucket;
+        }
+        counts.resize(std::max(counts.size(), bucket + 1));
+        ++counts[bucket];
+    }
+    Json::Value histogram(Json::objectValue);
+    for (size_t bucket = 0; bucket < counts.size(); ++bucket) {
+        if (counts[bucket] > 0) {
+            histogram["le_" + std::to_string(uint64_t(1) << bucket) + "us"] =
+                    Json::UInt64(counts[bucket]);
+        }
+    }
+    return histogram;
+}
+
+BusyPollStats ReadBusyPollStats(WebRTCManager &manager) {
+    rtc::Thread *thread = manager.network_thread.get();
+    return thread->Invoke<BusyPollStats>(RTC_FROM_HERE, [thread]() {
+        return static_cast<BusyPollSocketServer *>(thread->socketserver())
+                ->stats();
+    });
+}
+
+Json::Value RunCase(const std::string &mode, const BenchFlags &flags) {
+    BusyPollConfig busy_poll_config;
+    busy_poll_config.spin_us = flags.get_int("spin_us", 200);
+    const int round_trips = flags.get_int("round_trips", 5000);
+    const std::string message(flags.get_int("message_size", 64), 'x');
+    const int timeout_ms = flags.get_int("timeout_ms", 30000);
+    Json::Value result;
+    result["mode"] = mode;
+
+    std::function<std::unique_ptr<rtc::SocketServer>()> create_socket_server;
+    bool pinned = false;
+    if (mode == "busy_poll" || mode == "busy_poll_pinned") {
+        create_socket_server = [busy_poll_config]() {
+            return std::unique_ptr<rtc::SocketServer>(
+                    new BusyPollSocketServer(busy_poll_config));
+        };
+        pinned = mode == "busy_poll_pinned";
+    } else if (mode != "physical") {
+        throw std::runtime_error("Unknown mode: " + mode);
+    }
+    PeerPair peers;
+    for (WebRTCManager *manager : {&peers.offerer, &peers.answerer}) {
+        // Host candidates only.
+        manager->configuration.servers.clear();
+        manager->create_socket_server = create_socket_server;
+    }
+    if (pinned) {
+        const std::vector<int> cpus =
+                ParseCpuList(flags.get_string("cpus", "1-3"));
+        const int available = std::thread::hardware_concurrency();
+        if (cpus.size() < 3 ||
+            *std::max_element(cpus.begin(), cpus.end()) >= available) {
+            result["skipped"] = "needs 3 CPUs below " +
+                                std::to_string(available);
+            return result;
+        }
+        peers.offerer.network_thread_config.cpus = {cpus[0]};
+        peers.answerer.network_thread_config.cpus = {cpus[1]};
+        const std::vector<int> others(cpus.begin() + 2, cpus.end());
+        for (WebRTCManager *manager : {&peers.offerer, &peers.answerer}) {
+            manager->worker_thread_config.cpus = others;
+            manager->signaling_thread_config.cpus = others;
+        }
+    }
+    peers.init();
+
+    const double connect_ms = peers.connect(timeout_ms);
+    result["connect_ms"] = connect_ms;
+    if (connect_ms < 0) {
+        peers.quit();
+        return result;
+    }
+
+    BusyPollStats before;
+    if (create_socket_server) {
+        before = ReadBusyPollStats(peers.answerer);
+    }
+    const std::vector<double> round_trips_ms =
+            peers.ping_pong(message, round_trips, timeout_ms);
+    if (create_socket_server && !round_trips_ms.empty()) {
+        const BusyPollStats after = ReadBusyPollStats(peers.answerer);
+        const double waits =
+                after.spin_wakeups - before.spin_wakeups +
+                after.blocking_waits - before.blocking_waits;
+        result["answerer_polls_per_round_trip"] =
+                double(after.polls - before.polls) / round_trips_ms.size();
+        result["answerer_blocking_wait_ratio"] =
+                waits > 0 ? (after.blocking_waits - before.blocking_waits) /
+                                    waits
+                          : -1.0;
+    }
+    // No callback runs once the connection is closed.
+    peers.quit();
+
+    result["round_trips"] = Json::UInt64(round_trips_ms.size());
+    result["round_trip_p50_ms"] = Percentile(round_trips_ms, 50);
+    result["round_trip_p90_ms"] = Percentile(round_trips_ms, 90);
+    result["round_trip_p99_ms"] = Percentile(round_trips_ms, 99);
+    result["round_trip_p999_ms"] = Percentile(round_trips_ms, 99.9);
+    result["round_trip_histogram"] = Histogram(round_trips_ms);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    return RunListedCases(
+            flags, "modes", "physical,busy_poll,busy_poll_pinned",
+            [&](const std::string &mode) { return RunCase(mode, flags); });
+}
@@ -0,0 +1,231 @@
+#include <json/json.h>
+#include <rtc_base/virtual_socket_server.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_flags.h"
+#include "bench/bench_stats.h"
+#include "bench/virtual_network.h"
+#include "util/async_connection.h"
+#include "util/json_utils.h"
+
+// Concurrent sessions written as coroutines (util/async_connection.h). Each
+// session is a pair of in-process peers over a rtc::VirtualSocketServer: the
+// offerer connects and runs |messages| ping/echo round trips, the answerer
+// echoes. All sessions share one network, worker and signaling thread, and
+// their session logic runs on |executors| threads, so the thread count stays
+// fixed however many sessions are in flight.
+//
+// Flags (key=value):
+//   sessions    number of sessions, i.e. pairs of peers (1000)
+//   executors   threads running the session coroutines (2)
+//   messages    round trips per session (10)
+//   timeout_ms  timeout of each connection setup (30000)
+//   report      also write the report to this file
+
+int ProcessThreads() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            return std::stoi(line.substr(8));
+        }
+    }
+    return 0;
+}
+
+// Hands the signaling messages of one peer to the other.
+class DirectSignaler : public Signaler {
+public:
+    AsyncConnection *remote = nullptr;
+
+    void send_sdp(const std::string &sdp) override { remote->push_sdp(sdp); }
+    void send_ice(const Ice &ice) override { remote->push_ice(ice); }
+};
+
+struct Session {
+    Session(rtc::Thread *executor)
+        : offerer("offerer"),
+          answerer("answerer"),
+          async_offerer(offerer,
+                        executor,
+                        offerer_signaler,
+                        AsyncConnection::Role::kOfferer),
+          async_answerer(answerer,
+                         executor,
+                         answerer_signaler,
+                         AsyncConnection::Role::kAnswerer) {
+        offerer.connection.verbose = false;
+        answerer.connection.verbose = false;
+        offerer_signaler.remote = &async_answerer;
+        answerer_signaler.remote = &async_offerer;
+    }
+
+    DirectSignaler offerer_signaler;
+    DirectSignaler answerer_signaler;
+    WebRTCManager offerer;
+    WebRTCManager answerer;
+    AsyncConnection async_offerer;
+    AsyncConnection async_answerer;
+
+    double setup_ms = -1;
+    std::vector<double> round_trips_ms;
+};
+
+// Counts finished session halves.
+class Latch {
+public:
+    void count_down() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++count_;
+        cv_.notify_all();
+    }
+
+    void wait(int count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return count_ >= count; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int count_ = 0;
+};
+
+Task<> RunAnswerer(Session &session, int timeout_ms, Latch &done) {
+    if (co_await session.async_answerer.open(timeout_ms)) {
+        while (std::optional<std::string> message =
+                       co_await session.async_answerer.receive()) {
+            if (*message == "bye") {
+                break;
+            }
+            co_await session.async_answerer.send(*message);
+        }
+    }
+    done.count_down();
+}
+
+Task<> RunOfferer(Session &session,
+                  int messages,
+                  int timeout_ms,
+                  Latch &done) {
+    const int64_t start_us = NowUs();
+    if (co_await session.async_offerer.open(timeout_ms)) {
+        session.setup_ms = (NowUs() - start_us) / 1000.0;
+        for (int i = 0; i < messages; ++i) {
+            const int64_t sent_us = NowUs();
+            co_await session.async_offerer.send(std::to_string(i));
+            if (!co_await session.async_offerer.receive()) {
+                break;
+            }
+            session.round_trips_ms.push_back((NowUs() - sent_us) / 1000.0);
+        }
+        co_await session.async_offerer.send("bye");
+    }
+    done.count_down();
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    const int num_sessions = flags.get_int("sessions", 1000);
+    const int num_executors = std::max(flags.get_int("executors", 2), 1);
+    const int messages = flags.get_int("messages", 10);
+    const int timeout_ms = flags.get_int("timeout_ms", 30000);
+
+    rtc::VirtualSocketServer socket_server;
+    rtc::Thread network_thread(&socket_server);
+    network_thread.Start();
+    std::unique_ptr<rtc::Thread> worker_thread = rtc::Thread::Create();
+    worker_thread->Start();
+    std::unique_ptr<rtc::Thread> signaling_thread = rtc::Thread::Create();
+    signaling_thread->Start();
+    std::vector<std::unique_ptr<rtc::Thread>> executors;
+    for (int i = 0; i < num_executors; ++i) {
+        executors.push_back(rtc::Thread::Create());
+        executors.back()->SetName("executor" + std::to_string(i), nullptr);
+        executors.back()->Start();
+    }
+
+    std::vector<std::unique_ptr<VirtualNetwork>> networks;
+    std::vector<std::unique_ptr<Session>> sessions;
+    for (int i = 0; i < num_sessions; ++i) {
+        const std::string host =
+                std::to_string(i / 250) + "." + std::to_string(i % 250 + 1);
+        sessions.emplace_back(
+                new Session(executors[i % num_executors].get()));
+        Session &session = *sessions.back();
+        for (WebRTCManager *manager : {&session.offerer, &session.answerer}) {
+            const std::string ip =
+                    (manager == &session.offerer ? "10.0." : "10.1.") + host;
+            networks.emplace_back(new VirtualNetwork(&socket_server, ip));
+            networks.back()->attach(*manager);
+            manager->external_network_thread = &network_thread;
+            manager->external_worker_thread = worker_thread.get();
+            manager->external_signaling_thread = signaling_thread.get();
+            manager->init();
+        }
+    }
+
+    // Both halves of a session run on the same executor, the answerer
+    // first, so it waits for the offer before the offerer sends it.
+    Latch done;
+    const int64_t start_us = NowUs();
+    for (int i = 0; i < num_sessions; ++i) {
+        rtc::Thread *executor = executors[i % num_executors].get();
+        Session &session = *sessions[i];
+        Spawn(executor, RunAnswerer(session, timeout_ms, done));
+        Spawn(executor, RunOfferer(session, messages, timeout_ms, done));
+    }
+    const int threads_running = ProcessThreads();
+    done.wait(2 * num_sessions);
+    const double seconds = (NowUs() - start_us) / 1e6;
+
+    int num_connected = 0;
+    std::vector<double> setups_ms;
+    std::vector<double> round_trips_ms;
+    for (const std::unique_ptr<Session> &session : sessions) {
+        if (session->setup_ms >= 0) {
+            ++num_connected;
+            setups_ms.push_back(session->setup_ms);
+        }
+        round_trips_ms.insert(round_trips_ms.end(),
+                              session->round_trips_ms.begin(),
+                              session->round_trips_ms.end());
+    }
+
+    Json::Value report;
+    report["sessions"] = num_sessions;
+    report["executors"] = num_executors;
+    report["connected"] = num_connected;
+    report["threads"] = threads_running;
+    report["seconds"] = seconds;
+    report["sessions_per_s"] = num_sessions / seconds;
+    report["setup_p50_ms"] = Percentile(setups_ms, 50);
+    report["setup_p99_ms"] = Percentile(setups_ms, 99);
+    report["round_trips"] = Json::UInt64(round_trips_ms.size());
+    report["round_trip_p50_ms"] = Percentile(round_trips_ms, 50);
+    report["round_trip_p99_ms"] = Percentile(round_trips_ms, 99);
+
+    for (const std::unique_ptr<Session> &session : sessions) {
+        session->offerer.quit();
+        session->answerer.quit();
+    }
+    for (std::unique_ptr<rtc::Thread> &executor : executors) {
+        executor->Stop();
+    }
+    sessions.clear();
+    worker_thread->Stop();
+    signaling_thread->Stop();
+    network_thread.Stop();
+
+    WriteReport(flags, report);
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <json/json.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_payloads.h"
+#include "util/json_utils.h"
+#include "util/signaling_dispatcher.h"
+
+// Measures signaling messages/s through SignalingDispatcher against the
+// previous handling, which built a new reader per parse and parsed ICE
+// messages twice (once for "type", once in Ice::FromJsonString).
+
+Json::Value ParseWithFreshReader(const std::string &json_str) {
+    Json::Value json;
+    std::string err;
+    Json::CharReaderBuilder builder;
+    const std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    if (!reader->parse(json_str.c_str(), json_str.c_str() + json_str.length(),
+                       &json, &err)) {
+        throw std::runtime_error("Failed to parse string to json, error: " +
+                                 err);
+    }
+    return json;
+}
+
+size_t LegacyDispatch(const std::string &message) {
+    const Json::Value json = ParseWithFreshReader(message);
+    const std::string type = json.get("type", "").asString();
+    if (type == "offer") {
+        return json.get("sdp", "").asString().size();
+    } else if (type == "answer") {
+        return json.get("answer", "").asString().size();
+    } else if (type == "ice") {
+        return Ice::FromJson(ParseWithFreshReader(message)).candidate.size();
+    }
+    throw std::runtime_error("Unkown json message type: " + type);
+}
+
+template <typename F>
+double MessagesPerSecond(const std::vector<std::string> &messages,
+                         int iterations,
+                         F dispatch) {
+    size_t checksum = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (const std::string &message : messages) {
+            checksum += dispatch(message);
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    if (checksum == 0) {
+        throw std::runtime_error("Nothing was dispatched.");
+    }
+    return messages.size() * iterations /
+           std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char **argv) {
+    const int iterations = argc > 1 ? std::stoi(argv[1]) : 20000;
+
+    // One handshake as the server sees it from a C++ or browser client.
+    std::vector<std::string> messages;
+    Json::Value offer;
+    offer["type"] = "offer";
+    offer["sdp"] = SampleOfferSdp();
+    messages.push_back(JsonToString(offer));
+    Json::Value answer;
+    answer["type"] = "answer";
+    answer["answer"] = SampleAnswerSdp();
+    messages.push_back(JsonToString(answer));
+    for (const Ice &ice : SampleIceCandidates()) {
+        messages.push_back(ice.ToJsonString());
+    }
+
+    size_t dispatched = 0;
+    SignalingDispatcher dispatcher;
+    dispatcher.on_offer([&](const SignalingMessage &message) {
+        dispatched = message.sdp.size();
+    });
+    dispatcher.on_answer([&](const SignalingMessage &message) {
+        dispatched = message.sdp.size();
+    });
+    dispatcher.on_ice([&](const SignalingMessage &message) {
+        dispatched = message.ices[0].candidate.size();
+    });
+
+    const double legacy =
+            MessagesPerSecond(messages, iterations, LegacyDispatch);
+    const double single_parse = MessagesPerSecond(
+            messages, iterations, [&](const std::string &message) {
+                dispatcher.dispatch_text(message);
+                return dispatched;
+            });
+
+    std::cout << messages.size() << " messages x " << iterations
+              << " iterations" << std::endl;
+    std::cout << "legacy:       " << legacy << " messages/s" << std::endl;
+    std::cout << "single parse: " << single_parse << " messages/s"
+              << std::endl;
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <json/json.h>
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "util/json_utils.h"
+
+// Shutdown right after a burst of DataChannel messages between two peers on
+// this host: the offerer queues the burst and then either quits at once or
+// drains first (WebRTCManager::drain()). Reports the bytes the answerer
+// received against those the offerer queued, and the drain's own stats.
+//
+// Flags (key=value):
+//   modes         comma-separated shutdowns to run (quit,drain)
+//   burst_bytes   bytes queued before the shutdown, below the DataChannel's
+//                 16MB send queue (8388608)
+//   message_size  DataChannel message size in bytes (1200)
+//   drain_ms      deadline of the drain (5000)
+//   settle_ms     time the answerer keeps receiving after the shutdown
+//                 (1000)
+//   timeout_ms    timeout of the connection setup (30000)
+//   report        also write the report to this file
+
+Json::Value RunCase(const std::string &mode, const BenchFlags &flags) {
+    const size_t burst_bytes = flags.get_int("burst_bytes", 8 << 20);
+    const std::string message(flags.get_int("message_size", 1200), 'x');
+    const int drain_ms = flags.get_int("drain_ms", 5000);
+    const int settle_ms = flags.get_int("settle_ms", 1000);
+    const int timeout_ms = flags.get_int("timeout_ms", 30000);
+    Json::Value result;
+    result["mode"] = mode;
+    if (mode != "quit" && mode != "drain") {
+        throw std::runtime_error("Unknown mode: " + mode);
+    }
+
+    PeerPair peers;
+    for (WebRTCManager *manager : {&peers.offerer, &peers.answerer}) {
+        // Host candidates only.
+        manager->configuration.servers.clear();
+    }
+    peers.init();
+    const double connect_ms = peers.connect(timeout_ms);
+    result["connect_ms"] = connect_ms;
+    if (connect_ms < 0) {
+        peers.quit();
+        return result;
+    }
+
+    size_t bytes_queued = 0;
+    while (bytes_queued < burst_bytes && peers.offerer.send(message)) {
+        bytes_queued += message.size();
+    }
+    if (mode == "drain") {
+        result["drain"] = peers.offerer.drain(drain_ms).ToJson();
+    }
+    peers.offerer.quit();
+    std::this_thread::sleep_for(std::chrono::milliseconds(settle_ms));
+    const size_t bytes_received = peers.bytes_received();
+    peers.answerer.quit();
+
+    result["bytes_queued"] = Json::UInt64(bytes_queued);
+    result["bytes_received"] = Json::UInt64(bytes_received);
+    result["bytes_lost"] = Json::UInt64(
+            bytes_queued > bytes_received ? bytes_queued - bytes_received : 0);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    return RunListedCases(flags, "modes", "quit,drain",
+                          [&](const std::string &mode) {
+                              return RunCase(mode, flags);
+                          });
+}
@@ -0,0 +1,134 @@
+#include <json/json.h>
+#include <rtc_base/thread.h>
+#include <sys/resource.h>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bench/bench_flags.h"
+#include "bench/bench_stats.h"
+#include "bench/peer_pair.h"
+#include "bench/virtual_network.h"
+#include "util/asio_socket_server.h"
+#include "util/json_utils.h"
+
+// DataChannel ping-pong over loopback with WebRTC's own network thread
+// (PhysicalSocketServer) against one AsioEventLoop per peer running both
+// networking and signaling. Reports the round trip time and the context
+// switches of the process per round trip.
+//
+// Flags (key=value):
+//   loops         comma-separated event loops to run (physical,asio)
+//   round_trips   ping-pong round trips per case (5000)
+//   message_size  DataChannel message size in bytes (64)
+//   timeout_ms    timeout of each phase (30000)
+//   report        also write the report to this file
+
+const char kLoopback[] = "127.0.0.1";
+
+int64_t ContextSwitches() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+// Network and signaling threads of one peer.
+class PeerThreads {
+public:
+    PeerThreads(const std::string &loop, const std::string &name) {
+        if (loop == "asio") {
+            event_loop_.reset(new AsioEventLoop(name + "_event_loop"));
+            event_loop_->start();
+            network_thread_ = signaling_thread_ = event_loop_->thread();
+        } else if (loop == "physical") {
+            network_ = rtc::Thread::CreateWithSocketServer();
+            signaling_ = rtc::Thread::Create();
+            network_->Start();
+            signaling_->Start();
+            network_thread_ = network_.get();
+            signaling_thread_ = signaling_.get();
+        } else {
+            throw std::runtime_error("Unknown event loop: " + loop);
+        }
+    }
+
+    ~PeerThreads() {
+        if (event_loop_) {
+            event_loop_->stop();
+        } else {
+            signaling_->Stop();
+            network_->Stop();
+        }
+    }
+
+    void attach(WebRTCManager &manager) {
+        manager.external_network_thread = network_thread_;
+        manager.external_signaling_thread = signaling_thread_;
+    }
+
+    rtc::Thread *network_thread() { return network_thread_; }
+
+private:
+    std::unique_ptr<AsioEventLoop> event_loop_;
+    std::unique_ptr<rtc::Thread> network_;
+    std::unique_ptr<rtc::Thread> signaling_;
+    rtc::Thread *network_thread_ = nullptr;
+    rtc::Thread *signaling_thread_ = nullptr;
+};
+
+Json::Value RunCase(const std::string &loop, const BenchFlags &flags) {
+    const int round_trips = flags.get_int("round_trips", 5000);
+    const std::string message(flags.get_int("message_size", 64), 'x');
+    const int timeout_ms = flags.get_int("timeout_ms", 30000);
+    Json::Value result;
+    result["loop"] = loop;
+
+    PeerThreads offerer_threads(loop, "offerer");
+    PeerThreads answerer_threads(loop, "answerer");
+    VirtualNetwork offerer_network(
+            offerer_threads.network_thread()->socketserver(), kLoopback);
+    VirtualNetwork answerer_network(
+            answerer_threads.network_thread()->socketserver(), kLoopback);
+    PeerPair peers;
+    offerer_network.attach(peers.offerer);
+    answerer_network.attach(peers.answerer);
+    offerer_threads.attach(peers.offerer);
+    answerer_threads.attach(peers.answerer);
+    peers.init();
+
+    const double connect_ms = peers.connect(timeout_ms);
+    result["connect_ms"] = connect_ms;
+    if (connect_ms < 0) {
+        peers.quit();
+        return result;
+    }
+
+    const int64_t switches_start = ContextSwitches();
+    const int64_t start_us = NowUs();
+    const std::vector<double> round_trips_ms =
+            peers.ping_pong(message, round_trips, timeout_ms);
+    const double seconds = (NowUs() - start_us) / 1e6;
+    const int64_t switches = ContextSwitches() - switches_start;
+    // No callback runs once the connection is closed.
+    peers.quit();
+
+    result["round_trips"] = Json::UInt64(round_trips_ms.size());
+    result["round_trips_per_s"] = round_trips_ms.size() / seconds;
+    result["round_trip_p50_ms"] = Percentile(round_trips_ms, 50);
+    result["round_trip_p99_ms"] = Percentile(round_trips_ms, 99);
+    result["context_switches_per_round_trip"] =
+            round_trips_ms.empty()
+                    ? -1.0
+                    : double(switches) / round_trips_ms.size();
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    return RunListedCases(flags, "loops", "physical,asio",
+                          [&](const std::string &loop) {
+                              return RunCase(loop, flags);
+                          });
+}
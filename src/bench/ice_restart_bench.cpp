@@ -0,0 +1,131 @@
+#include <json/json.h>
+#include <rtc_base/thread.h>
+#include <rtc_base/virtual_socket_server.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "bench/virtual_network.h"
+#include "util/json_utils.h"
+
+// Recovery of a DataChannel session from a network outage between two
+// in-process peers over a rtc::VirtualSocketServer. The offerer sends a
+// paced load; after warmup_ms every packet is dropped for outage_ms. Runs
+// the session as it is, and with WebRTCManager::enable_ice_restart().
+// Reports when ICE noticed the loss and the path came back, relative to the
+// outage, when the messages flowed again, and the offerer's
+// IceRecoveryStats.
+//
+// Flags (key=value):
+//   modes         comma-separated modes to run (none,restart)
+//   outage_ms     duration of the outage (15000)
+//   warmup_ms     traffic before the outage (2000)
+//   resume_ms     time the messages get to flow again after the outage
+//                 (30000)
+//   rate_kbps     offered DataChannel load (500)
+//   message_size  DataChannel message size in bytes (1200)
+//   timeout_ms    timeout of the connection setup (30000)
+//   report        also write the report to this file
+
+Json::Value RunCase(const std::string &mode, const BenchFlags &flags) {
+    const int outage_ms = flags.get_int("outage_ms", 15000);
+    const int warmup_ms = flags.get_int("warmup_ms", 2000);
+    const int resume_ms = flags.get_int("resume_ms", 30000);
+    const int rate_kbps = flags.get_int("rate_kbps", 500);
+    const size_t message_size = flags.get_int("message_size", 1200);
+    const int timeout_ms = flags.get_int("timeout_ms", 30000);
+    Json::Value result;
+    result["mode"] = mode;
+    if (mode != "none" && mode != "restart") {
+        throw std::runtime_error("Unknown mode: " + mode);
+    }
+
+    rtc::VirtualSocketServer socket_server;
+    rtc::Thread network_thread(&socket_server);
+    network_thread.Start();
+    VirtualNetwork offerer_network(&socket_server, "10.0.0.1");
+    VirtualNetwork answerer_network(&socket_server, "10.0.0.2");
+    PeerPair peers;
+    peers.offerer.external_network_thread = &network_thread;
+    peers.answerer.external_network_thread = &network_thread;
+    offerer_network.attach(peers.offerer);
+    answerer_network.attach(peers.answerer);
+
+    std::atomic<int64_t> lost_us{-1};
+    std::atomic<int64_t> restored_us{-1};
+    std::atomic<bool> failed{false};
+    // Only reported with ICE restart enabled.
+    peers.offerer.on_path_change([&](bool up) {
+        if (up) {
+            restored_us = peers.now_us();
+        } else if (lost_us < 0) {
+            lost_us = peers.now_us();
+        }
+    });
+    peers.offerer.on_error([&](const OperationError &) { failed = true; });
+    peers.init();
+    if (mode == "restart") {
+        for (WebRTCManager *manager : {&peers.offerer, &peers.answerer}) {
+            manager->enable_ice_restart(IceRestartConfig());
+        }
+    }
+    const double connect_ms = peers.connect(timeout_ms);
+    result["connect_ms"] = connect_ms;
+    if (connect_ms < 0) {
+        peers.quit();
+        network_thread.Stop();
+        return result;
+    }
+
+    // Keep sending until the flow had its chance to resume.
+    std::thread sender([&]() {
+        peers.send_paced(rate_kbps, message_size,
+                         warmup_ms + outage_ms + resume_ms, 0);
+    });
+    peers.sleep_ms(warmup_ms);
+    const int64_t outage_start_us = peers.now_us();
+    network_thread.Invoke<void>(RTC_FROM_HERE, [&]() {
+        socket_server.set_drop_probability(1);
+    });
+    peers.sleep_ms(outage_ms);
+    network_thread.Invoke<void>(RTC_FROM_HERE, [&]() {
+        socket_server.set_drop_probability(0);
+    });
+    const int64_t outage_end_us = peers.now_us();
+
+    // First message through after the outage.
+    const size_t bytes_before = peers.bytes_received();
+    double resumed_ms = -1;
+    for (int waited_ms = 0; waited_ms < resume_ms && !failed; waited_ms += 10) {
+        if (peers.bytes_received() > bytes_before) {
+            resumed_ms = (peers.now_us() - outage_end_us) / 1000.0;
+            break;
+        }
+        peers.sleep_ms(10);
+    }
+    sender.join();
+
+    result["outage_ms"] = outage_ms;
+    result["detection_ms"] =
+            lost_us >= 0 ? (lost_us - outage_start_us) / 1000.0 : -1;
+    result["path_restored_ms"] =
+            restored_us >= 0 ? (restored_us - outage_end_us) / 1000.0 : -1;
+    result["messages_resumed_ms"] = resumed_ms;
+    result["session_failed"] = failed.load();
+    result["recovery"] = peers.offerer.ice_recovery_stats().ToJson();
+    peers.quit();
+    network_thread.Stop();
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    return RunListedCases(flags, "modes", "none,restart",
+                          [&](const std::string &mode) {
+                              return RunCase(mode, flags);
+                          });
+}
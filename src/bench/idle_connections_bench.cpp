@@ -0,0 +1,170 @@
+#include <json/json.h>
+#include <rtc_base/virtual_socket_server.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if MEMORY_ACCOUNTING
+#include "util/memory_accounting_hooks.h"
+#endif
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "bench/virtual_network.h"
+#include "util/json_utils.h"
+#include "util/memory_accounting.h"
+
+// Memory footprint of idle connections. Opens |connections| PeerConnections
+// (half offerers, half answerers) in one process over a
+// rtc::VirtualSocketServer, lets them idle, and reports the RSS growth per
+// connection. All managers share one network, worker and signaling thread,
+// as a server holding many connections would.
+//
+// The idle_connections_accounting_bench build also charges heap allocations
+// to each manager (util/memory_accounting_hooks.h). Since the threads are
+// shared, WebRTC's internal allocations outside of the managers' calls and
+// callbacks are reported as unattributed.
+//
+// With idle_mode=1 the managers enter idle mode (see
+// WebRTCManager::enable_idle_mode()) after idle_after_ms without messages.
+// Compare the RSS and the wakeups per connection, i.e. the context switches
+// of the process during the idle period, against a run without it.
+//
+// Flags (key=value):
+//   connections    number of PeerConnections, rounded down to even (10000)
+//   idle_s         time to idle once all are connected (10)
+//   timeout_ms     timeout of each connection setup (30000)
+//   idle_mode      enable idle mode on every manager (0)
+//   idle_after_ms  quiet period before a connection goes idle (5000)
+//   report         also write the report to this file
+
+double Mb(int64_t bytes) { return bytes / 1048576.0; }
+
+// Voluntary and involuntary context switches of the process so far.
+int64_t ContextSwitches() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    const int num_pairs = flags.get_int("connections", 10000) / 2;
+    const int timeout_ms = flags.get_int("timeout_ms", 30000);
+    const bool idle_mode = flags.get_int("idle_mode", 0) != 0;
+    IdleConfig idle_config;
+    idle_config.quiet_period_ms = flags.get_int("idle_after_ms", 5000);
+
+    rtc::VirtualSocketServer socket_server;
+    rtc::Thread network_thread(&socket_server);
+    network_thread.Start();
+    std::unique_ptr<rtc::Thread> worker_thread = rtc::Thread::Create();
+    worker_thread->Start();
+    std::unique_ptr<rtc::Thread> signaling_thread = rtc::Thread::Create();
+    signaling_thread->Start();
+
+    const int64_t rss_baseline = CurrentRssBytes();
+    std::vector<std::unique_ptr<VirtualNetwork>> networks;
+    std::vector<std::unique_ptr<PeerPair>> pairs;
+    int num_connected = 0;
+    std::atomic<int> num_idle(0);
+    for (int i = 0; i < num_pairs; ++i) {
+        const std::string host =
+                std::to_string(i / 250) + "." + std::to_string(i % 250 + 1);
+        std::unique_ptr<PeerPair> peers(new PeerPair());
+        for (WebRTCManager *manager : {&peers->offerer, &peers->answerer}) {
+            const std::string ip =
+                    (manager == &peers->offerer ? "10.0." : "10.1.") + host;
+            networks.emplace_back(new VirtualNetwork(&socket_server, ip));
+            networks.back()->attach(*manager);
+            manager->external_network_thread = &network_thread;
+            manager->external_worker_thread = worker_thread.get();
+            manager->external_signaling_thread = signaling_thread.get();
+            manager->on_idle_change(
+                    [&](bool idle) { num_idle += idle ? 1 : -1; });
+        }
+        peers->init();
+        if (idle_mode) {
+            peers->offerer.enable_idle_mode(idle_config);
+            peers->answerer.enable_idle_mode(idle_config);
+        }
+        if (peers->connect(timeout_ms) >= 0) {
+            ++num_connected;
+        }
+        pairs.push_back(std::move(peers));
+        if ((i + 1) % 500 == 0) {
+            std::cout << "connected " << 2 * num_connected << " of "
+                      << 2 * (i + 1) << ", RSS "
+                      << Mb(CurrentRssBytes() - rss_baseline) << "MB"
+                      << std::endl;
+        }
+    }
+    const int64_t rss_connected = CurrentRssBytes();
+    if (idle_mode) {
+        // Let every connection reach idle mode before measuring.
+        std::this_thread::sleep_for(
+                std::chrono::milliseconds(idle_config.quiet_period_ms * 5 / 4));
+    }
+    const int idle_s = flags.get_int("idle_s", 10);
+    const int64_t switches_start = ContextSwitches();
+    std::this_thread::sleep_for(std::chrono::seconds(idle_s));
+    const int64_t switches_idle = ContextSwitches() - switches_start;
+    const int64_t rss_idle = CurrentRssBytes();
+
+    const int num_connections = 2 * num_pairs;
+    Json::Value report;
+    report["connections"] = num_connections;
+    report["connected"] = 2 * num_connected;
+    report["idle_mode"] = idle_mode;
+    report["idle"] = num_idle.load();
+    report["rss_baseline_mb"] = Mb(rss_baseline);
+    report["rss_connected_mb"] = Mb(rss_connected);
+    report["rss_idle_mb"] = Mb(rss_idle);
+    report["rss_per_connection_kb"] =
+            (rss_idle - rss_baseline) / 1024.0 / num_connections;
+    report["wakeups_per_connection_per_min"] =
+            switches_idle * 60.0 / idle_s / num_connections;
+
+    WebRTCManager::MemoryUsage total;
+    total.heap_bytes = 0;
+    int64_t max_heap_bytes = 0;
+    for (const std::unique_ptr<PeerPair> &peers : pairs) {
+        for (WebRTCManager *manager : {&peers->offerer, &peers->answerer}) {
+            const WebRTCManager::MemoryUsage usage = manager->memory_usage();
+            total.heap_bytes += usage.heap_bytes;
+            total.queued_message_bytes += usage.queued_message_bytes;
+            total.pending_ice_bytes += usage.pending_ice_bytes;
+            total.trace_bytes += usage.trace_bytes;
+            max_heap_bytes = std::max(max_heap_bytes, usage.heap_bytes);
+        }
+    }
+    report["queued_message_bytes"] = Json::UInt64(total.queued_message_bytes);
+    report["pending_ice_bytes"] = Json::UInt64(total.pending_ice_bytes);
+    report["trace_bytes_per_connection"] =
+            double(total.trace_bytes) / num_connections;
+    if (MemoryAccount::Enabled()) {
+        report["heap_per_connection_kb"] =
+                total.heap_bytes / 1024.0 / num_connections;
+        report["heap_max_connection_kb"] = max_heap_bytes / 1024.0;
+        report["heap_unattributed_mb"] =
+                Mb(MemoryAccount::Unattributed().bytes());
+    }
+
+    for (const std::unique_ptr<PeerPair> &peers : pairs) {
+        peers->quit();
+    }
+    pairs.clear();
+    worker_thread->Stop();
+    signaling_thread->Stop();
+    network_thread.Stop();
+
+    WriteReport(flags, report);
+    return 0;
+}
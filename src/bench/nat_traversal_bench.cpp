@@ -0,0 +1,221 @@
+#include <json/json.h>
+#include <p2p/base/test_stun_server.h>
+#include <p2p/base/test_turn_server.h>
+#include <rtc_base/nat_socket_factory.h>
+#include <rtc_base/nat_types.h>
+#include <rtc_base/virtual_socket_server.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "bench/stats_helpers.h"
+#include "bench/virtual_network.h"
+#include "util/json_utils.h"
+
+// NAT traversal matrix. Each peer sits behind an in-process rtc::NATServer of
+// every rtc::NATType (or has a public address), with a local STUN and TURN
+// server on the virtual internet. For every combination it reports the
+// candidate types of the selected pair, the time to connect and the
+// DataChannel throughput, and compares a direct path with a relay-only one to
+// get the relay penalty.
+//
+// Flags (key=value):
+//   delay_ms        one-way delay of the virtual network (10)
+//   bandwidth_kbps  bandwidth of the virtual network (10000)
+//   total_bytes     bytes sent per case (2097152)
+//   message_size    DataChannel message size in bytes (16384)
+//   timeout_ms      timeout of each phase (30000)
+//   report          also write the report to this file
+
+const char kStunAddress[] = "99.99.99.1";
+const char kTurnAddress[] = "99.99.99.2";
+const char kTurnExternalAddress[] = "99.99.99.3";
+const int kServerPort = 3478;
+
+struct NatSetting {
+    std::string name;
+    bool behind_nat;
+    rtc::NATType type;
+};
+
+std::vector<NatSetting> NatSettings() {
+    return {
+            {"public", false, rtc::NAT_OPEN_CONE},
+            {"open_cone", true, rtc::NAT_OPEN_CONE},
+            {"addr_restricted", true, rtc::NAT_ADDR_RESTRICTED},
+            {"port_restricted", true, rtc::NAT_PORT_RESTRICTED},
+            {"symmetric", true, rtc::NAT_SYMMETRIC},
+    };
+}
+
+// The virtual internet: one network thread on a NATSocketServer over a
+// VirtualSocketServer, with the STUN and TURN servers on public addresses.
+class NatTestBed {
+public:
+    NatTestBed(const BenchFlags &flags)
+        : nat_server_(&virtual_server_), network_thread_(&nat_server_) {
+        network_thread_.Start();
+        network_thread_.Invoke<void>(RTC_FROM_HERE, [&]() {
+            virtual_server_.set_delay_mean(flags.get_int("delay_ms", 10));
+            virtual_server_.UpdateDelayDistribution();
+            virtual_server_.set_bandwidth(
+                    flags.get_int("bandwidth_kbps", 10000) * 1000 / 8);
+            stun_server_.reset(cricket::TestStunServer::Create(
+                    &virtual_server_,
+                    rtc::SocketAddress(kStunAddress, kServerPort)));
+            turn_server_.reset(new cricket::TestTurnServer(
+                    &network_thread_,
+                    rtc::SocketAddress(kTurnAddress, kServerPort),
+                    rtc::SocketAddress(kTurnExternalAddress, 0)));
+        });
+    }
+
+    ~NatTestBed() {
+        network_thread_.Invoke<void>(RTC_FROM_HERE, [&]() {
+            stun_server_.reset();
+            turn_server_.reset();
+        });
+        network_thread_.Stop();
+    }
+
+    // Put the host |index| (1 or 2) behind |nat| and return the address of
+    // its interface.
+    std::string add_host(int index, const NatSetting &nat) {
+        const std::string i = std::to_string(index);
+        if (!nat.behind_nat) {
+            return "11.0.0." + i;
+        }
+        network_thread_.Invoke<void>(RTC_FROM_HERE, [&]() {
+            nat_server_
+                    .AddTranslator(rtc::SocketAddress("22.0.0." + i, 0),
+                                   rtc::SocketAddress("192.168." + i + ".1", 0),
+                                   nat.type)
+                    ->AddClient(rtc::SocketAddress("192.168." + i + ".2", 0));
+        });
+        return "192.168." + i + ".2";
+    }
+
+    void remove_host(int index, const NatSetting &nat) {
+        if (!nat.behind_nat) {
+            return;
+        }
+        network_thread_.Invoke<void>(RTC_FROM_HERE, [&]() {
+            nat_server_.RemoveTranslator(rtc::SocketAddress(
+                    "22.0.0." + std::to_string(index), 0));
+        });
+    }
+
+    // Use the local STUN and TURN servers only.
+    void configure(WebRTCManager &manager, bool relay_only) {
+        manager.external_network_thread = &network_thread_;
+        manager.configuration.servers.clear();
+        webrtc::PeerConnectionInterface::IceServer stun;
+        stun.uri = std::string("stun:") + kStunAddress + ":" +
+                   std::to_string(kServerPort);
+        manager.configuration.servers.push_back(stun);
+        // TestTurnServer accepts any user whose password is its name.
+        webrtc::PeerConnectionInterface::IceServer turn;
+        turn.uri = std::string("turn:") + kTurnAddress + ":" +
+                   std::to_string(kServerPort) + "?transport=udp";
+        turn.username = "bench";
+        turn.password = "bench";
+        manager.configuration.servers.push_back(turn);
+        if (relay_only) {
+            manager.configuration.type =
+                    webrtc::PeerConnectionInterface::IceTransportsType::kRelay;
+        }
+    }
+
+    rtc::SocketFactory *socket_factory() { return &nat_server_; }
+
+private:
+    rtc::VirtualSocketServer virtual_server_;
+    rtc::NATSocketServer nat_server_;
+    rtc::Thread network_thread_;
+    std::unique_ptr<cricket::TestStunServer> stun_server_;
+    std::unique_ptr<cricket::TestTurnServer> turn_server_;
+};
+
+Json::Value RunCase(NatTestBed &test_bed,
+                    const NatSetting &offerer_nat,
+                    const NatSetting &answerer_nat,
+                    bool relay_only,
+                    const BenchFlags &flags) {
+    const int timeout_ms = flags.get_int("timeout_ms", 30000);
+    Json::Value result;
+    result["offerer_nat"] = offerer_nat.name;
+    result["answerer_nat"] = answerer_nat.name;
+    result["relay_only"] = relay_only;
+
+    VirtualNetwork offerer_network(test_bed.socket_factory(),
+                                   test_bed.add_host(1, offerer_nat));
+    VirtualNetwork answerer_network(test_bed.socket_factory(),
+                                    test_bed.add_host(2, answerer_nat));
+    {
+        PeerPair peers;
+        offerer_network.attach(peers.offerer);
+        answerer_network.attach(peers.answerer);
+        test_bed.configure(peers.offerer, relay_only);
+        test_bed.configure(peers.answerer, relay_only);
+        peers.init();
+
+        const double connect_ms = peers.connect(timeout_ms);
+        result["connect_ms"] = connect_ms;
+        if (connect_ms >= 0) {
+            const auto report = GetStatsReport(peers.offerer);
+            result["candidates"] =
+                    report ? SelectedCandidateTypes(*report) : "";
+            const ThroughputResult throughput = peers.send_bulk(
+                    flags.get_int("message_size", 16384),
+                    flags.get_int("total_bytes", 2 << 20), timeout_ms);
+            result["throughput_mbps"] = throughput.mbps;
+        }
+        peers.quit();
+    }
+    test_bed.remove_host(1, offerer_nat);
+    test_bed.remove_host(2, answerer_nat);
+
+    std::cout << JsonToString(result) << std::endl;
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    NatTestBed test_bed(flags);
+
+    Json::Value report;
+    report["matrix"] = Json::Value(Json::arrayValue);
+    const std::vector<NatSetting> nat_settings = NatSettings();
+    for (const NatSetting &offerer_nat : nat_settings) {
+        for (const NatSetting &answerer_nat : nat_settings) {
+            report["matrix"].append(RunCase(test_bed, offerer_nat,
+                                            answerer_nat, false, flags));
+        }
+    }
+
+    // Same hosts, direct path against relay-only.
+    const NatSetting &open_cone = nat_settings[1];
+    const Json::Value direct =
+            RunCase(test_bed, open_cone, open_cone, false, flags);
+    const Json::Value relayed =
+            RunCase(test_bed, open_cone, open_cone, true, flags);
+    const double direct_mbps = direct.get("throughput_mbps", 0).asDouble();
+    const double relayed_mbps = relayed.get("throughput_mbps", 0).asDouble();
+    report["relay_penalty"]["direct_mbps"] = direct_mbps;
+    report["relay_penalty"]["relayed_mbps"] = relayed_mbps;
+    report["relay_penalty"]["connect_ms_added"] =
+            relayed.get("connect_ms", 0).asDouble() -
+            direct.get("connect_ms", 0).asDouble();
+    if (direct_mbps > 0) {
+        report["relay_penalty"]["throughput_loss"] =
+                1 - relayed_mbps / direct_mbps;
+    }
+
+    WriteReport(flags, report);
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <api/test/create_network_emulation_manager.h>
+#include <api/test/network_emulation_manager.h>
+#include <api/test/simulated_network.h>
+#include <json/json.h>
+#include <p2p/client/basic_port_allocator.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "util/json_utils.h"
+
+// Runs the DataChannel workload through webrtc::NetworkEmulationManager
+// profiles and reports connection time, goodput and one-way latency
+// percentiles per profile as JSON. Profiles are described from the
+// offerer's side: its messages cross the profile's uplink, and what the
+// answerer sends back (SCTP acknowledgements, replies) leaves on the
+// answerer's own uplink, which is the profile's downlink. The goodput and
+// latencies measure the profile's uplink.
+//
+// Flags (key=value):
+//   profile       run only this profile (all)
+//   time_mode     "simulated" or "real" (simulated)
+//   duration_s    traffic duration per profile (30)
+//   rate_kbps     offered DataChannel load (1000)
+//   message_size  DataChannel message size in bytes (1200)
+//   timeout_ms    timeout of the handshake (30000)
+//   report        also write the report to this file
+
+struct NetworkProfile {
+    std::string name;
+    webrtc::BuiltInNetworkBehaviorConfig uplink;
+    webrtc::BuiltInNetworkBehaviorConfig downlink;
+};
+
+std::vector<NetworkProfile> NetworkProfiles() {
+    std::vector<NetworkProfile> profiles;
+
+    NetworkProfile wired;
+    wired.name = "wired";
+    wired.uplink.queue_delay_ms = 5;
+    wired.uplink.link_capacity_kbps = 100000;
+    wired.downlink = wired.uplink;
+    profiles.push_back(wired);
+
+    NetworkProfile congested_4g;
+    congested_4g.name = "4g_congested_uplink";
+    congested_4g.uplink.queue_delay_ms = 60;
+    congested_4g.uplink.delay_standard_deviation_ms = 20;
+    congested_4g.uplink.link_capacity_kbps = 1500;
+    congested_4g.uplink.queue_length_packets = 50;
+    congested_4g.uplink.loss_percent = 1;
+    congested_4g.downlink.queue_delay_ms = 40;
+    congested_4g.downlink.delay_standard_deviation_ms = 10;
+    congested_4g.downlink.link_capacity_kbps = 10000;
+    profiles.push_back(congested_4g);
+
+    NetworkProfile lossy_wifi;
+    lossy_wifi.name = "lossy_wifi";
+    lossy_wifi.uplink.queue_delay_ms = 10;
+    lossy_wifi.uplink.delay_standard_deviation_ms = 5;
+    lossy_wifi.uplink.link_capacity_kbps = 20000;
+    lossy_wifi.uplink.loss_percent = 5;
+    lossy_wifi.uplink.avg_burst_loss_length = 3;
+    lossy_wifi.uplink.allow_reordering = true;
+    lossy_wifi.downlink = lossy_wifi.uplink;
+    profiles.push_back(lossy_wifi);
+
+    NetworkProfile satellite;
+    satellite.name = "satellite";
+    satellite.uplink.queue_delay_ms = 300;
+    satellite.uplink.link_capacity_kbps = 5000;
+    satellite.uplink.loss_percent = 1;
+    satellite.downlink = satellite.uplink;
+    profiles.push_back(satellite);
+
+    return profiles;
+}
+
+// Give |manager| the network thread and interfaces of |network|.
+void AttachEmulatedNetwork(WebRTCManager &manager,
+                           webrtc::EmulatedNetworkManagerInterface *network) {
+    manager.configuration.servers.clear();
+    manager.external_network_thread = network->network_thread();
+    manager.create_port_allocator = [network]() {
+        return std::unique_ptr<cricket::PortAllocator>(
+                new cricket::BasicPortAllocator(network->network_manager()));
+    };
+}
+
+Json::Value RunProfile(const NetworkProfile &profile,
+                       const BenchFlags &flags) {
+    const bool simulated =
+            flags.get_string("time_mode", "simulated") == "simulated";
+    std::unique_ptr<webrtc::NetworkEmulationManager> emulation =
+            webrtc::CreateNetworkEmulationManager(
+                    simulated ? webrtc::TimeMode::kSimulated
+                              : webrtc::TimeMode::kRealTime);
+
+    webrtc::EmulatedNetworkNode *uplink =
+            emulation->CreateEmulatedNode(profile.uplink);
+    webrtc::EmulatedNetworkNode *downlink =
+            emulation->CreateEmulatedNode(profile.downlink);
+    webrtc::EmulatedEndpoint *offerer_endpoint =
+            emulation->CreateEndpoint(webrtc::EmulatedEndpointConfig());
+    webrtc::EmulatedEndpoint *answerer_endpoint =
+            emulation->CreateEndpoint(webrtc::EmulatedEndpointConfig());
+    emulation->CreateRoute(offerer_endpoint, {uplink}, answerer_endpoint);
+    emulation->CreateRoute(answerer_endpoint, {downlink}, offerer_endpoint);
+
+    PeerPair peers;
+    if (simulated) {
+        peers.use_time_controller(emulation->time_controller());
+    }
+    AttachEmulatedNetwork(peers.offerer,
+                          emulation->CreateEmulatedNetworkManagerInterface(
+                                  {offerer_endpoint}));
+    AttachEmulatedNetwork(peers.answerer,
+                          emulation->CreateEmulatedNetworkManagerInterface(
+                                  {answerer_endpoint}));
+    peers.init();
+
+    Json::Value result;
+    result["profile"] = profile.name;
+    const double connect_ms =
+            peers.connect(flags.get_int("timeout_ms", 30000));
+    result["connect_ms"] = connect_ms;
+    if (connect_ms >= 0) {
+        const ThroughputResult goodput = peers.send_paced(
+                flags.get_int("rate_kbps", 1000),
+                flags.get_int("message_size", 1200),
+                flags.get_int("duration_s", 30) * 1000);
+        result["goodput_kbps"] = goodput.mbps * 1000;
+        result["bytes_received"] = Json::UInt64(goodput.bytes_received);
+        result["latency_p50_ms"] = peers.latency_percentile_ms(50);
+        result["latency_p90_ms"] = peers.latency_percentile_ms(90);
+        result["latency_p99_ms"] = peers.latency_percentile_ms(99);
+    }
+    peers.quit();
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    const std::string only_profile = flags.get_string("profile", "");
+
+    Json::Value report(Json::arrayValue);
+    for (const NetworkProfile &profile : NetworkProfiles()) {
+        if (!only_profile.empty() && profile.name != only_profile) {
+            continue;
+        }
+        std::cout << "Running profile " << profile.name << std::endl;
+        report.append(RunProfile(profile, flags));
+    }
+
+    WriteReport(flags, report);
+    return 0;
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <api/test/create_time_controller.h>
+#include <api/test/time_controller.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_stats.h"
+#include "util/webrtc_manager.h"
+
+struct ThroughputResult {
+    size_t bytes_received = 0;
+    double seconds = 0;
+    double mbps = 0;
+};
+
+// Two WebRTCManager peers in one process. Signaling messages are handed over
+// by direct calls instead of a WebSocket, so the only network involved is
+// the one the managers' sockets are bound to.
+//
+// Every DataChannel message starts with its send time, so the answerer can
+// record one-way latencies. With a time controller, waits advance its
+// (simulated) time and all durations are measured on its clock.
+class PeerPair {
+public:
+    PeerPair() : offerer("offerer"), answerer("answerer") {
+        offerer.connection.verbose = false;
+        answerer.connection.verbose = false;
+    }
+
+    // Run both peers on worker and signaling threads, task queues and calls
+    // of |controller|. The network thread is set separately.
+    void use_time_controller(webrtc::TimeController *controller) {
+        time_controller = controller;
+        for (WebRTCManager *manager : {&offerer, &answerer}) {
+            threads_.push_back(
+                    controller->CreateThread(manager->name + "_worker"));
+            manager->external_worker_thread = threads_.back().get();
+            threads_.push_back(
+                    controller->CreateThread(manager->name + "_signaling"));
+            manager->external_signaling_thread = threads_.back().get();
+            manager->task_queue_factory = controller->CreateTaskQueueFactory();
+            manager->call_factory =
+                    webrtc::CreateTimeControllerBasedCallFactory(controller);
+        }
+    }
+
+    // Set up the signaling between the peers and start both managers. Any
+    // dependency of the managers must be set before.
+    void init() {
+        offerer.on_sdp([&](const std::string &sdp) {
+            answerer.create_answer_sdp(sdp);
+        });
+        answerer.on_sdp(
+                [&](const std::string &sdp) { offerer.push_reply_sdp(sdp); });
+        offerer.on_ice([&](const Ice &ice) { answerer.push_ice(ice); });
+        answerer.on_ice([&](const Ice &ice) { offerer.push_ice(ice); });
+        offerer.on_success([&]() { notify(num_open_); });
+        answerer.on_success([&]() { notify(num_open_); });
+        answerer.on_message([&](const std::string &message) {
+            int64_t sent_us;
+            std::memcpy(&sent_us, message.data(), sizeof(sent_us));
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                latencies_ms_.push_back((now_us() - sent_us) / 1000.0);
+            }
+            bytes_received_ += message.size();
+            notify(num_messages_);
+        });
+        offerer.init();
+        answerer.init();
+    }
+
+    // Run the offer/answer handshake. Returns the time until the DataChannel
+    // is open on both sides, in ms, or -1 on timeout.
+    double connect(int timeout_ms) {
+        const int64_t start_us = now_us();
+        offerer.create_offer_sdp();
+        if (!wait_for(num_open_, 2, timeout_ms)) {
+            return -1;
+        }
+        return (now_us() - start_us) / 1000.0;
+    }
+
+    // Send |total_bytes| from the offerer to the answerer in messages of
+    // |message_size| bytes, keeping at most |max_buffered| bytes queued in
+    // the DataChannel.
+    ThroughputResult send_bulk(size_t message_size,
+                               size_t total_bytes,
+                               int timeout_ms,
+                               uint64_t max_buffered = 1 << 20) {
+        const int num_messages =
+                static_cast<int>((total_bytes + message_size - 1) /
+                                 message_size);
+        const int expected = num_messages_ + num_messages;
+        const size_t bytes_before = bytes_received_;
+
+        const int64_t start_us = now_us();
+        for (int i = 0; i < num_messages; ++i) {
+            while (offerer.connection.data_channel->buffered_amount() >
+                   max_buffered) {
+                sleep_ms(1);
+            }
+            send_stamped(message_size);
+        }
+        wait_for(num_messages_, expected, timeout_ms);
+
+        ThroughputResult result;
+        result.seconds = (now_us() - start_us) / 1e6;
+        result.bytes_received = bytes_received_ - bytes_before;
+        result.mbps = result.bytes_received * 8 / result.seconds / 1e6;
+        return result;
+    }
+
+    // DataChannel ping-pong of |round_trips| |message|s: the answerer echoes,
+    // and the offerer sends the next ping from the echo callback, so the
+    // calling thread only starts and waits. Returns the round trips, in ms,
+    // completed within |timeout_ms|. Takes over the on_message callbacks of
+    // init().
+    std::vector<double> ping_pong(const std::string &message,
+                                  int round_trips,
+                                  int timeout_ms) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            round_trips_ms_.clear();
+            round_trips_ms_.reserve(round_trips);
+        }
+        const int expected = num_pongs_ + round_trips;
+        answerer.on_message(
+                [this](const std::string &ping) { answerer.send(ping); });
+        offerer.on_message([this, message, expected](const std::string &) {
+            const int64_t received_us = now_us();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                round_trips_ms_.push_back((received_us - ping_sent_us_) /
+                                          1000.0);
+            }
+            if (num_pongs_ + 1 < expected) {
+                ping_sent_us_ = now_us();
+                offerer.send(message);
+            }
+            notify(num_pongs_);
+        });
+
+        ping_sent_us_ = now_us();
+        offerer.send(message);
+        wait_for(num_pongs_, expected, timeout_ms);
+        std::lock_guard<std::mutex> lock(mutex_);
+        return round_trips_ms_;
+    }
+
+    // Offer a constant load of |rate_kbps| from the offerer for
+    // |duration_ms|, in 10ms ticks, then let the link drain for
+    // |drain_ms|. Returns the goodput over the whole period.
+    ThroughputResult send_paced(int rate_kbps,
+                                size_t message_size,
+                                int duration_ms,
+                                int drain_ms = 1000) {
+        const size_t bytes_before = bytes_received_;
+        const size_t bytes_per_tick = rate_kbps * 1000 / 8 / 100;
+        size_t budget = 0;
+
+        const int64_t start_us = now_us();
+        for (int elapsed_ms = 0; elapsed_ms < duration_ms; elapsed_ms += 10) {
+            budget += bytes_per_tick;
+            while (budget >= message_size) {
+                send_stamped(message_size);
+                budget -= message_size;
+            }
+            sleep_ms(10);
+        }
+        sleep_ms(drain_ms);
+
+        ThroughputResult result;
+        result.seconds = (now_us() - start_us) / 1e6;
+        result.bytes_received = bytes_received_ - bytes_before;
+        result.mbps = result.bytes_received * 8 / result.seconds / 1e6;
+        return result;
+    }
+
+    // Percentile |p| in [0, 100] of the one-way latencies recorded so far.
+    double latency_percentile_ms(double p) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return Percentile(latencies_ms_, p);
+    }
+
+    void quit() {
+        offerer.quit();
+        answerer.quit();
+        for (std::unique_ptr<rtc::Thread> &thread : threads_) {
+            thread->Stop();
+        }
+    }
+
+    int64_t now_us() const {
+        if (time_controller) {
+            return time_controller->GetClock()->TimeInMicroseconds();
+        }
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+    }
+
+    void sleep_ms(int ms) {
+        if (time_controller) {
+            time_controller->AdvanceTime(webrtc::TimeDelta::Millis(ms));
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        }
+    }
+
+    size_t bytes_received() const { return bytes_received_; }
+
+    WebRTCManager offerer;
+    WebRTCManager answerer;
+    webrtc::TimeController *time_controller = nullptr;
+
+private:
+    void send_stamped(size_t message_size) {
+        std::string message(std::max(message_size, sizeof(int64_t)), 'x');
+        const int64_t sent_us = now_us();
+        std::memcpy(&message[0], &sent_us, sizeof(sent_us));
+        offerer.send(message);
+    }
+
+    void notify(std::atomic<int> &counter) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++counter;
+        cv_.notify_all();
+    }
+
+    bool wait_for(std::atomic<int> &counter, int value, int timeout_ms) {
+        if (time_controller) {
+            return time_controller->Wait(
+                    [&]() { return counter >= value; },
+                    webrtc::TimeDelta::Millis(timeout_ms));
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                            [&]() { return counter >= value; });
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<int> num_open_{0};
+    std::atomic<int> num_messages_{0};
+    std::atomic<size_t> bytes_received_{0};
+    std::vector<double> latencies_ms_;
+    // State of ping_pong().
+    std::atomic<int> num_pongs_{0};
+    std::atomic<int64_t> ping_sent_us_{0};
+    std::vector<double> round_trips_ms_;
+    // Threads created by use_time_controller().
+    std::vector<std::unique_ptr<rtc::Thread>> threads_;
+};
@@ -0,0 +1,111 @@
+#include <json/json.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "util/json_utils.h"
+#include "util/sharded_runtime.h"
+
+// Aggregate DataChannel throughput of many concurrent connections on this
+// host against the number of shards of a ShardedRuntime. Every peer is a
+// session attached to the least loaded shard, so both ends of a connection
+// usually land on different shards. Reports the aggregate goodput and each
+// shard's sessions and network thread CPU time during the transfer.
+//
+// Flags (key=value):
+//   shards        comma-separated shard counts to run (1,2,4,8,16,32)
+//   connections   concurrent peer pairs (32)
+//   message_size  DataChannel message size in bytes (1200)
+//   total_bytes   bytes each pair transfers (4194304)
+//   timeout_ms    timeout of each phase (60000)
+//   report        also write the report to this file
+
+Json::Value RunCase(int num_shards, const BenchFlags &flags) {
+    const int connections = flags.get_int("connections", 32);
+    const size_t message_size = flags.get_int("message_size", 1200);
+    const size_t total_bytes = flags.get_int("total_bytes", 4 << 20);
+    const int timeout_ms = flags.get_int("timeout_ms", 60000);
+    Json::Value result;
+    result["shards"] = num_shards;
+
+    ShardedRuntimeConfig config;
+    config.shards = num_shards;
+    ShardedRuntime runtime(config);
+    std::vector<std::unique_ptr<PeerPair>> pairs;
+    std::vector<RtcShard *> shards;
+    for (int i = 0; i < connections; ++i) {
+        pairs.emplace_back(new PeerPair());
+        for (WebRTCManager *manager :
+             {&pairs.back()->offerer, &pairs.back()->answerer}) {
+            // Host candidates only.
+            manager->configuration.servers.clear();
+            shards.push_back(&runtime.attach(*manager));
+        }
+        pairs.back()->init();
+    }
+
+    int connected = 0;
+    for (std::unique_ptr<PeerPair> &pair : pairs) {
+        if (pair->connect(timeout_ms) >= 0) {
+            ++connected;
+        }
+    }
+    result["connected"] = connected;
+    if (connected == connections) {
+        const std::vector<ShardLoad> before = runtime.load();
+        std::vector<ThroughputResult> throughputs(pairs.size());
+        std::vector<std::thread> senders;
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            senders.emplace_back([&, i]() {
+                throughputs[i] = pairs[i]->send_bulk(message_size,
+                                                     total_bytes, timeout_ms);
+            });
+        }
+        for (std::thread &sender : senders) {
+            sender.join();
+        }
+        const std::vector<ShardLoad> after = runtime.load();
+
+        double seconds = 0;
+        size_t bytes = 0;
+        for (const ThroughputResult &throughput : throughputs) {
+            seconds = std::max(seconds, throughput.seconds);
+            bytes += throughput.bytes_received;
+        }
+        result["aggregate_goodput_mbps"] = bytes * 8 / seconds / 1e6;
+        Json::Value loads(Json::arrayValue);
+        double busiest = 0;
+        for (size_t i = 0; i < after.size(); ++i) {
+            const double cpu_seconds = after[i].network_cpu_seconds -
+                                       before[i].network_cpu_seconds;
+            busiest = std::max(busiest, cpu_seconds / seconds);
+            Json::Value load;
+            load["sessions"] = Json::UInt64(after[i].sessions);
+            load["numa_node"] = after[i].numa_node;
+            load["network_cpu_utilization"] = cpu_seconds / seconds;
+            loads.append(load);
+        }
+        result["busiest_network_cpu_utilization"] = busiest;
+        result["shard_loads"] = loads;
+    }
+    for (std::unique_ptr<PeerPair> &pair : pairs) {
+        pair->quit();
+    }
+    for (RtcShard *shard : shards) {
+        shard->detach();
+    }
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    return RunListedCases(flags, "shards", "1,2,4,8,16,32",
+                          [&](const std::string &shard_count) {
+                              return RunCase(std::stoi(shard_count), flags);
+                          });
+}
@@ -0,0 +1,136 @@
+#include <json/json.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_payloads.h"
+#include "util/binary_signaling.h"
+#include "util/json_utils.h"
+
+// Compares the cost of one signaling handshake (offer, answer and one ICE
+// batch per peer) in JSON and in the binary protocol, with and without the
+// compact SDP encoding. Every message is encoded and decoded once.
+
+struct HandshakeCost {
+    size_t bytes = 0;
+    double micros = 0;
+};
+
+size_t JsonHandshake(const std::string &offer,
+                     const std::string &answer,
+                     const std::vector<Ice> &ices) {
+    size_t bytes = 0;
+
+    Json::Value offer_json;
+    offer_json["type"] = "offer";
+    offer_json["sdp"] = offer;
+    const std::string offer_str = JsonToString(offer_json);
+    bytes += offer_str.size();
+    if (StringToJson(offer_str)["sdp"].asString() != offer) {
+        throw std::runtime_error("JSON offer round trip failed.");
+    }
+
+    Json::Value answer_json;
+    answer_json["type"] = "answer";
+    answer_json["answer"] = answer;
+    const std::string answer_str = JsonToString(answer_json);
+    bytes += answer_str.size();
+    if (StringToJson(answer_str)["answer"].asString() != answer) {
+        throw std::runtime_error("JSON answer round trip failed.");
+    }
+
+    for (int peer = 0; peer < 2; ++peer) {
+        const std::string ice_str = Ice::ToJsonString(ices);
+        bytes += ice_str.size();
+        if (Ice::FromJsonBatch(StringToJson(ice_str)).size() != ices.size()) {
+            throw std::runtime_error("JSON ICE round trip failed.");
+        }
+    }
+    return bytes;
+}
+
+size_t BinaryHandshake(const std::string &offer,
+                       const std::string &answer,
+                       const std::vector<Ice> &ices,
+                       bool compact_sdp) {
+    size_t bytes = 0;
+
+    SignalingMessage offer_message;
+    offer_message.type = SignalingMessage::kOffer;
+    offer_message.sdp = offer;
+    const std::string offer_str =
+            EncodeSignalingMessage(offer_message, compact_sdp);
+    bytes += offer_str.size();
+    if (DecodeSignalingMessage(offer_str).sdp != offer) {
+        throw std::runtime_error("Binary offer round trip failed.");
+    }
+
+    SignalingMessage answer_message;
+    answer_message.type = SignalingMessage::kAnswer;
+    answer_message.sdp = answer;
+    const std::string answer_str =
+            EncodeSignalingMessage(answer_message, compact_sdp);
+    bytes += answer_str.size();
+    if (DecodeSignalingMessage(answer_str).sdp != answer) {
+        throw std::runtime_error("Binary answer round trip failed.");
+    }
+
+    SignalingMessage ice_message;
+    ice_message.type = SignalingMessage::kIceBatch;
+    ice_message.ices = ices;
+    for (int peer = 0; peer < 2; ++peer) {
+        const std::string ice_str = EncodeSignalingMessage(ice_message);
+        bytes += ice_str.size();
+        if (DecodeSignalingMessage(ice_str).ices.size() != ices.size()) {
+            throw std::runtime_error("Binary ICE round trip failed.");
+        }
+    }
+    return bytes;
+}
+
+template <typename F>
+HandshakeCost Measure(int iterations, F handshake) {
+    HandshakeCost cost;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        cost.bytes = handshake();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    cost.micros = std::chrono::duration<double, std::micro>(end - start)
+                          .count() /
+                  iterations;
+    return cost;
+}
+
+int main(int argc, char **argv) {
+    const int iterations = argc > 1 ? std::stoi(argv[1]) : 20000;
+    const std::string offer = SampleOfferSdp();
+    const std::string answer = SampleAnswerSdp();
+    const std::vector<Ice> ices = SampleIceCandidates();
+
+    const HandshakeCost json = Measure(
+            iterations, [&]() { return JsonHandshake(offer, answer, ices); });
+    const HandshakeCost binary = Measure(iterations, [&]() {
+        return BinaryHandshake(offer, answer, ices, false);
+    });
+    const HandshakeCost compact = Measure(iterations, [&]() {
+        return BinaryHandshake(offer, answer, ices, true);
+    });
+
+    std::cout << "Handshake: offer, answer, 2 x " << ices.size()
+              << " ICE candidates, " << iterations << " iterations"
+              << std::endl;
+    std::cout << std::left << std::setw(16) << "format" << std::setw(12)
+              << "bytes" << "us/handshake" << std::endl;
+    std::cout << std::setw(16) << "json" << std::setw(12) << json.bytes
+              << json.micros << std::endl;
+    std::cout << std::setw(16) << "binary" << std::setw(12) << binary.bytes
+              << binary.micros << std::endl;
+    std::cout << std::setw(16) << "binary+compact" << std::setw(12)
+              << compact.bytes << compact.micros << std::endl;
+    return 0;
+}
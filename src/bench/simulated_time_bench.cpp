@@ -0,0 +1,89 @@
+#include <api/test/time_controller.h>
+#include <rtc_base/virtual_socket_server.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "bench/virtual_network.h"
+
+// A full session lifecycle on simulated time: both peers run on threads and
+// task queues of one GlobalSimulatedTimeController and talk over a
+// VirtualSocketServer, so minutes of emulated traffic take milliseconds of
+// wall time and a run only depends on its flags.
+//
+// Flags (key=value):
+//   delay_ms        mean one-way delay (20)
+//   jitter_ms       standard deviation of the delay (0)
+//   bandwidth_kbps  link bandwidth, 0 for unlimited (0)
+//   loss            packet drop probability in [0, 1] (0)
+//   duration_s      emulated traffic duration (300)
+//   rate_kbps       offered DataChannel load (256)
+//   message_size    DataChannel message size in bytes (1200)
+//   timeout_ms      emulated timeout of the handshake (60000)
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    const int duration_s = flags.get_int("duration_s", 300);
+    const int rate_kbps = flags.get_int("rate_kbps", 256);
+    const size_t message_size = flags.get_int("message_size", 1200);
+    const auto wall_start = std::chrono::steady_clock::now();
+
+    std::unique_ptr<webrtc::TimeController> time_controller =
+            webrtc::CreateSimulatedTimeController();
+
+    // Owned by the network thread.
+    rtc::VirtualSocketServer *socket_server = new rtc::VirtualSocketServer();
+    const std::unique_ptr<rtc::Thread> network_thread =
+            time_controller->CreateThread(
+                    "network",
+                    std::unique_ptr<rtc::SocketServer>(socket_server));
+    network_thread->Invoke<void>(RTC_FROM_HERE, [&]() {
+        socket_server->set_delay_mean(flags.get_int("delay_ms", 20));
+        socket_server->set_delay_stddev(flags.get_int("jitter_ms", 0));
+        socket_server->UpdateDelayDistribution();
+        socket_server->set_bandwidth(flags.get_int("bandwidth_kbps", 0) *
+                                     1000 / 8);
+        socket_server->set_drop_probability(flags.get_double("loss", 0));
+    });
+
+    VirtualNetwork offerer_network(socket_server, "10.0.0.1");
+    VirtualNetwork answerer_network(socket_server, "10.0.0.2");
+    PeerPair peers;
+    peers.use_time_controller(time_controller.get());
+    peers.offerer.external_network_thread = network_thread.get();
+    peers.answerer.external_network_thread = network_thread.get();
+    offerer_network.attach(peers.offerer);
+    answerer_network.attach(peers.answerer);
+    peers.init();
+
+    const double setup_ms = peers.connect(flags.get_int("timeout_ms", 60000));
+    if (setup_ms < 0) {
+        std::cout << "Connection timed out." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const ThroughputResult goodput =
+            peers.send_paced(rate_kbps, message_size, duration_s * 1000);
+
+    const double wall_ms = std::chrono::duration<double, std::milli>(
+                                   std::chrono::steady_clock::now() -
+                                   wall_start)
+                                   .count();
+    std::cout << "connection setup (emulated): " << setup_ms << "ms"
+              << std::endl;
+    std::cout << "bytes received: " << goodput.bytes_received << " in "
+              << goodput.seconds << "s emulated (" << goodput.mbps
+              << "Mbps)" << std::endl;
+    std::cout << "latency p50/p99: " << peers.latency_percentile_ms(50)
+              << "/" << peers.latency_percentile_ms(99) << "ms" << std::endl;
+    std::cout << "wall time: " << wall_ms << "ms" << std::endl;
+
+    peers.quit();
+    network_thread->Stop();
+    return 0;
+}
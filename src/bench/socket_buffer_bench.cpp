@@ -0,0 +1,89 @@
+#include <json/json.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "util/json_utils.h"
+#include "util/socket_config.h"
+
+// Bursts of DataChannel messages between two peers on this host, once per
+// socket buffer size (WebRTCManager::socket_config). Reports the goodput and
+// the datagrams the kernel dropped for lack of buffer space, counted on the
+// peers' own sockets and host-wide.
+//
+// Flags (key=value):
+//   buffer_sizes  comma-separated SO_RCVBUF/SO_SNDBUF sizes in bytes, 0 for
+//                 the system default (0,4194304)
+//   dscp          DiffServ code point of the peers' packets (-1, unmarked)
+//   port_range    local ports to bind, as min-max (any)
+//   message_size  DataChannel message size in bytes (1200)
+//   total_bytes   bytes to transfer per case (67108864)
+//   max_buffered  bytes the sender may queue in the DataChannel, the size of
+//                 its bursts (16777216)
+//   timeout_ms    timeout of each phase (30000)
+//   report        also write the report to this file
+
+Json::Value RunCase(int buffer_size, const BenchFlags &flags) {
+    const size_t message_size = flags.get_int("message_size", 1200);
+    const size_t total_bytes = flags.get_int("total_bytes", 64 << 20);
+    const uint64_t max_buffered = flags.get_int("max_buffered", 16 << 20);
+    const int timeout_ms = flags.get_int("timeout_ms", 30000);
+    Json::Value result;
+    result["buffer_size"] = buffer_size;
+
+    SocketConfig config;
+    config.receive_buffer_size = buffer_size;
+    config.send_buffer_size = buffer_size;
+    config.dscp = flags.get_int("dscp", -1);
+    const std::string port_range = flags.get_string("port_range", "");
+    if (!port_range.empty()) {
+        sscanf(port_range.c_str(), "%d-%d", &config.min_port,
+               &config.max_port);
+    }
+    PeerPair peers;
+    for (WebRTCManager *manager : {&peers.offerer, &peers.answerer}) {
+        // Host candidates only.
+        manager->configuration.servers.clear();
+        manager->socket_config = config;
+    }
+    peers.init();
+
+    const double connect_ms = peers.connect(timeout_ms);
+    result["connect_ms"] = connect_ms;
+    if (connect_ms < 0) {
+        peers.quit();
+        return result;
+    }
+
+    const UdpDrops offerer_before = peers.offerer.socket_drops();
+    const UdpDrops answerer_before = peers.answerer.socket_drops();
+    const ThroughputResult throughput = peers.send_bulk(
+            message_size, total_bytes, timeout_ms, max_buffered);
+    const UdpDrops offerer_after = peers.offerer.socket_drops();
+    const UdpDrops answerer_after = peers.answerer.socket_drops();
+
+    result["goodput_mbps"] = throughput.mbps;
+    result["bytes_received"] = Json::UInt64(throughput.bytes_received);
+    result["socket_drops"] = Json::UInt64(
+            offerer_after.socket_drops - offerer_before.socket_drops +
+            answerer_after.socket_drops - answerer_before.socket_drops);
+    result["host_receive_buffer_errors"] =
+            Json::UInt64(answerer_after.receive_buffer_errors -
+                         answerer_before.receive_buffer_errors);
+    result["host_send_buffer_errors"] =
+            Json::UInt64(answerer_after.send_buffer_errors -
+                         answerer_before.send_buffer_errors);
+    peers.quit();
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    return RunListedCases(flags, "buffer_sizes", "0,4194304",
+                          [&](const std::string &buffer_size) {
+                              return RunCase(std::stoi(buffer_size), flags);
+                          });
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <api/stats/rtc_stats_collector_callback.h>
+#include <api/stats/rtc_stats_report.h>
+#include <api/stats/rtcstats_objects.h>
+
+#include <chrono>
+#include <future>
+#include <string>
+
+#include "util/stats_exporter.h"
+#include "util/webrtc_manager.h"
+
+// Blocking GetStats() for benchmarks. Returns null on timeout.
+inline rtc::scoped_refptr<const webrtc::RTCStatsReport> GetStatsReport(
+        WebRTCManager &manager, int timeout_ms = 5000) {
+    class Callback : public webrtc::RTCStatsCollectorCallback {
+    public:
+        void OnStatsDelivered(
+                const rtc::scoped_refptr<const webrtc::RTCStatsReport> &report)
+                override {
+            promise.set_value(report);
+        }
+
+        std::promise<rtc::scoped_refptr<const webrtc::RTCStatsReport>> promise;
+    };
+
+    rtc::scoped_refptr<Callback> callback(
+            new rtc::RefCountedObject<Callback>());
+    auto report = callback->promise.get_future();
+    manager.connection.peer_connection->GetStats(callback.get());
+    if (report.wait_for(std::chrono::milliseconds(timeout_ms)) !=
+        std::future_status::ready) {
+        return nullptr;
+    }
+    return report.get();
+}
+
+// Candidate types of the selected pair, e.g. "srflx/relay" for a local
+// server-reflexive and a remote relay candidate. Empty if none is selected.
+inline std::string SelectedCandidateTypes(
+        const webrtc::RTCStatsReport &report) {
+    const webrtc::RTCIceCandidatePairStats *pair =
+            FindSelectedCandidatePair(report);
+    if (pair == nullptr) {
+        return "";
+    }
+    const webrtc::RTCStats *local = report.Get(*pair->local_candidate_id);
+    const webrtc::RTCStats *remote = report.Get(*pair->remote_candidate_id);
+    if (local == nullptr || remote == nullptr) {
+        return "";
+    }
+    return *local->cast_to<webrtc::RTCLocalIceCandidateStats>()
+                    .candidate_type +
+           "/" +
+           *remote->cast_to<webrtc::RTCRemoteIceCandidateStats>()
+                    .candidate_type;
+}
@@ -0,0 +1,126 @@
+#include <json/json.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "util/json_utils.h"
+#include "util/thread_config.h"
+#include "util/thread_group.h"
+
+// Concurrent bulk DataChannel transfers between pairs of peers on this host,
+// all running on shared thread groups (RtcThreadGroup), one group per NUMA
+// node. Compares the placements:
+//   unpinned  the groups' threads go wherever the scheduler puts them
+//   numa      each group runs on its node and a connection's peers share a
+//             group (NumaThreadGroups)
+//   split     each connection's network thread runs on one node and its
+//             worker and signaling threads on the next, the placement
+//             unpinned threads drift into
+// Reports the aggregate goodput and one-way latency percentiles. On a host
+// with one NUMA node the placements only differ in pinning.
+//
+// Flags (key=value):
+//   placements    comma-separated placements to run (unpinned,numa,split)
+//   connections   concurrent peer pairs (8)
+//   message_size  DataChannel message size in bytes (1200)
+//   total_bytes   bytes each pair transfers (16777216)
+//   timeout_ms    timeout of each phase (30000)
+//   report        also write the report to this file
+
+Json::Value RunCase(const std::string &placement, const BenchFlags &flags) {
+    const int connections = flags.get_int("connections", 8);
+    const size_t message_size = flags.get_int("message_size", 1200);
+    const size_t total_bytes = flags.get_int("total_bytes", 16 << 20);
+    const int timeout_ms = flags.get_int("timeout_ms", 30000);
+    Json::Value result;
+    result["placement"] = placement;
+
+    const std::vector<int> nodes = NumaNodes();
+    result["numa_nodes"] = Json::UInt64(nodes.size());
+    std::vector<std::unique_ptr<RtcThreadGroup>> groups;
+    for (int node : nodes) {
+        if (placement == "unpinned") {
+            groups.emplace_back(
+                    new RtcThreadGroup("node" + std::to_string(node)));
+        } else if (placement == "numa" || placement == "split") {
+            groups.emplace_back(new RtcThreadGroup(
+                    "node" + std::to_string(node), node));
+        } else {
+            throw std::runtime_error("Unknown placement: " + placement);
+        }
+    }
+
+    std::vector<std::unique_ptr<PeerPair>> pairs;
+    for (int i = 0; i < connections; ++i) {
+        pairs.emplace_back(new PeerPair());
+        RtcThreadGroup &group = *groups[i % groups.size()];
+        RtcThreadGroup &next = *groups[(i + 1) % groups.size()];
+        for (WebRTCManager *manager :
+             {&pairs.back()->offerer, &pairs.back()->answerer}) {
+            // Host candidates only.
+            manager->configuration.servers.clear();
+            group.attach(*manager);
+            if (placement == "split") {
+                manager->external_worker_thread = next.worker_thread();
+                manager->external_signaling_thread = next.signaling_thread();
+            }
+        }
+        pairs.back()->init();
+    }
+
+    int connected = 0;
+    for (std::unique_ptr<PeerPair> &pair : pairs) {
+        if (pair->connect(timeout_ms) >= 0) {
+            ++connected;
+        }
+    }
+    result["connected"] = connected;
+    if (connected == connections) {
+        std::vector<ThroughputResult> throughputs(pairs.size());
+        std::vector<std::thread> senders;
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            senders.emplace_back([&, i]() {
+                throughputs[i] = pairs[i]->send_bulk(message_size,
+                                                     total_bytes, timeout_ms);
+            });
+        }
+        for (std::thread &sender : senders) {
+            sender.join();
+        }
+        double seconds = 0;
+        size_t bytes = 0;
+        std::vector<double> p50s;
+        std::vector<double> p99s;
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            seconds = std::max(seconds, throughputs[i].seconds);
+            bytes += throughputs[i].bytes_received;
+            p50s.push_back(pairs[i]->latency_percentile_ms(50));
+            p99s.push_back(pairs[i]->latency_percentile_ms(99));
+        }
+        result["aggregate_goodput_mbps"] = bytes * 8 / seconds / 1e6;
+        // Medians over the connections of their own percentiles.
+        std::sort(p50s.begin(), p50s.end());
+        std::sort(p99s.begin(), p99s.end());
+        result["latency_p50_ms"] = p50s[p50s.size() / 2];
+        result["latency_p99_ms"] = p99s[p99s.size() / 2];
+        result["worst_latency_p99_ms"] = p99s.back();
+    }
+    for (std::unique_ptr<PeerPair> &pair : pairs) {
+        pair->quit();
+    }
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    return RunListedCases(flags, "placements", "unpinned,numa,split",
+                          [&](const std::string &placement) {
+                              return RunCase(placement, flags);
+                          });
+}
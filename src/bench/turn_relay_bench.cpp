@@ -0,0 +1,196 @@
+#include <json/json.h>
+#include <p2p/base/test_turn_server.h>
+#include <rtc_base/thread.h>
+#include <time.h>
+
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "bench/stats_helpers.h"
+#include "bench/virtual_network.h"
+#include "util/json_utils.h"
+
+// Cost of a TURN relay. Both peers and a cricket::TurnServer run in this
+// process on real loopback sockets, so kernel and crypto costs are included.
+// ICE is restricted to relay candidates (IceTransportsType::kRelay) and the
+// TURN allocation is made over UDP, TCP or TLS. Every case is compared with a
+// direct host-to-host connection.
+//
+// Per case it reports connection time, DataChannel throughput, one-way
+// latency under a paced load and, for relayed cases, the CPU time of the
+// TURN server thread per Mbps relayed.
+//
+// Flags (key=value):
+//   protocols     comma-separated TURN transports (udp,tcp,tls)
+//   turn_port     first TURN port; UDP/TCP/TLS use the next ones (34780)
+//   rate_kbps     load of the latency phase (2000)
+//   duration_s    duration of the latency phase (5)
+//   message_size  DataChannel message size in bytes (16384)
+//   total_bytes   bytes sent by the throughput phase (33554432)
+//   timeout_ms    timeout of each phase (30000)
+//   report        also write the report to this file
+
+const char kLoopback[] = "127.0.0.1";
+
+// CPU time consumed by |thread| so far.
+int64_t ThreadCpuTimeUs(rtc::Thread *thread) {
+    return thread->Invoke<int64_t>(RTC_FROM_HERE, []() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    });
+}
+
+// A TURN server listening on UDP, TCP and TLS, on its own thread so its CPU
+// time can be measured apart from the peers'.
+class TurnRelay {
+public:
+    TurnRelay(int port)
+        : port_(port), thread_(rtc::Thread::CreateWithSocketServer()) {
+        thread_->SetName("turn_server", nullptr);
+        thread_->Start();
+        thread_->Invoke<void>(RTC_FROM_HERE, [&]() {
+            server_.reset(new cricket::TestTurnServer(
+                    thread_.get(), rtc::SocketAddress(kLoopback, port_),
+                    rtc::SocketAddress(kLoopback, 0), cricket::PROTO_UDP));
+            server_->AddInternalSocket(rtc::SocketAddress(kLoopback, port_ + 1),
+                                       cricket::PROTO_TCP);
+            server_->AddInternalSocket(rtc::SocketAddress(kLoopback, port_ + 2),
+                                       cricket::PROTO_TLS);
+        });
+    }
+
+    ~TurnRelay() {
+        thread_->Invoke<void>(RTC_FROM_HERE, [&]() { server_.reset(); });
+        thread_->Stop();
+    }
+
+    // ICE server entry allocating over |protocol|: "udp", "tcp" or "tls".
+    webrtc::PeerConnectionInterface::IceServer ice_server(
+            const std::string &protocol) const {
+        webrtc::PeerConnectionInterface::IceServer server;
+        if (protocol == "udp") {
+            server.uri = "turn:" + address(port_) + "?transport=udp";
+        } else if (protocol == "tcp") {
+            server.uri = "turn:" + address(port_ + 1) + "?transport=tcp";
+        } else if (protocol == "tls") {
+            server.uri = "turns:" + address(port_ + 2) + "?transport=tcp";
+            // The test server uses a self-signed certificate.
+            server.tls_cert_policy = webrtc::PeerConnectionInterface::
+                    TlsCertPolicy::kTlsCertPolicyInsecureNoCheck;
+        } else {
+            throw std::runtime_error("Unknown TURN protocol: " + protocol);
+        }
+        // TestTurnServer accepts any user whose password is its name.
+        server.username = "bench";
+        server.password = "bench";
+        return server;
+    }
+
+    rtc::Thread *thread() { return thread_.get(); }
+
+private:
+    static std::string address(int port) {
+        return std::string(kLoopback) + ":" + std::to_string(port);
+    }
+
+    const int port_;
+    std::unique_ptr<rtc::Thread> thread_;
+    std::unique_ptr<cricket::TestTurnServer> server_;
+};
+
+// |protocol| is empty for the direct baseline.
+Json::Value RunCase(const std::string &protocol,
+                    TurnRelay &relay,
+                    rtc::Thread *network_thread,
+                    const BenchFlags &flags) {
+    const int timeout_ms = flags.get_int("timeout_ms", 30000);
+    const size_t message_size = flags.get_int("message_size", 16384);
+    Json::Value result;
+    result["transport"] = protocol.empty() ? "direct" : protocol;
+
+    VirtualNetwork offerer_network(network_thread->socketserver(), kLoopback);
+    VirtualNetwork answerer_network(network_thread->socketserver(),
+                                    kLoopback);
+    PeerPair peers;
+    offerer_network.attach(peers.offerer);
+    answerer_network.attach(peers.answerer);
+    for (WebRTCManager *manager : {&peers.offerer, &peers.answerer}) {
+        manager->external_network_thread = network_thread;
+        if (!protocol.empty()) {
+            manager->configuration.servers.push_back(
+                    relay.ice_server(protocol));
+            manager->configuration.type = webrtc::PeerConnectionInterface::
+                    IceTransportsType::kRelay;
+        }
+    }
+    peers.init();
+
+    const double connect_ms = peers.connect(timeout_ms);
+    result["connect_ms"] = connect_ms;
+    if (connect_ms < 0) {
+        peers.quit();
+        return result;
+    }
+    const auto report = GetStatsReport(peers.offerer);
+    result["candidates"] = report ? SelectedCandidateTypes(*report) : "";
+
+    peers.send_paced(flags.get_int("rate_kbps", 2000), message_size,
+                     flags.get_int("duration_s", 5) * 1000);
+    result["latency_ms"]["p50"] = peers.latency_percentile_ms(50);
+    result["latency_ms"]["p95"] = peers.latency_percentile_ms(95);
+    result["latency_ms"]["p99"] = peers.latency_percentile_ms(99);
+
+    const int64_t cpu_before_us = ThreadCpuTimeUs(relay.thread());
+    const ThroughputResult throughput = peers.send_bulk(
+            message_size, flags.get_int("total_bytes", 32 << 20), timeout_ms);
+    const double relay_cpu_s =
+            (ThreadCpuTimeUs(relay.thread()) - cpu_before_us) / 1e6;
+    result["throughput_mbps"] = throughput.mbps;
+    if (!protocol.empty() && throughput.mbps > 0) {
+        result["relay_cpu_s"] = relay_cpu_s;
+        // Share of one core needed per relayed Mbps.
+        result["relay_cpu_percent_per_mbps"] =
+                100 * relay_cpu_s / throughput.seconds / throughput.mbps;
+    }
+    peers.quit();
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    TurnRelay relay(flags.get_int("turn_port", 34780));
+    std::unique_ptr<rtc::Thread> network_thread =
+            rtc::Thread::CreateWithSocketServer();
+    network_thread->Start();
+
+    Json::Value report;
+    const Json::Value direct = RunCase("", relay, network_thread.get(), flags);
+    std::cout << JsonToString(direct) << std::endl;
+    report["direct"] = direct;
+
+    report["relayed"] = Json::Value(Json::arrayValue);
+    std::istringstream protocols(flags.get_string("protocols", "udp,tcp,tls"));
+    for (std::string protocol; std::getline(protocols, protocol, ',');) {
+        Json::Value result =
+                RunCase(protocol, relay, network_thread.get(), flags);
+        if (result.isMember("latency_ms")) {
+            result["added_latency_ms"] =
+                    result["latency_ms"]["p50"].asDouble() -
+                    direct["latency_ms"].get("p50", 0).asDouble();
+        }
+        std::cout << JsonToString(result) << std::endl;
+        report["relayed"].append(result);
+    }
+    network_thread->Stop();
+
+    WriteReport(flags, report);
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include <json/json.h>
+#include <rtc_base/thread.h>
+#include <time.h>
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "util/batching_socket_server.h"
+#include "util/io_uring_socket_server.h"
+#include "util/json_utils.h"
+
+// Bulk DataChannel transfer between two peers on this host with WebRTC's
+// PhysicalSocketServer against the BatchingSocketServer and the
+// IoUringSocketServer on the network threads
+// (WebRTCManager::create_socket_server). Reports UDP packets/s from the
+// kernel's counters, network thread CPU time per packet and, for the other
+// servers, datagrams per system call.
+//
+// Flags (key=value):
+//   servers       comma-separated socket servers to run
+//                 (physical,batching,io_uring)
+//   batch_size    datagrams per recvmmsg/sendmmsg (32)
+//   gso           1 to send with UDP_SEGMENT (0)
+//   gro           1 to receive with UDP_GRO (0)
+//   buffers       io_uring receive buffers (1024)
+//   message_size  DataChannel message size in bytes (1024)
+//   total_bytes   bytes to transfer per case (33554432)
+//   timeout_ms    timeout of each phase (30000)
+//   report        also write the report to this file
+
+int64_t ThreadCpuTimeUs(rtc::Thread *thread) {
+    return thread->Invoke<int64_t>(RTC_FROM_HERE, []() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    });
+}
+
+// UDP datagrams received and sent by this host, from /proc/net/snmp.
+struct UdpCounters {
+    int64_t in_datagrams = 0;
+    int64_t out_datagrams = 0;
+};
+
+UdpCounters ReadUdpCounters() {
+    std::ifstream snmp("/proc/net/snmp");
+    std::string names;
+    std::string values;
+    UdpCounters counters;
+    while (std::getline(snmp, names) && std::getline(snmp, values)) {
+        if (names.compare(0, 4, "Udp:") != 0) {
+            continue;
+        }
+        std::istringstream name_stream(names);
+        std::istringstream value_stream(values);
+        std::string name;
+        std::string value;
+        while (name_stream >> name && value_stream >> value) {
+            if (name == "InDatagrams") {
+                counters.in_datagrams = std::stoll(value);
+            } else if (name == "OutDatagrams") {
+                counters.out_datagrams = std::stoll(value);
+            }
+        }
+        break;
+    }
+    return counters;
+}
+
+// Datagrams and the system calls that moved them, summed over both peers.
+// For io_uring, receive calls are the batches of completions reaped and
+// send calls the io_uring_enter() calls.
+struct SyscallCounters {
+    uint64_t datagrams_received = 0;
+    uint64_t receive_calls = 0;
+    uint64_t datagrams_sent = 0;
+    uint64_t send_calls = 0;
+    uint64_t drops = 0;
+};
+
+SyscallCounters ReadSyscallCounters(bool io_uring, PeerPair &peers) {
+    SyscallCounters counters;
+    for (WebRTCManager *manager : {&peers.offerer, &peers.answerer}) {
+        rtc::Thread *thread = manager->network_thread.get();
+        thread->Invoke<void>(RTC_FROM_HERE, [&]() {
+            if (io_uring) {
+#ifdef IORING_RECV_MULTISHOT
+                const IoUringStats &stats =
+                        static_cast<IoUringSocketServer *>(
+                                thread->socketserver())
+                                ->stats();
+                counters.datagrams_received += stats.datagrams_received;
+                counters.receive_calls += stats.completion_batches;
+                counters.datagrams_sent += stats.datagrams_sent;
+                counters.send_calls += stats.submit_calls;
+                counters.drops += stats.send_drops + stats.receive_drops;
+#endif
+            } else {
+                const BatchingStats &stats =
+                        static_cast<BatchingSocketServer *>(
+                                thread->socketserver())
+                                ->stats();
+                counters.datagrams_received += stats.datagrams_received;
+                counters.receive_calls += stats.receive_calls;
+                counters.datagrams_sent += stats.datagrams_sent;
+                counters.send_calls += stats.send_calls;
+                counters.drops += stats.send_drops + stats.receive_drops;
+            }
+        });
+    }
+    return counters;
+}
+
+Json::Value RunCase(const std::string &server, const BenchFlags &flags) {
+    BatchingConfig batching_config;
+    batching_config.batch_size = flags.get_int("batch_size", 32);
+    batching_config.gso = flags.get_int("gso", 0) != 0;
+    batching_config.gro = flags.get_int("gro", 0) != 0;
+    IoUringConfig io_uring_config;
+    io_uring_config.buffer_count = flags.get_int("buffers", 1024);
+    const size_t message_size = flags.get_int("message_size", 1024);
+    const size_t total_bytes = flags.get_int("total_bytes", 32 << 20);
+    const int timeout_ms = flags.get_int("timeout_ms", 30000);
+    Json::Value result;
+    result["server"] = server;
+
+    // Socket server the network threads run, empty for the default.
+    std::function<std::unique_ptr<rtc::SocketServer>()> create_socket_server;
+    // Whether the socket server keeps counters, and of which kind.
+    bool counted = true;
+    bool io_uring = false;
+    if (server == "batching") {
+        create_socket_server = [batching_config]() {
+            return std::unique_ptr<rtc::SocketServer>(
+                    new BatchingSocketServer(batching_config));
+        };
+    } else if (server == "io_uring") {
+        io_uring = IoUringSupported();
+        // CreateIoUringSocketServer() falls back to the batching server.
+        result["backend"] = io_uring ? "io_uring" : "batching";
+        create_socket_server = [io_uring_config]() {
+            return CreateIoUringSocketServer(io_uring_config);
+        };
+    } else if (server == "physical") {
+        counted = false;
+    } else {
+        throw std::runtime_error("Unknown socket server: " + server);
+    }
+    PeerPair peers;
+    for (WebRTCManager *manager : {&peers.offerer, &peers.answerer}) {
+        // Host candidates only.
+        manager->configuration.servers.clear();
+        manager->create_socket_server = create_socket_server;
+    }
+    peers.init();
+
+    const double connect_ms = peers.connect(timeout_ms);
+    result["connect_ms"] = connect_ms;
+    if (connect_ms < 0) {
+        peers.quit();
+        return result;
+    }
+
+    rtc::Thread *offerer_thread = peers.offerer.network_thread.get();
+    rtc::Thread *answerer_thread = peers.answerer.network_thread.get();
+    const int64_t cpu_before_us = ThreadCpuTimeUs(offerer_thread) +
+                                  ThreadCpuTimeUs(answerer_thread);
+    const UdpCounters udp_before = ReadUdpCounters();
+    SyscallCounters before;
+    if (counted) {
+        before = ReadSyscallCounters(io_uring, peers);
+    }
+
+    const ThroughputResult throughput =
+            peers.send_bulk(message_size, total_bytes, timeout_ms);
+
+    const int64_t cpu_us = ThreadCpuTimeUs(offerer_thread) +
+                           ThreadCpuTimeUs(answerer_thread) - cpu_before_us;
+    const UdpCounters udp_after = ReadUdpCounters();
+    const int64_t packets = udp_after.in_datagrams - udp_before.in_datagrams;
+    result["throughput_mbps"] = throughput.mbps;
+    result["packets_received"] = Json::Int64(packets);
+    result["packets_sent"] =
+            Json::Int64(udp_after.out_datagrams - udp_before.out_datagrams);
+    result["packets_per_s"] = packets / throughput.seconds;
+    result["network_cpu_us_per_packet"] =
+            packets > 0 ? double(cpu_us) / packets : -1.0;
+
+    if (counted) {
+        const SyscallCounters after = ReadSyscallCounters(io_uring, peers);
+        const uint64_t receive_calls =
+                after.receive_calls - before.receive_calls;
+        const uint64_t send_calls = after.send_calls - before.send_calls;
+        result["datagrams_per_receive_call"] =
+                receive_calls > 0
+                        ? double(after.datagrams_received -
+                                 before.datagrams_received) /
+                                  receive_calls
+                        : -1.0;
+        result["datagrams_per_send_call"] =
+                send_calls > 0 ? double(after.datagrams_sent -
+                                        before.datagrams_sent) /
+                                         send_calls
+                               : -1.0;
+        result["drops"] = Json::UInt64(after.drops - before.drops);
+    }
+    peers.quit();
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    return RunListedCases(flags, "servers", "physical,batching,io_uring",
+                          [&](const std::string &server) {
+                              return RunCase(server, flags);
+                          });
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <p2p/base/basic_packet_socket_factory.h>
+#include <p2p/client/basic_port_allocator.h>
+#include <rtc_base/fake_network.h>
+#include <rtc_base/virtual_socket_server.h>
+
+#include <memory>
+#include <string>
+
+#include "util/webrtc_manager.h"
+
+// One virtual interface per peer, so candidates are gathered from a
+// VirtualSocketServer (or a NATSocketServer on top of one) instead of the
+// host's interfaces.
+class VirtualNetwork {
+public:
+    VirtualNetwork(rtc::SocketFactory *socket_server, const std::string &ip)
+        : socket_factory_(socket_server) {
+        network_manager_.AddInterface(rtc::SocketAddress(ip, 0));
+    }
+
+    void attach(WebRTCManager &manager) {
+        manager.configuration.servers.clear();
+        manager.create_port_allocator = [this]() {
+            return std::unique_ptr<cricket::PortAllocator>(
+                    new cricket::BasicPortAllocator(&network_manager_,
+                                                    &socket_factory_));
+        };
+    }
+
+private:
+    rtc::FakeNetworkManager network_manager_;
+    rtc::BasicPacketSocketFactory socket_factory_;
+};
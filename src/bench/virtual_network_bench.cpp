@@ -0,0 +1,65 @@
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "bench/bench_flags.h"
+#include "bench/peer_pair.h"
+#include "bench/virtual_network.h"
+
+// Connection setup time and DataChannel throughput between two in-process
+// peers over a rtc::VirtualSocketServer. No real socket is opened, so runs
+// are reproducible on one machine without a network.
+//
+// Flags (key=value):
+//   delay_ms        mean one-way delay (0)
+//   jitter_ms       standard deviation of the delay (0)
+//   bandwidth_kbps  link bandwidth, 0 for unlimited (0)
+//   loss            packet drop probability in [0, 1] (0)
+//   message_size    DataChannel message size in bytes (16384)
+//   total_bytes     bytes to send from offerer to answerer (16777216)
+//   timeout_ms      timeout of each phase (60000)
+
+int main(int argc, char **argv) {
+    const BenchFlags flags(argc, argv);
+    const int timeout_ms = flags.get_int("timeout_ms", 60000);
+
+    rtc::VirtualSocketServer socket_server;
+    rtc::Thread network_thread(&socket_server);
+    network_thread.Start();
+    network_thread.Invoke<void>(RTC_FROM_HERE, [&]() {
+        socket_server.set_delay_mean(flags.get_int("delay_ms", 0));
+        socket_server.set_delay_stddev(flags.get_int("jitter_ms", 0));
+        socket_server.UpdateDelayDistribution();
+        socket_server.set_bandwidth(flags.get_int("bandwidth_kbps", 0) *
+                                    1000 / 8);
+        socket_server.set_drop_probability(flags.get_double("loss", 0));
+    });
+
+    VirtualNetwork offerer_network(&socket_server, "10.0.0.1");
+    VirtualNetwork answerer_network(&socket_server, "10.0.0.2");
+    PeerPair peers;
+    peers.offerer.external_network_thread = &network_thread;
+    peers.answerer.external_network_thread = &network_thread;
+    offerer_network.attach(peers.offerer);
+    answerer_network.attach(peers.answerer);
+    peers.init();
+
+    const double setup_ms = peers.connect(timeout_ms);
+    if (setup_ms < 0) {
+        std::cout << "Connection timed out." << std::endl;
+        return EXIT_FAILURE;
+    }
+    const ThroughputResult throughput = peers.send_bulk(
+            flags.get_int("message_size", 16384),
+            flags.get_int("total_bytes", 16 << 20), timeout_ms);
+
+    std::cout << "connection setup: " << setup_ms << "ms" << std::endl;
+    std::cout << "throughput: " << throughput.mbps << "Mbps ("
+              << throughput.bytes_received << " bytes in "
+              << throughput.seconds << "s)" << std::endl;
+
+    peers.quit();
+    network_thread.Stop();
+    return 0;
+}
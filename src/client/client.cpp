@@ -1,14 +1,31 @@
 #include <json/json.h>
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #define ASIO_STANDALONE  // Use ASIO standalone lib instead of boost.
 #include <websocketpp/client.hpp>
 #include <websocketpp/config/asio_no_tls_client.hpp>
 
+#include "util/asio_socket_server.h"
+#include "util/binary_signaling.h"
+#include "util/chrome_tracer.h"
+#include "util/connection_trace.h"
 #include "util/json_utils.h"
+#include "util/rtc_event_log_recorder.h"
+#include "util/signaling_dispatcher.h"
+#include "util/socket_config.h"
+#include "util/socket_server_factory.h"
+#include "util/thread_config.h"
 #include "util/webrtc_manager.h"
 
 using websocketpp::lib::bind;
@@ -24,15 +41,48 @@ class WebSocketClientManager {
 
 public:
     WebSocketClientManager(const std::string& uri)
-        : uri_(uri), ws_client_(), rtc_manager_("client") {
-        rtc_manager_.on_ice([&](const Ice& ice) {
-            std::cout << "[RTCClient::on_ice] " << std::endl;
-            ice_list_.push_back(ice);
+        : uri_(uri),
+          ws_client_(),
+          rtc_manager_("client"),
+          keep_signaling_(IceRestartFromEnv()) {
+        // Set WEBRTC_UNIFIED_LOOP=1 to run the WebSocket, WebRTC networking
+        // and signaling on one thread, or WEBRTC_SOCKET_SERVER to pick the
+        // socket server of WebRTC's own network thread. WEBRTC_NETWORK_*,
+        // WEBRTC_WORKER_* and WEBRTC_SIGNALING_* name, place and schedule
+        // the threads the manager starts (see ThreadConfigFromEnv).
+        if (UnifiedEventLoopFromEnv()) {
+            event_loop_.reset(new AsioEventLoop("event_loop"));
+            event_loop_->start();
+            rtc_manager_.external_network_thread = event_loop_->thread();
+            rtc_manager_.external_signaling_thread = event_loop_->thread();
+        } else {
+            rtc_manager_.create_socket_server = SocketServerFactoryFromEnv();
+        }
+        rtc_manager_.socket_config = SocketConfigFromEnv();
+        rtc_manager_.network_thread_config =
+                ThreadConfigFromEnv("WEBRTC_NETWORK");
+        rtc_manager_.worker_thread_config =
+                ThreadConfigFromEnv("WEBRTC_WORKER");
+        rtc_manager_.signaling_thread_config =
+                ThreadConfigFromEnv("WEBRTC_SIGNALING");
+        rtc_manager_.on_ice_batch([&](const std::vector<Ice>& ices) {
+            std::cout << "[RTCClient::on_ice_batch] " << ices.size()
+                      << std::endl;
+            ice_list_.insert(ice_list_.end(), ices.begin(), ices.end());
             std::cout << "========== Sending ICE begin ==========" << std::endl;
-            std::cout << ice.ToJsonString();
+            std::cout << Ice::ToJsonString(ices);
             std::cout << "========== Sending ICE end ============" << std::endl;
-            ws_client_.send(ws_hdl_, ice.ToJsonString(),
-                            websocketpp::frame::opcode::text);
+            if (use_binary_) {
+                SignalingMessage message;
+                message.type = SignalingMessage::kIceBatch;
+                message.ices = ices;
+                ws_client_.send(ws_hdl_, EncodeSignalingMessage(message),
+                                websocketpp::frame::opcode::binary);
+            } else {
+                ws_client_.send(ws_hdl_, Ice::ToJsonString(ices),
+                                websocketpp::frame::opcode::text);
+            }
+            ++num_frames_sent_;
         });
         rtc_manager_.on_message([&](const std::string& message) {
             std::cout << "[RTCClient::on_message]" << std::endl;
@@ -55,13 +105,70 @@ public:
             Json::Value json;
             json["type"] = "offer";
             json["sdp"] = sdp;
+            json["binary"] = true;  // Announce binary signaling support.
+            json["trace"] = true;   // Ask for the server's trace.
             ws_client_.send(ws_hdl_, JsonToString(json),
                             websocketpp::frame::opcode::text);
+            ++num_frames_sent_;
+            rtc_manager_.connection.trace.record("offer_sent");
         });
         // DataChannel created. WebSocketClientManager exits its blocking state.
-        rtc_manager_.on_success(
-                [&]() { std::cout << "[RTCClient::on_success]" << std::endl; });
+        rtc_manager_.on_success([&]() {
+            std::cout << "[RTCClient::on_success]" << std::endl;
+            PrintHandshakeStats();
+            // The server keeps the WebSocket open; stop blocking here.
+            if (keep_signaling_) {
+                NotifyClosed();
+            }
+        });
+        // The session failed, e.g. on a malformed answer or a deadline.
+        rtc_manager_.on_error([&](const OperationError& error) {
+            std::cout << "[RTCClient::on_error] " << error.ToString()
+                      << std::endl;
+            namespace status = websocketpp::close::status;
+            websocketpp::lib::error_code ec;
+            ws_client_.close(ws_hdl_, status::internal_endpoint_error,
+                             "WebRTC session failed", ec);
+        });
         rtc_manager_.init();
+        if (keep_signaling_) {
+            rtc_manager_.enable_ice_restart(IceRestartConfig());
+        }
+        RtcEventLogConfig event_log_config;
+        if (RtcEventLogConfigFromEnv(rtc_manager_.name, &event_log_config)) {
+            rtc_manager_.start_event_log(event_log_config);
+        }
+
+        dispatcher_.on_answer([&](const SignalingMessage& message) {
+            rtc_manager_.connection.trace.record("answer_received");
+            std::cout << "========== Answer SDP begin ==========" << std::endl;
+            std::cout << message.sdp;
+            std::cout << "========== Answer SDP end ============" << std::endl;
+            rtc_manager_.push_reply_sdp(message.sdp);
+        });
+        dispatcher_.on_ice([&](const SignalingMessage& message) {
+            rtc_manager_.push_ice_batch(message.ices);
+            std::cout << "========== Receive ICE begin ==========" << std::endl;
+            std::cout << Ice::ToJsonString(message.ices);
+            std::cout << "========== Receive ICE end ============" << std::endl;
+        });
+        // The server sends its trace once connected. The offer/answer exchange
+        // doubles as the round trip that aligns both clocks.
+        dispatcher_.on_trace([&](const SignalingMessage& message) {
+            const std::vector<TraceEvent> client_events =
+                    rtc_manager_.connection.trace.events();
+            const int64_t offset = EstimateClockOffset(
+                    FindTraceEvent(client_events, "offer_sent"),
+                    FindTraceEvent(message.trace, "offer_received"),
+                    FindTraceEvent(message.trace, "answer_sent"),
+                    FindTraceEvent(client_events, "answer_received"));
+            std::cout << "========== Trace begin ==========" << std::endl;
+            std::cout << JsonToString(CombineTraces("client", client_events,
+                                                    "server", message.trace,
+                                                    offset));
+            std::cout << std::endl;
+            std::cout << "========== Trace end ============" << std::endl;
+        });
 
         ws_client_.clear_access_channels(
                 websocketpp::log::alevel::frame_header |
@@ -73,17 +180,54 @@ public:
         ws_client_.set_message_handler(
                 bind(&WebSocketClientManager::MessageHandler, this, &ws_client_,
                      _1, _2));
-        ws_client_.init_asio();
-        websocketpp::lib::error_code ec;
-        WebSocketClient::connection_ptr connection =
-                ws_client_.get_connection(uri, ec);
-        ws_client_.connect(connection);
-        ws_client_.run();
+        ws_client_.set_fail_handler(bind(&WebSocketClientManager::FailHandler,
+                                         this, &ws_client_, _1));
+        if (!event_loop_ && !keep_signaling_) {
+            ws_client_.init_asio();
+            Connect(uri);
+            ws_client_.run();
+            return;
+        }
+        if (!event_loop_) {
+            // The WebSocket outlives the handshake; run it on a thread of its
+            // own and block until the DataChannel is open.
+            ws_client_.init_asio();
+            Connect(uri);
+            ws_thread_ = std::thread([this]() { ws_client_.run(); });
+            std::unique_lock<std::mutex> lock(closed_mutex_);
+            closed_cv_.wait(lock, [this]() { return closed_; });
+            return;
+        }
+        // The event loop runs the io_context; block until the WebSocket is
+        // done, as run() would.
+        ws_client_.init_asio(&event_loop_->io_context());
+        event_loop_->thread()->Invoke<void>(RTC_FROM_HERE,
+                                            [&]() { Connect(uri); });
+        std::unique_lock<std::mutex> lock(closed_mutex_);
+        closed_cv_.wait(lock, [this]() { return closed_; });
     }
 
     virtual ~WebSocketClientManager() {
-        // TODO: close WebSocket connection if it is open.
         // TODO: close WebRTC connection if it is open.
+        if (keep_signaling_) {
+            websocketpp::lib::error_code ec;
+            ws_client_.close(ws_hdl_, websocketpp::close::status::normal, "",
+                             ec);
+        }
+        if (ws_thread_.joinable()) {
+            ws_thread_.join();
+        }
+        // Stop handling events before the endpoint goes away.
+        if (event_loop_) {
+            event_loop_->stop();
+        }
+    }
+
+    void Connect(const std::string& uri) {
+        websocketpp::lib::error_code ec;
+        WebSocketClient::connection_ptr connection =
+                ws_client_.get_connection(uri, ec);
+        ws_client_.connect(connection);
     }
 
     // Send WebRTC offer once the WebSocket connection is established.
@@ -91,6 +235,7 @@ public:
                      websocketpp::connection_hdl hdl) {
         ws_hdl_ = hdl;
         std::cout << "[WebSocketClientManager::OpenHandler]" << std::endl;
+        handshake_start_time_ = std::chrono::steady_clock::now();
         rtc_manager_.create_offer_sdp();  // Triggers rtc_manager_.on_sdp.
     }
 
@@ -98,6 +243,19 @@ public:
                       websocketpp::connection_hdl hdl) {
         ws_hdl_ = hdl;
         std::cout << "[WebSocketClientManager::CloseHandler]" << std::endl;
+        NotifyClosed();
+    }
+
+    void FailHandler(WebSocketClient* ws_client,
+                     websocketpp::connection_hdl hdl) {
+        std::cout << "[WebSocketClientManager::FailHandler]" << std::endl;
+        NotifyClosed();
+    }
+
+    void NotifyClosed() {
+        std::lock_guard<std::mutex> lock(closed_mutex_);
+        closed_ = true;
+        closed_cv_.notify_all();
     }
 
     void MessageHandler(WebSocketClient* ws_client,
@@ -107,28 +265,28 @@ public:
         const std::string message = message_ptr->get_payload();
         std::cout << "[WebSocketClientManager::MessageHandler]" << std::endl;
 
-        const Json::Value json = StringToJson(message);
-        const std::string type = json.get("type", "").asString();
-        std::cout << "Received message type: " << type << std::endl;
-        std::cout << "Received message: " << message << std::endl;
-
-        if (type == "answer") {
-            const std::string answer = json.get("answer", "").asString();
-            std::cout << "========== Answer SDP begin ==========" << std::endl;
-            std::cout << answer;
-            std::cout << "========== Answer SDP end ============" << std::endl;
-            rtc_manager_.push_reply_sdp(answer);
-        } else if (type == "ice") {
-            Ice ice = Ice::FromJsonString(message);
-            rtc_manager_.push_ice(ice);
-            std::cout << "========== Receive ICE begin ==========" << std::endl;
-            std::cout << ice.ToJsonString();
-            std::cout << "========== Receive ICE end ============" << std::endl;
+        // A binary reply means the server accepted binary signaling.
+        if (message_ptr->get_opcode() == websocketpp::frame::opcode::binary) {
+            std::cout << "Received binary message: " << message.size()
+                      << " bytes" << std::endl;
+            use_binary_ = true;
+            dispatcher_.dispatch_binary(message);
         } else {
-            throw std::runtime_error("Unkown json message type: " + type);
+            std::cout << "Received message: " << message << std::endl;
+            dispatcher_.dispatch_text(message);
         }
     }
 
+    void PrintHandshakeStats() const {
+        std::cout << "Signaling frames sent: " << num_frames_sent_
+                  << ", time to connected: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() -
+                             handshake_start_time_)
+                             .count()
+                  << "ms" << std::endl;
+    }
+
 public:
     /// WebRTCManger.
     // TODO: Return this in a factory function.
@@ -141,10 +299,16 @@ private:
     /// automatically during WebRTC handshake.
     std::string uri_;
 
+    /// With WEBRTC_UNIFIED_LOOP=1, the thread running the WebSocket, WebRTC
+    /// networking and signaling. Declared before ws_client_, which uses its
+    /// io_context.
+    std::unique_ptr<AsioEventLoop> event_loop_;
+
     /// WebSocketpp client is used to send/receive WebRTC handshake (a.k.a.
     /// signaling) messages. WebRTC protocol defines the message formats but
     /// does not take care of sending/receiving handshake messages. The
-    /// WebSocket will be closed once the WebRTC connection is established.
+    /// WebSocket will be closed once the WebRTC connection is established,
+    /// unless |keep_signaling_|.
     WebSocketClient ws_client_;
 
     /// WebSocket connection handler uniquely identifies a WebSocket connection.
@@ -152,13 +316,42 @@ private:
     /// use case, they shall all be the same one.
     websocketpp::connection_hdl ws_hdl_;
 
+    /// Parses incoming signaling messages once and routes them by type.
+    SignalingDispatcher dispatcher_;
+
     /// List of ICE candidates. It updates when rtc_manager_.on_ice() is
     /// triggered. The server and client exchange their ICE candidate list and
     /// select a candidate to set up the connection.
     std::list<Ice> ice_list_;
+
+    /// Number of signaling frames sent, and the time the handshake started.
+    /// Reported once the DataChannel is open to measure the signaling cost.
+    int num_frames_sent_ = 0;
+    std::chrono::steady_clock::time_point handshake_start_time_;
+
+    /// Whether the peer speaks the binary signaling protocol. Negotiated by
+    /// the "binary" flag of the offer; the browser client never sets it.
+    std::atomic<bool> use_binary_{false};
+
+    /// With WEBRTC_ICE_RESTART=1, the WebSocket stays open after the
+    /// handshake to carry ICE restarts, run by |ws_thread_| unless
+    /// |event_loop_| runs it.
+    const bool keep_signaling_;
+    std::thread ws_thread_;
+
+    /// Set once the WebSocket is closed or failed to connect, or with
+    /// |keep_signaling_| once the DataChannel is open.
+    std::mutex closed_mutex_;
+    std::condition_variable closed_cv_;
+    bool closed_ = false;
 };
 
-int main() {
+int Run() {
+    // Set WEBRTC_TRACE_FILE to write a Chrome trace of the session. The tracer
+    // must be installed before any WebRTC object is created.
+    const std::string trace_file = ChromeTracer::StartFromEnv();
+    ChromeTracer::Instance().name_current_thread("main");
+
     // TODO: add try-catch for WS connection.
     WebSocketClientManager ws_client_manager("ws://localhost:8888");
 
@@ -167,6 +360,8 @@ int main() {
         if (message == "exit") {
             std::cout << "message == exit, exiting..." << std::endl;
             ws_client_manager.rtc_manager_.send("exit");
+            // Deliver "exit" and anything still queued before closing.
+            ws_client_manager.rtc_manager_.drain(DrainTimeoutMsFromEnv());
             ws_client_manager.rtc_manager_.quit();
             break;
         } else {
@@ -177,6 +372,21 @@ int main() {
             ws_client_manager.rtc_manager_.send(message);
         }
     }
+    if (!trace_file.empty()) {
+        ChromeTracer::Instance().stop_and_write(trace_file);
+    }
     std::cout << "Client exits gracefully." << std::endl;
     return 0;
 }
+
+int main() {
+    // Invalid WEBRTC_* settings, and threads that cannot be configured as
+    // asked, stop the client before the session starts.
+    try {
+        return Run();
+    } catch (const std::exception &error) {
+        std::cout << "client:" << std::this_thread::get_id() << ":"
+                  << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -112,6 +112,10 @@ function onWebSocketMessage(event) {
   } else if (messageObject.type == "ice") {
     var iceObj = new RTCIceCandidate(messageObject);
     peerConnection.addIceCandidate(iceObj);
+  } else if (messageObject.type == "ice_batch") {
+    for (const candidate of messageObject.candidates) {
+      peerConnection.addIceCandidate(new RTCIceCandidate(candidate));
+    }
   } else {
     throw "Unknown message type.";
   }
@@ -1,15 +1,33 @@
 #include <json/json.h>
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <thread>
 
 #define ASIO_STANDALONE  // Use ASIO standalone lib instead of boost.
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
 
+#include "util/asio_socket_server.h"
+#include "util/binary_signaling.h"
+#include "util/chrome_tracer.h"
+#include "util/connection_trace.h"
 #include "util/json_utils.h"
+#include "util/metrics_http_server.h"
+#include "util/rtc_event_log_recorder.h"
+#include "util/signaling_dispatcher.h"
+#include "util/socket_config.h"
+#include "util/socket_server_factory.h"
+#include "util/stats_exporter.h"
+#include "util/thread_config.h"
 #include "util/webrtc_manager.h"
 
 using websocketpp::lib::bind;
@@ -20,16 +38,55 @@ class WebSocketServerManager {
     using WebSocketServer = websocketpp::server<websocketpp::config::asio>;
 
 public:
-    WebSocketServerManager(uint16_t port)
-        : port_(port), ws_server_(), rtc_manager_("server") {
-        rtc_manager_.on_ice([&](const Ice& ice) {
-            std::cout << "[RTCServer::on_ice] " << std::endl;
-            ice_list_.push_back(ice);
+    WebSocketServerManager(uint16_t port, uint16_t metrics_port)
+        : port_(port),
+          ws_server_(),
+          rtc_manager_("server"),
+          stats_exporter_(1000),
+          metrics_server_([this]() {
+              return stats_exporter_.render() +
+                     RenderUdpDrops(rtc_manager_.socket_drops()) +
+                     RenderIceRecoveryStats(rtc_manager_.ice_recovery_stats());
+          }),
+          keep_signaling_(IceRestartFromEnv()) {
+        // Set WEBRTC_UNIFIED_LOOP=1 to run the WebSocket, WebRTC networking
+        // and signaling on one thread, or WEBRTC_SOCKET_SERVER to pick the
+        // socket server of WebRTC's own network thread. WEBRTC_NETWORK_*,
+        // WEBRTC_WORKER_* and WEBRTC_SIGNALING_* name, place and schedule
+        // the threads the manager starts (see ThreadConfigFromEnv).
+        if (UnifiedEventLoopFromEnv()) {
+            event_loop_.reset(new AsioEventLoop("event_loop"));
+            event_loop_->start();
+            rtc_manager_.external_network_thread = event_loop_->thread();
+            rtc_manager_.external_signaling_thread = event_loop_->thread();
+        } else {
+            rtc_manager_.create_socket_server = SocketServerFactoryFromEnv();
+        }
+        rtc_manager_.socket_config = SocketConfigFromEnv();
+        rtc_manager_.network_thread_config =
+                ThreadConfigFromEnv("WEBRTC_NETWORK");
+        rtc_manager_.worker_thread_config =
+                ThreadConfigFromEnv("WEBRTC_WORKER");
+        rtc_manager_.signaling_thread_config =
+                ThreadConfigFromEnv("WEBRTC_SIGNALING");
+        rtc_manager_.on_ice_batch([&](const std::vector<Ice>& ices) {
+            std::cout << "[RTCServer::on_ice_batch] " << ices.size()
+                      << std::endl;
+            ice_list_.insert(ice_list_.end(), ices.begin(), ices.end());
             std::cout << "========== Sending ICE begin ==========" << std::endl;
-            std::cout << ice.ToJsonString();
+            std::cout << Ice::ToJsonString(ices);
             std::cout << "========== Sending ICE end ============" << std::endl;
-            ws_server_.send(ws_hdl_, ice.ToJsonString(),
-                            websocketpp::frame::opcode::text);
+            if (use_binary_) {
+                SignalingMessage message;
+                message.type = SignalingMessage::kIceBatch;
+                message.ices = ices;
+                ws_server_.send(ws_hdl_, EncodeSignalingMessage(message),
+                                websocketpp::frame::opcode::binary);
+            } else {
+                ws_server_.send(ws_hdl_, Ice::ToJsonString(ices),
+                                websocketpp::frame::opcode::text);
+            }
+            ++num_frames_sent_;
         });
         rtc_manager_.on_message([&](const std::string& message) {
             std::cout << "[RTCServer::on_message] " << message << std::endl;
@@ -41,7 +98,14 @@ public:
             if (message == "exit") {
                 // TODO: Use this as a proxy to stop the main event loop. Will
                 // be replaced in the future.
+                if (keep_signaling_) {
+                    websocketpp::lib::error_code ec;
+                    ws_server_.close(ws_hdl_,
+                                     websocketpp::close::status::normal, "",
+                                     ec);
+                }
                 ws_server_.stop_listening();
+                NotifyStopped();
             } else {
                 std::string reply_message = "Echo of: " + message;
                 std::cout << "========= Send message begin ========="
@@ -57,19 +121,81 @@ public:
             std::cout << "========== Answer SDP begin ==========" << std::endl;
             std::cout << sdp;
             std::cout << "========== Answer SDP end ============" << std::endl;
-            Json::Value json;
-            json["type"] = "answer";
-            json["answer"] = sdp;
-            ws_server_.send(ws_hdl_, JsonToString(json),
-                            websocketpp::frame::opcode::text);
+            if (use_binary_) {
+                SignalingMessage message;
+                message.type = SignalingMessage::kAnswer;
+                message.sdp = sdp;
+                ws_server_.send(ws_hdl_, EncodeSignalingMessage(message),
+                                websocketpp::frame::opcode::binary);
+            } else {
+                Json::Value json;
+                json["type"] = "answer";
+                json["answer"] = sdp;
+                ws_server_.send(ws_hdl_, JsonToString(json),
+                                websocketpp::frame::opcode::text);
+            }
+            rtc_manager_.connection.trace.record("answer_sent");
+            ++num_frames_sent_;
         });
         // DataChannel created. WebSocketClientManager exits its blocking state.
+        // With ICE restart, the WebSocket stays open for the restart offers.
         rtc_manager_.on_success([&]() {
             std::cout << "[RTCServer::on_success]" << std::endl;
-            ws_server_.pause_reading(ws_hdl_);
-            ws_server_.close(ws_hdl_, websocketpp::close::status::normal, "");
+            PrintHandshakeStats();
+            // Only to clients that asked for it; the browser client does not.
+            if (send_trace_) {
+                SendTrace();
+            }
+            if (!keep_signaling_) {
+                ws_server_.pause_reading(ws_hdl_);
+                ws_server_.close(ws_hdl_, websocketpp::close::status::normal,
+                                 "");
+            }
+        });
+        // The session failed, e.g. on a malformed offer or a deadline. Stop
+        // as on the exit message.
+        rtc_manager_.on_error([&](const OperationError& error) {
+            std::cout << "[RTCServer::on_error] " << error.ToString()
+                      << std::endl;
+            namespace status = websocketpp::close::status;
+            websocketpp::lib::error_code ec;
+            ws_server_.close(ws_hdl_, status::internal_endpoint_error,
+                             "WebRTC session failed", ec);
+            ws_server_.stop_listening(ec);
+            NotifyStopped();
         });
         rtc_manager_.init();
+        if (keep_signaling_) {
+            rtc_manager_.enable_ice_restart(IceRestartConfig());
+        }
+        RtcEventLogConfig event_log_config;
+        if (RtcEventLogConfigFromEnv(rtc_manager_.name, &event_log_config)) {
+            rtc_manager_.start_event_log(event_log_config);
+        }
+
+        dispatcher_.on_offer([&](const SignalingMessage& message) {
+            rtc_manager_.connection.trace.record("offer_received");
+            std::cout << "========== Offer SDP begin ==========" << std::endl;
+            std::cout << message.sdp;
+            std::cout << "========== Offer SDP end ============" << std::endl;
+            handshake_start_time_ = std::chrono::steady_clock::now();
+            use_binary_ = message.accepts_binary;
+            send_trace_ = message.accepts_trace;
+            // Later offers restart ICE on the same PeerConnection.
+            const bool restart =
+                    rtc_manager_.connection.peer_connection != nullptr;
+            rtc_manager_.create_answer_sdp(message.sdp);
+            if (!restart) {
+                stats_exporter_.add(rtc_manager_.name,
+                                    rtc_manager_.connection.peer_connection);
+            }
+        });
+        dispatcher_.on_ice([&](const SignalingMessage& message) {
+            rtc_manager_.push_ice_batch(message.ices);
+            std::cout << "========== Receive ICE begin ==========" << std::endl;
+            std::cout << Ice::ToJsonString(message.ices);
+            std::cout << "========== Receive ICE end ============" << std::endl;
+        });
 
         ws_server_.clear_access_channels(
                 websocketpp::log::alevel::frame_header |
@@ -81,14 +207,44 @@ public:
         ws_server_.set_message_handler(
                 bind(&WebSocketServerManager::MessageHandler, this, &ws_server_,
                      _1, _2));
-        ws_server_.init_asio();
+        stats_exporter_.start();
+        metrics_server_.start(metrics_port);
+        if (!event_loop_) {
+            ws_server_.init_asio();
+            Listen();
+            ws_server_.run();
+        } else {
+            // The event loop runs the io_context; block until the exit
+            // message, as run() would.
+            ws_server_.init_asio(&event_loop_->io_context());
+            event_loop_->thread()->Invoke<void>(RTC_FROM_HERE,
+                                                [this]() { Listen(); });
+            std::unique_lock<std::mutex> lock(stopped_mutex_);
+            stopped_cv_.wait(lock, [this]() { return stopped_; });
+        }
+        // Release the PeerConnection before rtc_manager_.quit() closes it.
+        metrics_server_.stop();
+        stats_exporter_.stop();
+    }
+
+    virtual ~WebSocketServerManager() {
+        // Stop handling events before the endpoint goes away.
+        if (event_loop_) {
+            event_loop_->stop();
+        }
+    }
+
+    void Listen() {
         ws_server_.set_reuse_addr(true);
         ws_server_.listen(port_);
         ws_server_.start_accept();
-        ws_server_.run();
     }
 
-    virtual ~WebSocketServerManager() {}
+    void NotifyStopped() {
+        std::lock_guard<std::mutex> lock(stopped_mutex_);
+        stopped_ = true;
+        stopped_cv_.notify_all();
+    }
 
     void OpenHandler(WebSocketServer* ws_server,
                      websocketpp::connection_hdl hdl) {
@@ -109,26 +265,44 @@ public:
         const std::string message = message_ptr->get_payload();
         std::cout << "[WebSocketServerManager::MessageHandler]" << std::endl;
 
-        const Json::Value json = StringToJson(message);
-        const std::string type = json.get("type", "").asString();
-        std::cout << "Received message type: " << type << std::endl;
-        std::cout << "Received message: " << message << std::endl;
+        if (message_ptr->get_opcode() == websocketpp::frame::opcode::binary) {
+            std::cout << "Received binary message: " << message.size()
+                      << " bytes" << std::endl;
+            dispatcher_.dispatch_binary(message);
+        } else {
+            std::cout << "Received message: " << message << std::endl;
+            dispatcher_.dispatch_text(message);
+        }
+    }
 
-        if (type == "offer") {
-            const std::string offer = json.get("sdp", "").asString();
-            std::cout << "========== Offer SDP begin ==========" << std::endl;
-            std::cout << offer;
-            std::cout << "========== Offer SDP end ============" << std::endl;
-            rtc_manager_.create_answer_sdp(offer);
-        } else if (type == "ice") {
-            Ice ice = Ice::FromJsonString(message);
-            rtc_manager_.push_ice(ice);
-            std::cout << "========== Receive ICE begin ==========" << std::endl;
-            std::cout << ice.ToJsonString();
-            std::cout << "========== Receive ICE end ============" << std::endl;
+    // Send the trace of this peer to the client, which merges it with its own
+    // into one timeline.
+    void SendTrace() {
+        if (use_binary_) {
+            SignalingMessage message;
+            message.type = SignalingMessage::kTrace;
+            message.trace = rtc_manager_.connection.trace.events();
+            ws_server_.send(ws_hdl_, EncodeSignalingMessage(message),
+                            websocketpp::frame::opcode::binary);
         } else {
-            throw std::runtime_error("Unkown json message type: " + type);
+            Json::Value json;
+            json["type"] = "trace";
+            json["events"] =
+                    TraceEventsToJson(rtc_manager_.connection.trace.events());
+            ws_server_.send(ws_hdl_, JsonToString(json),
+                            websocketpp::frame::opcode::text);
         }
+        ++num_frames_sent_;
+    }
+
+    void PrintHandshakeStats() const {
+        std::cout << "Signaling frames sent: " << num_frames_sent_
+                  << ", time to connected: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() -
+                             handshake_start_time_)
+                             .count()
+                  << "ms" << std::endl;
     }
 
 public:
@@ -137,6 +311,12 @@ public:
 
 private:
     uint16_t port_;
+
+    /// With WEBRTC_UNIFIED_LOOP=1, the thread running the WebSocket, WebRTC
+    /// networking and signaling. Declared before ws_server_, which uses its
+    /// io_context.
+    std::unique_ptr<AsioEventLoop> event_loop_;
+
     WebSocketServer ws_server_;
 
     /// WebSocket connection handler uniquely identifies a WebSocket connection.
@@ -144,17 +324,68 @@ private:
     /// use case, they shall all be the same one.
     websocketpp::connection_hdl ws_hdl_;
 
+    /// Parses incoming signaling messages once and routes them by type.
+    SignalingDispatcher dispatcher_;
+
     /// List of ICE candidates. It updates when rtc_manager_.on_ice() is
     /// triggered. The server and client exchange their ICE candidate list and
     /// select a candidate to set up the connection.
     std::list<Ice> ice_list_;
+
+    /// Number of signaling frames sent, and the time the handshake started.
+    /// Reported once the DataChannel is open to measure the signaling cost.
+    int num_frames_sent_ = 0;
+    std::chrono::steady_clock::time_point handshake_start_time_;
+
+    /// Whether the peer speaks the binary signaling protocol. Negotiated by
+    /// the "binary" flag of the offer; the browser client never sets it.
+    std::atomic<bool> use_binary_{false};
+    /// Whether the peer wants the server's ConnectionTrace once connected.
+    /// Negotiated by the "trace" flag of the offer.
+    std::atomic<bool> send_trace_{false};
+
+    /// Polls the stats of the connection and serves them to Prometheus on
+    /// http://localhost:<metrics_port>/metrics.
+    StatsExporter stats_exporter_;
+    MetricsHttpServer metrics_server_;
+
+    /// With WEBRTC_ICE_RESTART=1, the WebSocket stays open after the
+    /// handshake to carry ICE restarts.
+    const bool keep_signaling_;
+
+    /// Set once the exit message stopped the server.
+    std::mutex stopped_mutex_;
+    std::condition_variable stopped_cv_;
+    bool stopped_ = false;
 };
 
-int main() {
+int Run() {
+    // Set WEBRTC_TRACE_FILE to write a Chrome trace of the session. The tracer
+    // must be installed before any WebRTC object is created.
+    const std::string trace_file = ChromeTracer::StartFromEnv();
+    ChromeTracer::Instance().name_current_thread("main");
+
     // TODO: add try-catch for WS connection.
-    WebSocketServerManager ws_server_manager(8888);
+    WebSocketServerManager ws_server_manager(8888, 9100);
 
+    // Deliver the queued replies before closing.
+    ws_server_manager.rtc_manager_.drain(DrainTimeoutMsFromEnv());
     ws_server_manager.rtc_manager_.quit();
+    if (!trace_file.empty()) {
+        ChromeTracer::Instance().stop_and_write(trace_file);
+    }
     std::cout << "Server exits gracefully." << std::endl;
     return 0;
 }
+
+int main() {
+    // Invalid WEBRTC_* settings, and threads that cannot be configured as
+    // asked, stop the server before the session starts.
+    try {
+        return Run();
+    } catch (const std::exception &error) {
+        std::cout << "server:" << std::this_thread::get_id() << ":"
+                  << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
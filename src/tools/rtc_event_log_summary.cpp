@@ -0,0 +1,154 @@
+#include <json/json.h>
+#include <logging/rtc_event_log/rtc_event_log_parser.h>
+
+#include <iostream>
+#include <string>
+
+#include "util/json_utils.h"
+
+// Summarize the ICE and DTLS timing of RtcEventLog files, e.g. the rotated
+// files written with RTC_EVENT_LOG_DIR set:
+//
+//   rtc_event_log_summary server.0.rtclog server.1.rtclog ...
+//
+// Prints one JSON object per file. Times are in ms since the start of the
+// log. SCTP association setup is not part of the RtcEventLog; the time the
+// DataChannel opens is in the connection trace printed by the client.
+
+std::string CandidateTypeName(webrtc::IceCandidateType type) {
+    switch (type) {
+        case webrtc::IceCandidateType::kLocal:
+            return "host";
+        case webrtc::IceCandidateType::kStun:
+            return "srflx";
+        case webrtc::IceCandidateType::kPrflx:
+            return "prflx";
+        case webrtc::IceCandidateType::kRelay:
+            return "relay";
+        default:
+            return "unknown";
+    }
+}
+
+Json::Value SummarizeIce(const webrtc::ParsedRtcEventLog &log,
+                         int64_t start_us) {
+    Json::Value ice;
+    int candidate_pairs = 0;
+    int selections = 0;
+    for (const webrtc::LoggedIceCandidatePairConfig &config :
+         log.ice_candidate_pair_configs()) {
+        if (config.type == webrtc::IceCandidatePairConfigType::kAdded) {
+            ++candidate_pairs;
+        } else if (config.type ==
+                   webrtc::IceCandidatePairConfigType::kSelected) {
+            if (selections++ == 0) {
+                ice["first_selected_ms"] =
+                        (config.timestamp_us - start_us) / 1000.0;
+            }
+            ice["selected_pair"] =
+                    CandidateTypeName(config.local_candidate_type) + "/" +
+                    CandidateTypeName(config.remote_candidate_type);
+        }
+    }
+    ice["candidate_pairs"] = candidate_pairs;
+    ice["selections"] = selections;
+
+    int checks_sent = 0;
+    int checks_received = 0;
+    for (const webrtc::LoggedIceCandidatePairEvent &event :
+         log.ice_candidate_pair_events()) {
+        const double time_ms = (event.timestamp_us - start_us) / 1000.0;
+        switch (event.type) {
+            case webrtc::IceCandidatePairEventType::kCheckSent:
+                if (checks_sent++ == 0) {
+                    ice["first_check_sent_ms"] = time_ms;
+                }
+                break;
+            case webrtc::IceCandidatePairEventType::kCheckReceived:
+                ++checks_received;
+                break;
+            case webrtc::IceCandidatePairEventType::kCheckResponseReceived:
+                if (!ice.isMember("first_response_received_ms")) {
+                    ice["first_response_received_ms"] = time_ms;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    ice["checks_sent"] = checks_sent;
+    ice["checks_received"] = checks_received;
+    return ice;
+}
+
+Json::Value SummarizeDtls(const webrtc::ParsedRtcEventLog &log,
+                          int64_t start_us) {
+    Json::Value dtls;
+    for (const webrtc::LoggedDtlsTransportState &state :
+         log.dtls_transport_states()) {
+        const double time_ms = (state.timestamp_us - start_us) / 1000.0;
+        switch (state.dtls_transport_state) {
+            case webrtc::DtlsTransportState::kConnecting:
+                if (!dtls.isMember("connecting_ms")) {
+                    dtls["connecting_ms"] = time_ms;
+                }
+                break;
+            case webrtc::DtlsTransportState::kConnected:
+                if (!dtls.isMember("connected_ms")) {
+                    dtls["connected_ms"] = time_ms;
+                }
+                break;
+            case webrtc::DtlsTransportState::kFailed:
+                dtls["failed_ms"] = time_ms;
+                break;
+            case webrtc::DtlsTransportState::kClosed:
+                dtls["closed_ms"] = time_ms;
+                break;
+            default:
+                break;
+        }
+    }
+    if (dtls.isMember("connecting_ms") && dtls.isMember("connected_ms")) {
+        dtls["handshake_ms"] = dtls["connected_ms"].asDouble() -
+                               dtls["connecting_ms"].asDouble();
+    }
+    for (const webrtc::LoggedDtlsWritableState &state :
+         log.dtls_writable_states()) {
+        if (state.writable) {
+            dtls["writable_ms"] = (state.timestamp_us - start_us) / 1000.0;
+            break;
+        }
+    }
+    return dtls;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " <file.rtclog>..." << std::endl;
+        return 1;
+    }
+    int status = 0;
+    for (int i = 1; i < argc; ++i) {
+        webrtc::ParsedRtcEventLog log;
+        const webrtc::ParsedRtcEventLog::ParseStatus parse_status =
+                log.ParseFile(argv[i]);
+        Json::Value summary;
+        summary["file"] = argv[i];
+        if (!parse_status.ok()) {
+            summary["error"] = parse_status.message();
+            std::cout << JsonToString(summary) << std::endl;
+            status = 1;
+            continue;
+        }
+        const int64_t start_us = log.first_timestamp();
+        if (!log.start_log_events().empty()) {
+            summary["start_utc_ms"] = Json::Int64(
+                    log.start_log_events().front().utc_start_time_ms);
+        }
+        summary["duration_ms"] = (log.last_timestamp() - start_us) / 1000.0;
+        summary["ice"] = SummarizeIce(log, start_us);
+        summary["dtls"] = SummarizeDtls(log, start_us);
+        std::cout << JsonToString(summary) << std::endl;
+    }
+    return status;
+}
@@ -0,0 +1,438 @@
+#pragma once
+
+#include <rtc_base/async_socket.h>
+#include <rtc_base/socket_address.h>
+#include <rtc_base/socket_server.h>
+#include <rtc_base/thread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#ifndef ASIO_STANDALONE
+#define ASIO_STANDALONE  // Use ASIO standalone lib instead of boost.
+#endif
+#include <asio/executor_work_guard.hpp>
+#include <asio/io_context.hpp>
+#include <asio/posix/stream_descriptor.hpp>
+#include <asio/post.hpp>
+
+#include "util/socket_options.h"
+
+// Nonblocking socket whose readiness is reported by an asio io_context
+// instead of PhysicalSocketServer's epoll loop. The system calls are the same
+// as PhysicalSocket's; only the waiting differs. Used on the thread running
+// the io_context, see AsioSocketServer.
+class AsioSocket : public rtc::AsyncSocket {
+public:
+    AsioSocket(asio::io_context &io_context)
+        : io_context_(io_context), descriptor_(io_context) {}
+
+    ~AsioSocket() override { Close(); }
+
+    bool Create(int family, int type) {
+        Close();
+        const int s = ::socket(family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (s < 0) {
+            error_ = errno;
+            return false;
+        }
+        attach(s, family, type, CS_CLOSED);
+        // Datagram sockets are readable as soon as they are bound.
+        if (type == SOCK_DGRAM) {
+            wait_readable();
+        }
+        return true;
+    }
+
+    rtc::SocketAddress GetLocalAddress() const override {
+        sockaddr_storage storage = {};
+        socklen_t length = sizeof(storage);
+        rtc::SocketAddress address;
+        if (::getsockname(fd(), reinterpret_cast<sockaddr *>(&storage),
+                          &length) == 0) {
+            rtc::SocketAddressFromSockAddrStorage(storage, &address);
+        }
+        return address;
+    }
+
+    rtc::SocketAddress GetRemoteAddress() const override {
+        sockaddr_storage storage = {};
+        socklen_t length = sizeof(storage);
+        rtc::SocketAddress address;
+        if (::getpeername(fd(), reinterpret_cast<sockaddr *>(&storage),
+                          &length) == 0) {
+            rtc::SocketAddressFromSockAddrStorage(storage, &address);
+        }
+        return address;
+    }
+
+    int Bind(const rtc::SocketAddress &address) override {
+        sockaddr_storage storage = {};
+        const size_t length = address.ToSockAddrStorage(&storage);
+        return check(::bind(fd(), reinterpret_cast<sockaddr *>(&storage),
+                            static_cast<socklen_t>(length)));
+    }
+
+    // Only resolved addresses are supported; WebRTC resolves TURN and STUN
+    // server names before connecting.
+    int Connect(const rtc::SocketAddress &address) override {
+        if (state_ != CS_CLOSED || address.IsUnresolvedIP()) {
+            error_ = EINVAL;
+            return -1;
+        }
+        sockaddr_storage storage = {};
+        const size_t length = address.ToSockAddrStorage(&storage);
+        if (::connect(fd(), reinterpret_cast<sockaddr *>(&storage),
+                      static_cast<socklen_t>(length)) == 0) {
+            state_ = CS_CONNECTED;
+            wait_readable();
+            return 0;
+        }
+        error_ = errno;
+        if (!rtc::IsBlockingError(error_) && error_ != EINPROGRESS) {
+            return -1;
+        }
+        // Completion is reported by writability, as with PhysicalSocket.
+        state_ = CS_CONNECTING;
+        wait_writable();
+        return 0;
+    }
+
+    int Send(const void *data, size_t size) override {
+        return check_send(::send(fd(), data, size, MSG_NOSIGNAL));
+    }
+
+    int SendTo(const void *data,
+               size_t size,
+               const rtc::SocketAddress &address) override {
+        sockaddr_storage storage = {};
+        const size_t length = address.ToSockAddrStorage(&storage);
+        return check_send(::sendto(fd(), data, size, MSG_NOSIGNAL,
+                                   reinterpret_cast<sockaddr *>(&storage),
+                                   static_cast<socklen_t>(length)));
+    }
+
+    int Recv(void *data, size_t size, int64_t *timestamp) override {
+        return RecvFrom(data, size, nullptr, timestamp);
+    }
+
+    int RecvFrom(void *data,
+                 size_t size,
+                 rtc::SocketAddress *address,
+                 int64_t *timestamp) override {
+        sockaddr_storage storage = {};
+        socklen_t length = sizeof(storage);
+        const ssize_t received =
+                ::recvfrom(fd(), data, size, 0,
+                           reinterpret_cast<sockaddr *>(&storage), &length);
+        if (timestamp != nullptr) {
+            *timestamp = -1;
+        }
+        if (received < 0) {
+            error_ = errno;
+            return -1;
+        }
+        if (received == 0 && size != 0 && type_ == SOCK_STREAM) {
+            // Report EOF as a close event, as PhysicalSocket does, so that
+            // Recv() itself never returns 0.
+            error_ = EWOULDBLOCK;
+            post_close(0);
+            return -1;
+        }
+        if (address != nullptr) {
+            rtc::SocketAddressFromSockAddrStorage(storage, address);
+        }
+        return static_cast<int>(received);
+    }
+
+    int Listen(int backlog) override {
+        if (check(::listen(fd(), backlog)) < 0) {
+            return -1;
+        }
+        state_ = CS_CONNECTING;
+        wait_readable();
+        return 0;
+    }
+
+    rtc::AsyncSocket *Accept(rtc::SocketAddress *address) override {
+        sockaddr_storage storage = {};
+        socklen_t length = sizeof(storage);
+        const int s = ::accept4(fd(), reinterpret_cast<sockaddr *>(&storage),
+                                &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (s < 0) {
+            error_ = errno;
+            return nullptr;
+        }
+        if (address != nullptr) {
+            rtc::SocketAddressFromSockAddrStorage(storage, address);
+        }
+        AsioSocket *socket = new AsioSocket(io_context_);
+        socket->attach(s, storage.ss_family, SOCK_STREAM, CS_CONNECTED);
+        socket->wait_readable();
+        return socket;
+    }
+
+    int Close() override {
+        if (!descriptor_.is_open()) {
+            return 0;
+        }
+        // Completion handlers still queued must not touch this socket.
+        alive_.reset();
+        asio::error_code error;
+        descriptor_.close(error);
+        fd_ = -1;
+        state_ = CS_CLOSED;
+        reading_ = false;
+        writing_ = false;
+        return 0;
+    }
+
+    int GetError() const override { return error_; }
+    void SetError(int error) override { error_ = error; }
+    ConnState GetState() const override { return state_; }
+
+    int GetOption(Option option, int *value) override {
+        return check(GetSocketOption(fd(), family_, option, value));
+    }
+
+    int SetOption(Option option, int value) override {
+        return check(SetSocketOption(fd(), family_, option, value));
+    }
+
+private:
+    void attach(int s, int family, int type, ConnState state) {
+        descriptor_.assign(s);
+        fd_ = s;
+        alive_ = std::make_shared<int>(0);
+        family_ = family;
+        type_ = type;
+        state_ = state;
+    }
+
+    int fd() const { return fd_; }
+
+    int check(int result) {
+        if (result < 0) {
+            error_ = errno;
+        }
+        return result;
+    }
+
+    int check_send(ssize_t sent) {
+        if (sent < 0) {
+            error_ = errno;
+            if (rtc::IsBlockingError(error_)) {
+                wait_writable();
+            }
+            return -1;
+        }
+        return static_cast<int>(sent);
+    }
+
+    // Readiness is waited for one event at a time and re-armed after the
+    // signal, which makes it level-triggered: data left unread fires again.
+    void wait_readable() {
+        if (reading_ || !descriptor_.is_open()) {
+            return;
+        }
+        reading_ = true;
+        std::weak_ptr<int> alive = alive_;
+        descriptor_.async_wait(
+                asio::posix::stream_descriptor::wait_read,
+                [this, alive](const asio::error_code &error) {
+                    if (error || alive.expired()) {
+                        return;
+                    }
+                    reading_ = false;
+                    SignalReadEvent(this);
+                    // The slots may have closed or deleted the socket.
+                    if (!alive.expired() &&
+                        (type_ == SOCK_DGRAM || state_ != CS_CLOSED)) {
+                        wait_readable();
+                    }
+                });
+    }
+
+    void wait_writable() {
+        if (writing_ || !descriptor_.is_open()) {
+            return;
+        }
+        writing_ = true;
+        std::weak_ptr<int> alive = alive_;
+        descriptor_.async_wait(
+                asio::posix::stream_descriptor::wait_write,
+                [this, alive](const asio::error_code &error) {
+                    if (error || alive.expired()) {
+                        return;
+                    }
+                    writing_ = false;
+                    if (state_ != CS_CONNECTING) {
+                        SignalWriteEvent(this);
+                        return;
+                    }
+                    int connect_error = 0;
+                    socklen_t length = sizeof(connect_error);
+                    ::getsockopt(fd(), SOL_SOCKET, SO_ERROR, &connect_error,
+                                 &length);
+                    if (connect_error != 0) {
+                        error_ = connect_error;
+                        Close();
+                        SignalCloseEvent(this, connect_error);
+                        return;
+                    }
+                    state_ = CS_CONNECTED;
+                    wait_readable();
+                    SignalConnectEvent(this);
+                });
+    }
+
+    void post_close(int error) {
+        std::weak_ptr<int> alive = alive_;
+        asio::post(io_context_, [this, alive, error]() {
+            if (alive.expired()) {
+                return;
+            }
+            state_ = CS_CLOSED;
+            SignalCloseEvent(this, error);
+        });
+    }
+
+    asio::io_context &io_context_;
+    asio::posix::stream_descriptor descriptor_;
+    // Reset when the descriptor closes; handlers hold weak references.
+    std::shared_ptr<int> alive_;
+    int fd_ = -1;
+    int family_ = AF_INET;
+    int type_ = SOCK_DGRAM;
+    ConnState state_ = CS_CLOSED;
+    int error_ = 0;
+    bool reading_ = false;
+    bool writing_ = false;
+};
+
+// rtc::SocketServer running an asio io_context. A rtc::Thread created with
+// it runs the io_context while it waits for messages, so WebRTC's network
+// sockets and any other asio user of the same io_context, e.g. a websocketpp
+// endpoint after init_asio(&io_context), share one thread and one epoll
+// loop. Signaling messages then reach WebRTC without a thread hop.
+//
+// Only that thread may run the io_context. Sockets are always nonblocking.
+class AsioSocketServer : public rtc::SocketServer {
+public:
+    AsioSocketServer(asio::io_context &io_context)
+        : io_context_(io_context), work_(io_context.get_executor()) {}
+
+    ~AsioSocketServer() override { work_.reset(); }
+
+    rtc::Socket *CreateSocket(int family, int type) override {
+        return CreateAsyncSocket(family, type);
+    }
+
+    rtc::AsyncSocket *CreateAsyncSocket(int family, int type) override {
+        AsioSocket *socket = new AsioSocket(io_context_);
+        if (!socket->Create(family, type)) {
+            delete socket;
+            return nullptr;
+        }
+        return socket;
+    }
+
+    bool Wait(int cms, bool process_io) override {
+        if (!process_io) {
+            // Thread::Send() waiting for a reply; run no handler meanwhile.
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (cms == kForever) {
+                cv_.wait(lock, [this]() { return wake_up_; });
+            } else {
+                cv_.wait_for(lock, std::chrono::milliseconds(cms),
+                             [this]() { return wake_up_; });
+            }
+            wake_up_ = false;
+            return true;
+        }
+        if (cms == 0) {
+            io_context_.poll();
+            consume_wake_up();
+            return true;
+        }
+        const std::chrono::steady_clock::time_point deadline =
+                std::chrono::steady_clock::now() +
+                std::chrono::milliseconds(cms);
+        while (!consume_wake_up()) {
+            if (cms == kForever) {
+                io_context_.run_one();
+            } else if (std::chrono::steady_clock::now() < deadline) {
+                io_context_.run_one_until(deadline);
+            } else {
+                break;
+            }
+        }
+        return true;
+    }
+
+    void WakeUp() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (wake_up_) {
+                return;
+            }
+            wake_up_ = true;
+        }
+        cv_.notify_one();
+        // Makes run_one() return.
+        asio::post(io_context_, []() {});
+    }
+
+private:
+    bool consume_wake_up() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const bool wake_up = wake_up_;
+        wake_up_ = false;
+        return wake_up;
+    }
+
+    asio::io_context &io_context_;
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool wake_up_ = false;
+};
+
+// A rtc::Thread running its own io_context through an AsioSocketServer. Use
+// thread() as network and signaling thread of a WebRTCManager, and pass
+// io_context() to websocketpp's init_asio() instead of calling run().
+class AsioEventLoop {
+public:
+    AsioEventLoop(const std::string &name)
+        : socket_server_(io_context_), thread_(&socket_server_) {
+        thread_.SetName(name, nullptr);
+    }
+
+    ~AsioEventLoop() { stop(); }
+
+    void start() { thread_.Start(); }
+    void stop() { thread_.Stop(); }
+
+    asio::io_context &io_context() { return io_context_; }
+    rtc::Thread *thread() { return &thread_; }
+
+private:
+    asio::io_context io_context_;
+    AsioSocketServer socket_server_;
+    rtc::Thread thread_;
+};
+
+// Runtime switch for the client and server: signaling and WebRTC networking
+// share one AsioEventLoop when WEBRTC_UNIFIED_LOOP is set to 1.
+inline bool UnifiedEventLoopFromEnv() {
+    const char *value = std::getenv("WEBRTC_UNIFIED_LOOP");
+    return value != nullptr && std::string(value) == "1";
+}
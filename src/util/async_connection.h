@@ -0,0 +1,471 @@
+#pragma once
+
+#include <rtc_base/thread.h>
+
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "util/webrtc_manager.h"
+
+// C++20 coroutine API over WebRTCManager. The rest of the code base builds as
+// C++14; only the targets that include this header need C++20.
+//
+// Every awaitable resumes its coroutine on an executor, the rtc::Thread given
+// to AsyncConnection, by posting to it. Session logic therefore never runs on
+// WebRTC's signaling thread, and thousands of sessions can share a few
+// executors without blocking any thread while they wait.
+
+namespace coro_internal {
+
+inline void Post(rtc::Thread *executor, std::coroutine_handle<> handle) {
+    executor->PostTask(RTC_FROM_HERE, [handle]() { handle.resume(); });
+}
+
+class PromiseBase {
+public:
+    // Resume the awaiting coroutine, if any, when the task completes.
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(
+                std::coroutine_handle<Promise> handle) noexcept {
+            std::coroutine_handle<> continuation =
+                    handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+};
+
+template <typename T>
+class ReturnValue {
+public:
+    void return_value(T value) { value_.emplace(std::move(value)); }
+    T take() { return std::move(*value_); }
+
+private:
+    std::optional<T> value_;
+};
+
+template <>
+class ReturnValue<void> {
+public:
+    void return_void() {}
+    void take() {}
+};
+
+// Coroutine started by Spawn(), which destroys itself when done.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// A value set once, first setter wins, awaited by at most one coroutine.
+template <typename T>
+class Completion {
+public:
+    explicit Completion(rtc::Thread *executor) : executor_(executor) {}
+
+    void set(T value) {
+        std::coroutine_handle<> waiter;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (value_) {
+                return;
+            }
+            value_.emplace(std::move(value));
+            std::swap(waiter, waiter_);
+        }
+        if (waiter) {
+            Post(executor_, waiter);
+        }
+    }
+
+    class Awaiter {
+    public:
+        explicit Awaiter(Completion &completion) : completion_(completion) {}
+
+        bool await_ready() {
+            std::lock_guard<std::mutex> lock(completion_.mutex_);
+            return completion_.value_.has_value();
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lock(completion_.mutex_);
+            if (completion_.value_) {
+                return false;
+            }
+            completion_.waiter_ = handle;
+            return true;
+        }
+
+        T await_resume() {
+            std::lock_guard<std::mutex> lock(completion_.mutex_);
+            return *completion_.value_;
+        }
+
+    private:
+        Completion &completion_;
+    };
+
+    Awaiter wait() { return Awaiter(*this); }
+
+private:
+    rtc::Thread *const executor_;
+    std::mutex mutex_;
+    std::optional<T> value_;
+    std::coroutine_handle<> waiter_;
+};
+
+// Values pushed by one thread and popped by at most one coroutine at a time.
+// pop() yields std::nullopt once the queue is closed and drained.
+template <typename T>
+class Queue {
+public:
+    explicit Queue(rtc::Thread *executor) : executor_(executor) {}
+
+    void push(T value) {
+        std::coroutine_handle<> waiter;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (closed_) {
+                return;
+            }
+            values_.push_back(std::move(value));
+            std::swap(waiter, waiter_);
+        }
+        if (waiter) {
+            Post(executor_, waiter);
+        }
+    }
+
+    void close() {
+        std::coroutine_handle<> waiter;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            std::swap(waiter, waiter_);
+        }
+        if (waiter) {
+            Post(executor_, waiter);
+        }
+    }
+
+    class Awaiter {
+    public:
+        explicit Awaiter(Queue &queue) : queue_(queue) {}
+
+        bool await_ready() {
+            std::lock_guard<std::mutex> lock(queue_.mutex_);
+            return !queue_.values_.empty() || queue_.closed_;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lock(queue_.mutex_);
+            if (!queue_.values_.empty() || queue_.closed_) {
+                return false;
+            }
+            queue_.waiter_ = handle;
+            return true;
+        }
+
+        std::optional<T> await_resume() {
+            std::lock_guard<std::mutex> lock(queue_.mutex_);
+            if (queue_.values_.empty()) {
+                return std::nullopt;
+            }
+            T value = std::move(queue_.values_.front());
+            queue_.values_.pop_front();
+            return value;
+        }
+
+    private:
+        Queue &queue_;
+    };
+
+    Awaiter pop() { return Awaiter(*this); }
+
+private:
+    rtc::Thread *const executor_;
+    std::mutex mutex_;
+    std::deque<T> values_;
+    bool closed_ = false;
+    std::coroutine_handle<> waiter_;
+};
+
+}  // namespace coro_internal
+
+// Lazily started coroutine returning T. Runs when awaited, and resumes the
+// awaiting coroutine where it completes; exceptions propagate to it.
+template <typename T = void>
+class Task {
+public:
+    struct promise_type : coro_internal::PromiseBase,
+                          coro_internal::ReturnValue<T> {
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(
+                    *this));
+        }
+    };
+
+    Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(
+            std::coroutine_handle<> continuation) noexcept {
+        handle_.promise().continuation = continuation;
+        return handle_;
+    }
+
+    T await_resume() {
+        if (handle_.promise().exception) {
+            std::rethrow_exception(handle_.promise().exception);
+        }
+        return handle_.promise().take();
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle)
+        : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// co_await ResumeOn(thread) continues the coroutine on |thread|.
+class ResumeOn {
+public:
+    explicit ResumeOn(rtc::Thread *executor) : executor_(executor) {}
+
+    bool await_ready() const { return executor_->IsCurrent(); }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        coro_internal::Post(executor_, handle);
+    }
+
+    void await_resume() {}
+
+private:
+    rtc::Thread *const executor_;
+};
+
+// Run |task| on |executor| without waiting for it. An exception escaping the
+// task terminates the program, as it would from a std::thread.
+inline coro_internal::Detached Spawn(rtc::Thread *executor, Task<> task) {
+    co_await ResumeOn(executor);
+    co_await task;
+}
+
+// Carries the signaling messages of an AsyncConnection to the remote peer.
+// Called on the signaling thread of the connection. Messages from the remote
+// peer are handed back with AsyncConnection::push_sdp() and push_ice().
+class Signaler {
+public:
+    virtual ~Signaler() = default;
+    virtual void send_sdp(const std::string &sdp) = 0;
+    virtual void send_ice(const Ice &ice) = 0;
+};
+
+// Awaitable handshake, sends and receives of one WebRTCManager:
+//
+//     AsyncConnection connection(manager, executor, signaler,
+//                                AsyncConnection::Role::kOfferer);
+//     manager.init();
+//     if (co_await connection.open(10000)) {
+//         co_await connection.send("ping");
+//         std::optional<std::string> reply = co_await connection.receive();
+//     }
+//
+// The manager's on_sdp, on_ice, on_success, on_message, on_close,
+// on_buffered_amount_change and on_error callbacks are taken over, so
+// construct it before init(). The role is fixed at construction, so
+// push_sdp() may be called before open(). A failed session completes open()
+// with false and ends receive(). Each of send() and receive() supports one
+// pending call at a time.
+class AsyncConnection {
+    struct State;
+
+public:
+    enum class Role { kOfferer, kAnswerer };
+
+    AsyncConnection(WebRTCManager &manager,
+                    rtc::Thread *executor,
+                    Signaler &signaler,
+                    Role role,
+                    uint64_t max_buffered = 1 << 20)
+        : manager_(manager),
+          executor_(executor),
+          role_(role),
+          state_(std::make_shared<State>(
+                  manager, executor, signaler, max_buffered)) {
+        std::shared_ptr<State> state = state_;
+        manager_.on_sdp([state](const std::string &sdp) {
+            state->signaler->send_sdp(sdp);
+        });
+        manager_.on_ice(
+                [state](const Ice &ice) { state->signaler->send_ice(ice); });
+        manager_.on_success([state]() { state->open.set(true); });
+        manager_.on_message([state](const std::string &message) {
+            state->messages.push(message);
+        });
+        manager_.on_close([state]() {
+            state->open.set(false);
+            state->messages.close();
+        });
+        manager_.on_error([state](const OperationError &) {
+            state->open.set(false);
+            state->messages.close();
+        });
+        manager_.on_buffered_amount_change(
+                [state](uint64_t) { state->resume_sender_if_writable(); });
+    }
+
+    // Open the connection: the offerer sends its offer, the answerer waits
+    // for it through push_sdp(). Completes with true once the DataChannel is
+    // open, false if it closes or |timeout_ms| passes first.
+    Task<bool> open(int timeout_ms) {
+        start_timeout(timeout_ms);
+        if (role_ == Role::kOfferer) {
+            manager_.create_offer_sdp();
+        }
+        co_return co_await state_->open.wait();
+    }
+
+    // Signaling messages from the remote peer.
+    void push_sdp(const std::string &sdp) {
+        if (role_ == Role::kOfferer) {
+            manager_.push_reply_sdp(sdp);
+        } else {
+            manager_.create_answer_sdp(sdp);
+        }
+    }
+
+    void push_ice(const Ice &ice) { manager_.push_ice(ice); }
+
+    // Completes once |message| is queued in the DataChannel, waiting while
+    // more than |max_buffered| bytes are queued already.
+    class SendAwaiter {
+    public:
+        SendAwaiter(std::shared_ptr<State> state, std::string message)
+            : state_(state), message_(std::move(message)) {}
+
+        bool await_ready() { return state_->writable(); }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            {
+                std::lock_guard<std::mutex> lock(state_->sender_mutex);
+                state_->sender = handle;
+            }
+            // The buffer may have drained since await_ready(); check again
+            // where the drain is reported.
+            std::shared_ptr<State> state = state_;
+            state_->manager.get_signaling_thread()->PostTask(
+                    RTC_FROM_HERE,
+                    [state]() { state->resume_sender_if_writable(); });
+        }
+
+        void await_resume() { state_->manager.send(message_); }
+
+    private:
+        std::shared_ptr<State> state_;
+        const std::string message_;
+    };
+
+    SendAwaiter send(std::string message) {
+        return SendAwaiter(state_, std::move(message));
+    }
+
+    // Next message received, or std::nullopt once the DataChannel is closed.
+    coro_internal::Queue<std::string>::Awaiter receive() {
+        return state_->messages.pop();
+    }
+
+    rtc::Thread *executor() const { return executor_; }
+
+private:
+    // Shared with the manager's callbacks, which may run after the
+    // AsyncConnection is gone.
+    struct State {
+        State(WebRTCManager &manager_,
+              rtc::Thread *executor_,
+              Signaler &signaler_,
+              uint64_t max_buffered_)
+            : manager(manager_),
+              executor(executor_),
+              signaler(&signaler_),
+              max_buffered(max_buffered_),
+              open(executor_),
+              messages(executor_) {}
+
+        bool writable() const {
+            return manager.connection.data_channel->buffered_amount() <=
+                   max_buffered;
+        }
+
+        // Runs on the signaling thread.
+        void resume_sender_if_writable() {
+            if (!writable()) {
+                return;
+            }
+            std::coroutine_handle<> waiter;
+            {
+                std::lock_guard<std::mutex> lock(sender_mutex);
+                std::swap(waiter, sender);
+            }
+            if (waiter) {
+                coro_internal::Post(executor, waiter);
+            }
+        }
+
+        WebRTCManager &manager;
+        rtc::Thread *const executor;
+        Signaler *const signaler;
+        const uint64_t max_buffered;
+        coro_internal::Completion<bool> open;
+        coro_internal::Queue<std::string> messages;
+
+        std::mutex sender_mutex;
+        std::coroutine_handle<> sender;
+    };
+
+    void start_timeout(int timeout_ms) {
+        std::shared_ptr<State> state = state_;
+        executor_->PostDelayedTask(
+                RTC_FROM_HERE, [state]() { state->open.set(false); },
+                timeout_ms);
+    }
+
+    WebRTCManager &manager_;
+    rtc::Thread *const executor_;
+    const Role role_;
+    std::shared_ptr<State> state_;
+};
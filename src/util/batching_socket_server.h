@@ -0,0 +1,474 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <rtc_base/physical_socket_server.h>
+#include <rtc_base/socket_address.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "util/native_udp_socket.h"
+
+struct BatchingConfig {
+    // Datagrams moved by one recvmmsg() or sendmmsg().
+    size_t batch_size = 32;
+
+    // Size of each receive slot. Longer datagrams are truncated; WebRTC's
+    // packets stay below the path MTU.
+    size_t max_datagram_size = 2048;
+
+    // Send runs of equal-sized datagrams to one address as one message the
+    // kernel segments (UDP_SEGMENT, Linux 4.18). Ignored where the headers
+    // lack UDP_SEGMENT.
+    bool gso = false;
+
+    // Let the kernel coalesce received datagrams of one flow (UDP_GRO, Linux
+    // 5.0). Receive slots then grow to 64KB.
+    bool gro = false;
+};
+
+// Counters of one BatchingSocketServer, only touched on its thread.
+struct BatchingStats {
+    uint64_t receive_calls = 0;
+    uint64_t datagrams_received = 0;
+    uint64_t send_calls = 0;
+    uint64_t datagrams_sent = 0;
+    // Datagrams the kernel refused, e.g. on unreachable destinations. UDP
+    // gives no delivery guarantee, so they are dropped as a lost packet.
+    uint64_t send_drops = 0;
+    // Datagrams of a receive batch the socket did not read while it was
+    // signaled.
+    uint64_t receive_drops = 0;
+};
+
+class BatchingSocketServer;
+
+// UDP socket whose receives and sends are batched by its
+// BatchingSocketServer:
+// - On readability, one recvmmsg() fills a queue of datagrams, and
+//   SignalReadEvent fires once per datagram; RecvFrom() pops the queue
+//   without a system call.
+// - SendTo() queues a copy of the datagram and reports it sent. The queue is
+//   flushed with one sendmmsg() when it is full, after each receive batch
+//   and before the thread waits for I/O.
+class BatchedUdpSocket : public NativeUdpSocket, public rtc::Dispatcher {
+public:
+    BatchedUdpSocket(BatchingSocketServer *server,
+                     const BatchingConfig &config,
+                     BatchingStats *stats)
+        : server_(server), config_(config), stats_(stats) {}
+
+    ~BatchedUdpSocket() override { Close(); }
+
+    bool Create(int family);
+
+    int SendTo(const void *data,
+               size_t size,
+               const rtc::SocketAddress &address) override;
+
+    int RecvFrom(void *data,
+                 size_t size,
+                 rtc::SocketAddress *address,
+                 int64_t *timestamp) override {
+        if (timestamp != nullptr) {
+            *timestamp = -1;
+        }
+        if (read_index_ == received_.size()) {
+            // Called outside of a read event; read directly.
+            sockaddr_storage storage = {};
+            socklen_t length = sizeof(storage);
+            const ssize_t n = ::recvfrom(
+                    fd_, data, size, 0,
+                    reinterpret_cast<sockaddr *>(&storage), &length);
+            if (n < 0) {
+                error_ = errno;
+                return -1;
+            }
+            ++stats_->receive_calls;
+            ++stats_->datagrams_received;
+            if (address != nullptr) {
+                rtc::SocketAddressFromSockAddrStorage(storage, address);
+            }
+            return static_cast<int>(n);
+        }
+        const Received &received = received_[read_index_++];
+        const size_t copied = std::min(size, received.size);
+        std::memcpy(data, &receive_buffer_[received.offset], copied);
+        if (address != nullptr) {
+            rtc::SocketAddressFromSockAddrStorage(
+                    receive_addresses_[received.message], address);
+        }
+        return static_cast<int>(copied);
+    }
+
+    int Close() override;
+
+    // rtc::Dispatcher, called by the PhysicalSocketServer loop.
+    uint32_t GetRequestedEvents() override {
+        return rtc::DE_READ | (write_blocked_ ? rtc::DE_WRITE : 0);
+    }
+
+    void OnPreEvent(uint32_t events) override {}
+    void OnEvent(uint32_t events, int error) override;
+    int GetDescriptor() override { return fd_; }
+    bool IsDescriptorClosed() override { return false; }
+
+    // Send the queued datagrams. Stops at the first datagram the kernel
+    // cannot take yet, and waits for writability.
+    void flush();
+
+private:
+    // A datagram of the last receive batch.
+    struct Received {
+        size_t offset;
+        size_t size;
+        size_t message;
+    };
+
+    struct Outgoing {
+        std::vector<char> data;
+        sockaddr_storage address;
+        socklen_t address_length;
+    };
+
+    void receive_batch() {
+        const size_t slot = gro_ ? 65536 : config_.max_datagram_size;
+        const size_t count = config_.batch_size;
+        receive_buffer_.resize(slot * count);
+        receive_addresses_.resize(count);
+        receive_iovecs_.resize(count);
+        receive_messages_.resize(count);
+        receive_controls_.resize(count * kControlSize);
+        for (size_t i = 0; i < count; ++i) {
+            receive_iovecs_[i].iov_base = &receive_buffer_[i * slot];
+            receive_iovecs_[i].iov_len = slot;
+            msghdr &header = receive_messages_[i].msg_hdr;
+            std::memset(&header, 0, sizeof(header));
+            header.msg_name = &receive_addresses_[i];
+            header.msg_namelen = sizeof(sockaddr_storage);
+            header.msg_iov = &receive_iovecs_[i];
+            header.msg_iovlen = 1;
+            if (gro_) {
+                header.msg_control = &receive_controls_[i * kControlSize];
+                header.msg_controllen = kControlSize;
+            }
+        }
+        const int n = ::recvmmsg(fd_, receive_messages_.data(),
+                                 static_cast<unsigned int>(count),
+                                 MSG_DONTWAIT, nullptr);
+        ++stats_->receive_calls;
+        received_.clear();
+        read_index_ = 0;
+        if (n < 0) {
+            error_ = errno;
+            return;
+        }
+        for (size_t i = 0; i < static_cast<size_t>(n); ++i) {
+            const size_t length = receive_messages_[i].msg_len;
+            size_t segment = length;
+#ifdef UDP_GRO
+            if (gro_) {
+                msghdr &header = receive_messages_[i].msg_hdr;
+                for (cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr;
+                     cmsg = CMSG_NXTHDR(&header, cmsg)) {
+                    if (cmsg->cmsg_level == SOL_UDP &&
+                        cmsg->cmsg_type == UDP_GRO) {
+                        int gso_size;
+                        std::memcpy(&gso_size, CMSG_DATA(cmsg),
+                                    sizeof(gso_size));
+                        segment = gso_size;
+                    }
+                }
+            }
+#endif
+            // A coalesced message holds equal-sized datagrams, the last one
+            // possibly shorter.
+            for (size_t offset = 0; offset < length; offset += segment) {
+                received_.push_back({i * slot + offset,
+                                     std::min(segment, length - offset), i});
+            }
+        }
+        stats_->datagrams_received += received_.size();
+    }
+
+    // Control buffer of one received message, large enough for UDP_GRO.
+    static constexpr size_t kControlSize = 64;
+
+    BatchingSocketServer *const server_;
+    const BatchingConfig config_;
+    BatchingStats *const stats_;
+    bool gro_ = false;
+    // Reset on close; checked after each signal, whose slots may delete the
+    // socket.
+    std::shared_ptr<int> alive_;
+
+    std::vector<char> receive_buffer_;
+    std::vector<sockaddr_storage> receive_addresses_;
+    std::vector<iovec> receive_iovecs_;
+    std::vector<mmsghdr> receive_messages_;
+    std::vector<char> receive_controls_;
+    std::vector<Received> received_;
+    size_t read_index_ = 0;
+
+    std::vector<Outgoing> outgoing_;
+    bool flush_scheduled_ = false;
+    bool write_blocked_ = false;
+
+    friend class BatchingSocketServer;
+};
+
+// PhysicalSocketServer whose UDP sockets batch their system calls, see
+// BatchedUdpSocket. TCP sockets are PhysicalSocketServer's own. Plug it into
+// WebRTCManager::create_socket_server to use it for the network thread.
+class BatchingSocketServer : public rtc::PhysicalSocketServer {
+public:
+    BatchingSocketServer(const BatchingConfig &config = BatchingConfig())
+        : config_(config) {}
+
+    rtc::AsyncSocket *CreateAsyncSocket(int family, int type) override {
+        if (type != SOCK_DGRAM) {
+            return rtc::PhysicalSocketServer::CreateAsyncSocket(family, type);
+        }
+        BatchedUdpSocket *socket =
+                new BatchedUdpSocket(this, config_, &stats_);
+        if (!socket->Create(family)) {
+            delete socket;
+            return nullptr;
+        }
+        return socket;
+    }
+
+    bool Wait(int cms, bool process_io) override {
+        if (process_io) {
+            flush_all();
+        }
+        return rtc::PhysicalSocketServer::Wait(cms, process_io);
+    }
+
+    // Read on the thread of the socket server.
+    const BatchingStats &stats() const { return stats_; }
+
+private:
+    friend class BatchedUdpSocket;
+
+    void schedule_flush(BatchedUdpSocket *socket) {
+        if (!socket->flush_scheduled_) {
+            socket->flush_scheduled_ = true;
+            to_flush_.push_back(socket);
+        }
+    }
+
+    void cancel_flush(BatchedUdpSocket *socket) {
+        if (socket->flush_scheduled_) {
+            socket->flush_scheduled_ = false;
+            to_flush_.erase(
+                    std::remove(to_flush_.begin(), to_flush_.end(), socket),
+                    to_flush_.end());
+        }
+    }
+
+    void flush_all() {
+        std::vector<BatchedUdpSocket *> sockets;
+        sockets.swap(to_flush_);
+        for (BatchedUdpSocket *socket : sockets) {
+            socket->flush_scheduled_ = false;
+            socket->flush();
+        }
+    }
+
+    const BatchingConfig config_;
+    BatchingStats stats_;
+    std::vector<BatchedUdpSocket *> to_flush_;
+};
+
+inline bool BatchedUdpSocket::Create(int family) {
+    if (!open(family)) {
+        return false;
+    }
+    alive_ = std::make_shared<int>(0);
+#ifdef UDP_GRO
+    if (config_.gro) {
+        const int on = 1;
+        gro_ = ::setsockopt(fd_, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+    }
+#endif
+    server_->Add(this);
+    return true;
+}
+
+inline int BatchedUdpSocket::Close() {
+    if (fd_ < 0) {
+        return 0;
+    }
+    server_->Remove(this);
+    server_->cancel_flush(this);
+    ::close(fd_);
+    fd_ = -1;
+    alive_.reset();
+    outgoing_.clear();
+    received_.clear();
+    read_index_ = 0;
+    return 0;
+}
+
+inline int BatchedUdpSocket::SendTo(const void *data,
+                                    size_t size,
+                                    const rtc::SocketAddress &address) {
+    // Closed; queuing would hand the server a socket it no longer tracks.
+    if (fd_ < 0) {
+        error_ = EBADF;
+        return -1;
+    }
+    if (outgoing_.size() >= config_.batch_size) {
+        flush();
+        if (outgoing_.size() >= config_.batch_size) {
+            error_ = EWOULDBLOCK;
+            return -1;
+        }
+    }
+    outgoing_.emplace_back();
+    Outgoing &outgoing = outgoing_.back();
+    const char *bytes = static_cast<const char *>(data);
+    outgoing.data.assign(bytes, bytes + size);
+    outgoing.address_length = static_cast<socklen_t>(
+            address.ToSockAddrStorage(&outgoing.address));
+    server_->schedule_flush(this);
+    return static_cast<int>(size);
+}
+
+inline void BatchedUdpSocket::OnEvent(uint32_t events, int error) {
+    BatchingSocketServer *server = server_;
+    std::weak_ptr<int> alive = alive_;
+    if (events & rtc::DE_WRITE) {
+        write_blocked_ = false;
+        server->Update(this);
+        flush();
+        if (outgoing_.empty()) {
+            SignalWriteEvent(this);
+            if (alive.expired()) {
+                return;
+            }
+        }
+    }
+    if (events & rtc::DE_READ) {
+        receive_batch();
+        while (read_index_ < received_.size()) {
+            const size_t before = read_index_;
+            SignalReadEvent(this);
+            if (alive.expired()) {
+                break;
+            }
+            // Not read; the next batch replaces the queue, so UDP drops
+            // the rest rather than stall the loop.
+            if (read_index_ == before) {
+                stats_->receive_drops += received_.size() - read_index_;
+                read_index_ = received_.size();
+                break;
+            }
+        }
+        // Answers to the batch, e.g. STUN responses and SCTP SACKs, leave
+        // together.
+        server->flush_all();
+    }
+}
+
+inline void BatchedUdpSocket::flush() {
+#ifdef UDP_SEGMENT
+    // Runs of datagrams sent by one mmsghdr each, with GSO.
+    constexpr size_t kMaxSegments = 64;
+    constexpr size_t kMaxGsoBytes = 65000;
+#endif
+    constexpr size_t kControlSpace = CMSG_SPACE(sizeof(uint16_t));
+    while (!outgoing_.empty() && !write_blocked_) {
+        std::vector<mmsghdr> messages;
+        std::vector<iovec> iovecs(outgoing_.size());
+        std::vector<size_t> datagrams;
+        std::vector<char> controls(outgoing_.size() * kControlSpace);
+        messages.reserve(outgoing_.size());
+        for (size_t i = 0; i < outgoing_.size();) {
+            size_t run = 1;
+#ifdef UDP_SEGMENT
+            size_t bytes = outgoing_[i].data.size();
+            if (config_.gso) {
+                // Equal sizes to one address; the last may be shorter.
+                while (i + run < outgoing_.size() && run < kMaxSegments) {
+                    const Outgoing &next = outgoing_[i + run];
+                    if (next.address_length != outgoing_[i].address_length ||
+                        std::memcmp(&next.address, &outgoing_[i].address,
+                                    next.address_length) != 0 ||
+                        next.data.size() > outgoing_[i].data.size() ||
+                        bytes + next.data.size() > kMaxGsoBytes ||
+                        outgoing_[i + run - 1].data.size() !=
+                                outgoing_[i].data.size()) {
+                        break;
+                    }
+                    bytes += next.data.size();
+                    ++run;
+                }
+            }
+#endif
+            for (size_t j = 0; j < run; ++j) {
+                iovecs[i + j].iov_base = outgoing_[i + j].data.data();
+                iovecs[i + j].iov_len = outgoing_[i + j].data.size();
+            }
+            mmsghdr message;
+            std::memset(&message, 0, sizeof(message));
+            message.msg_hdr.msg_name = &outgoing_[i].address;
+            message.msg_hdr.msg_namelen = outgoing_[i].address_length;
+            message.msg_hdr.msg_iov = &iovecs[i];
+            message.msg_hdr.msg_iovlen = run;
+#ifdef UDP_SEGMENT
+            if (run > 1) {
+                message.msg_hdr.msg_control =
+                        &controls[messages.size() * kControlSpace];
+                message.msg_hdr.msg_controllen = kControlSpace;
+                cmsghdr *cmsg = CMSG_FIRSTHDR(&message.msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                const uint16_t segment_size =
+                        static_cast<uint16_t>(outgoing_[i].data.size());
+                std::memcpy(CMSG_DATA(cmsg), &segment_size,
+                            sizeof(segment_size));
+            }
+#endif
+            messages.push_back(message);
+            datagrams.push_back(run);
+            i += run;
+        }
+
+        const int n = ::sendmmsg(fd_, messages.data(),
+                                 static_cast<unsigned int>(messages.size()),
+                                 MSG_DONTWAIT);
+        ++stats_->send_calls;
+        size_t sent_messages = 0;
+        if (n < 0) {
+            error_ = errno;
+            if (rtc::IsBlockingError(error_)) {
+                write_blocked_ = true;
+                server_->Update(this);
+                return;
+            }
+            // The first message failed; drop it and send the rest.
+            stats_->send_drops += datagrams[0];
+            sent_messages = 1;
+        } else {
+            sent_messages = static_cast<size_t>(n);
+            for (size_t i = 0; i < sent_messages; ++i) {
+                stats_->datagrams_sent += datagrams[i];
+            }
+        }
+        size_t sent_datagrams = 0;
+        for (size_t i = 0; i < sent_messages; ++i) {
+            sent_datagrams += datagrams[i];
+        }
+        outgoing_.erase(outgoing_.begin(), outgoing_.begin() + sent_datagrams);
+    }
+}
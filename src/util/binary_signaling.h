@@ -0,0 +1,291 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "util/connection_trace.h"
+#include "util/webrtc_manager.h"
+
+// Compact binary framing for signaling messages, used between the C++ peers
+// instead of JSON once both sides have announced support for it. The browser
+// client keeps using JSON.
+//
+// Frame layout:
+//   [version: u8][type: u8][flags: u8][payload...]
+// Strings are length-prefixed with a LEB128 varint. Offer and answer carry
+// one SDP, ICE and trace messages carry a varint count followed by the
+// candidates or events.
+
+constexpr uint8_t kBinarySignalingVersion = 1;
+
+// The SDP is encoded line by line against this template. Every entry can be
+// referenced as an exact line or as a prefix followed by a literal suffix.
+// Both peers must use the same template for a given version.
+inline const std::vector<std::string> &SdpTemplate() {
+    static const std::vector<std::string> kTemplate = {
+            "v=0",
+            "o=- ",
+            "s=-",
+            "t=0 0",
+            "a=group:BUNDLE 0",
+            "a=extmap-allow-mixed",
+            "a=msid-semantic: WMS",
+            "m=application 9 UDP/DTLS/SCTP webrtc-datachannel",
+            "c=IN IP4 0.0.0.0",
+            "a=ice-ufrag:",
+            "a=ice-pwd:",
+            "a=ice-options:trickle",
+            "a=fingerprint:sha-256 ",
+            "a=setup:actpass",
+            "a=setup:active",
+            "a=setup:passive",
+            "a=mid:0",
+            "a=sctp-port:5000",
+            "a=max-message-size:262144",
+            "a=candidate:",
+            "",
+    };
+    return kTemplate;
+}
+
+struct SignalingMessage {
+    enum Type : uint8_t {
+        kOffer = 1,
+        kAnswer = 2,
+        kIce = 3,
+        kIceBatch = 4,
+        kTrace = 5,
+    };
+    enum Flags : uint8_t { kCompactSdp = 1 };
+
+    Type type;
+    std::string sdp;
+    std::vector<Ice> ices;
+    std::vector<TraceEvent> trace;
+
+    // Set on JSON offers from peers that can switch to binary signaling.
+    bool accepts_binary = false;
+    // Set on JSON offers from peers that handle the "trace" message.
+    bool accepts_trace = false;
+};
+
+class BinaryWriter {
+public:
+    void PutByte(uint8_t value) { buffer_.push_back(static_cast<char>(value)); }
+
+    void PutVarint(uint64_t value) {
+        while (value >= 0x80) {
+            PutByte(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        PutByte(static_cast<uint8_t>(value));
+    }
+
+    void PutString(const std::string &value) {
+        PutVarint(value.size());
+        buffer_.append(value);
+    }
+
+    std::string &buffer() { return buffer_; }
+
+private:
+    std::string buffer_;
+};
+
+class BinaryReader {
+public:
+    BinaryReader(const std::string &buffer) : buffer_(buffer), pos_(0) {}
+
+    uint8_t GetByte() {
+        if (pos_ >= buffer_.size()) {
+            throw std::runtime_error("Truncated binary signaling message.");
+        }
+        return static_cast<uint8_t>(buffer_[pos_++]);
+    }
+
+    uint64_t GetVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            const uint8_t byte = GetByte();
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Invalid varint in binary signaling message.");
+    }
+
+    std::string GetString() {
+        const uint64_t size = GetVarint();
+        if (size > buffer_.size() - pos_) {
+            throw std::runtime_error("Truncated binary signaling message.");
+        }
+        std::string value = buffer_.substr(pos_, size);
+        pos_ += size;
+        return value;
+    }
+
+private:
+    const std::string &buffer_;
+    size_t pos_;
+};
+
+// Each SDP line is written as one tag:
+//   0         literal line follows,
+//   2 * i + 1 line equals template entry i,
+//   2 * i + 2 line starts with template entry i, the suffix follows.
+inline void EncodeCompactSdp(const std::string &sdp, BinaryWriter &writer) {
+    const std::vector<std::string> &entries = SdpTemplate();
+    static const std::unordered_map<std::string, size_t> kExact = [&]() {
+        std::unordered_map<std::string, size_t> exact;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            exact.emplace(entries[i], i);
+        }
+        return exact;
+    }();
+
+    std::vector<std::string> lines;
+    size_t begin = 0;
+    for (size_t end; (end = sdp.find("\r\n", begin)) != std::string::npos;
+         begin = end + 2) {
+        lines.push_back(sdp.substr(begin, end - begin));
+    }
+    lines.push_back(sdp.substr(begin));
+
+    writer.PutVarint(lines.size());
+    for (const std::string &line : lines) {
+        const auto exact = kExact.find(line);
+        if (exact != kExact.end()) {
+            writer.PutVarint(2 * exact->second + 1);
+            continue;
+        }
+        size_t prefix = entries.size();
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (!entries[i].empty() &&
+                line.compare(0, entries[i].size(), entries[i]) == 0) {
+                prefix = i;
+                break;
+            }
+        }
+        if (prefix < entries.size()) {
+            writer.PutVarint(2 * prefix + 2);
+            writer.PutString(line.substr(entries[prefix].size()));
+        } else {
+            writer.PutVarint(0);
+            writer.PutString(line);
+        }
+    }
+}
+
+inline std::string DecodeCompactSdp(BinaryReader &reader) {
+    const std::vector<std::string> &entries = SdpTemplate();
+    const uint64_t num_lines = reader.GetVarint();
+    std::string sdp;
+    for (uint64_t i = 0; i < num_lines; ++i) {
+        if (i > 0) {
+            sdp += "\r\n";
+        }
+        const uint64_t tag = reader.GetVarint();
+        if (tag == 0) {
+            sdp += reader.GetString();
+            continue;
+        }
+        const uint64_t index = (tag - 1) / 2;
+        if (index >= entries.size()) {
+            throw std::runtime_error("Unknown SDP template entry: " +
+                                     std::to_string(index));
+        }
+        sdp += entries[index];
+        if (tag % 2 == 0) {
+            sdp += reader.GetString();
+        }
+    }
+    return sdp;
+}
+
+inline std::string EncodeSignalingMessage(const SignalingMessage &message,
+                                          bool compact_sdp = true) {
+    BinaryWriter writer;
+    writer.PutByte(kBinarySignalingVersion);
+    writer.PutByte(message.type);
+    switch (message.type) {
+        case SignalingMessage::kOffer:
+        case SignalingMessage::kAnswer:
+            if (compact_sdp) {
+                writer.PutByte(SignalingMessage::kCompactSdp);
+                EncodeCompactSdp(message.sdp, writer);
+            } else {
+                writer.PutByte(0);
+                writer.PutString(message.sdp);
+            }
+            break;
+        case SignalingMessage::kIce:
+        case SignalingMessage::kIceBatch:
+            writer.PutByte(0);
+            writer.PutVarint(message.ices.size());
+            for (const Ice &ice : message.ices) {
+                writer.PutString(ice.candidate);
+                writer.PutString(ice.sdp_mid);
+                writer.PutVarint(ice.sdp_mline_index);
+            }
+            break;
+        case SignalingMessage::kTrace:
+            writer.PutByte(0);
+            writer.PutVarint(message.trace.size());
+            for (const TraceEvent &event : message.trace) {
+                writer.PutString(event.name);
+                writer.PutVarint(event.time_us);
+            }
+            break;
+    }
+    return std::move(writer.buffer());
+}
+
+inline SignalingMessage DecodeSignalingMessage(const std::string &buffer) {
+    BinaryReader reader(buffer);
+    const uint8_t version = reader.GetByte();
+    if (version != kBinarySignalingVersion) {
+        throw std::runtime_error("Unsupported binary signaling version: " +
+                                 std::to_string(version));
+    }
+    SignalingMessage message;
+    message.type = static_cast<SignalingMessage::Type>(reader.GetByte());
+    const uint8_t flags = reader.GetByte();
+    switch (message.type) {
+        case SignalingMessage::kOffer:
+        case SignalingMessage::kAnswer:
+            message.sdp = (flags & SignalingMessage::kCompactSdp)
+                                  ? DecodeCompactSdp(reader)
+                                  : reader.GetString();
+            break;
+        case SignalingMessage::kIce:
+        case SignalingMessage::kIceBatch: {
+            const uint64_t num_ices = reader.GetVarint();
+            for (uint64_t i = 0; i < num_ices; ++i) {
+                Ice ice;
+                ice.candidate = reader.GetString();
+                ice.sdp_mid = reader.GetString();
+                ice.sdp_mline_index = static_cast<int>(reader.GetVarint());
+                message.ices.push_back(ice);
+            }
+            break;
+        }
+        case SignalingMessage::kTrace: {
+            const uint64_t num_events = reader.GetVarint();
+            for (uint64_t i = 0; i < num_events; ++i) {
+                TraceEvent event;
+                event.name = reader.GetString();
+                event.time_us = static_cast<int64_t>(reader.GetVarint());
+                message.trace.push_back(event);
+            }
+            break;
+        }
+        default:
+            throw std::runtime_error("Unkown binary message type: " +
+                                     std::to_string(message.type));
+    }
+    return message;
+}
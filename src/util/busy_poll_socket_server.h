@@ -0,0 +1,100 @@
+#pragma once
+
+#include <rtc_base/physical_socket_server.h>
+#include <rtc_base/socket_server.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+struct BusyPollConfig {
+    // Time each wait spins before blocking, in microseconds.
+    int spin_us = 200;
+};
+
+// Counters of one BusyPollSocketServer, only touched on its thread.
+struct BusyPollStats {
+    // Non-blocking polls of the sockets while spinning.
+    uint64_t polls = 0;
+    // Waits ended by a posted task or a wake-up while spinning.
+    uint64_t spin_wakeups = 0;
+    // Waits that ran out of spin budget and blocked.
+    uint64_t blocking_waits = 0;
+};
+
+// PhysicalSocketServer that trades a core for latency: a wait first polls
+// its sockets without blocking, handling whatever became readable, until a
+// task is posted to the thread or |spin_us| elapse, and only then blocks in
+// epoll_wait(). Posting to a spinning thread skips the wake-up system call.
+// Pin the thread to a core of its own (ThreadConfig::cpus), or the spinning
+// competes with the threads it waits for. Plug it into
+// WebRTCManager::create_socket_server to use it for the network thread.
+class BusyPollSocketServer : public rtc::PhysicalSocketServer {
+public:
+    BusyPollSocketServer(const BusyPollConfig &config = BusyPollConfig())
+        : config_(config) {}
+
+    bool Wait(int cms, bool process_io) override {
+        // Waits without I/O are the thread's own Invoke()s and Quit()s.
+        if (cms == 0 || !process_io || config_.spin_us <= 0) {
+            return rtc::PhysicalSocketServer::Wait(cms, process_io);
+        }
+        int64_t spin_us = config_.spin_us;
+        if (cms != kForever) {
+            spin_us = std::min<int64_t>(spin_us, int64_t(cms) * 1000);
+        }
+        const int64_t start_us = NowUs();
+        spinning_.store(true);
+        do {
+            // Dispatches the readable sockets, whose handlers read inline.
+            rtc::PhysicalSocketServer::Wait(0, true);
+            ++stats_.polls;
+            if (woken_.exchange(false)) {
+                spinning_.store(false);
+                ++stats_.spin_wakeups;
+                return true;
+            }
+        } while (NowUs() - start_us < spin_us);
+        // A WakeUp() that still saw the flag only set |woken_|.
+        spinning_.store(false);
+        if (woken_.exchange(false)) {
+            ++stats_.spin_wakeups;
+            return true;
+        }
+        ++stats_.blocking_waits;
+        int remaining_ms = cms;
+        if (cms != kForever) {
+            remaining_ms = std::max(
+                    cms - static_cast<int>((NowUs() - start_us) / 1000), 0);
+        }
+        const bool result =
+                rtc::PhysicalSocketServer::Wait(remaining_ms, process_io);
+        // The wake-up is consumed; the thread checks its queue next.
+        woken_.store(false);
+        return result;
+    }
+
+    void WakeUp() override {
+        woken_.store(true);
+        if (!spinning_.load()) {
+            rtc::PhysicalSocketServer::WakeUp();
+        }
+    }
+
+    // Read on the thread of the socket server.
+    const BusyPollStats &stats() const { return stats_; }
+
+private:
+    static int64_t NowUs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    const BusyPollConfig config_;
+    BusyPollStats stats_;
+    // Set while Wait() spins; WakeUp() from other threads reads it.
+    std::atomic<bool> spinning_{false};
+    std::atomic<bool> woken_{false};
+};
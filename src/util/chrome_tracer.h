@@ -0,0 +1,219 @@
+#pragma once
+
+#include <json/json.h>
+#include <rtc_base/event_tracer.h>
+#include <rtc_base/platform_thread_types.h>
+#include <rtc_base/thread.h>
+#include <rtc_base/time_utils.h>
+#include <rtc_base/trace_event.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "util/json_utils.h"
+
+// Collects the TRACE_EVENT* events of WebRTC and of this code base and writes
+// them in the Chrome trace-event JSON format, which chrome://tracing and
+// Perfetto load. Threads show up with the names given to name_thread().
+//
+// WebRTC accepts one tracer per process, so this is a singleton, installed by
+// the first call to Instance(). Call sites that ran before are never traced,
+// so call it before creating any WebRTC object. Events are only recorded
+// between start() and stop(); outside of that every TRACE_EVENT* costs one
+// load of the enabled flag.
+class ChromeTracer {
+public:
+    static ChromeTracer &Instance() {
+        static ChromeTracer *tracer = new ChromeTracer();
+        return *tracer;
+    }
+
+    // Runtime switch for the client and server: trace the whole process into
+    // the file named by WEBRTC_TRACE_FILE. Returns the file name, or an empty
+    // string when it is unset.
+    static std::string StartFromEnv() {
+        const char *path = std::getenv("WEBRTC_TRACE_FILE");
+        if (path == nullptr || *path == '\0') {
+            return "";
+        }
+        Instance().start();
+        return path;
+    }
+
+    // Label the thread |thread| runs on. Threads without a name appear with
+    // their id.
+    static void name_thread(rtc::Thread *thread, const std::string &name) {
+        thread->Invoke<void>(RTC_FROM_HERE,
+                             [&]() { Instance().name_current_thread(name); });
+    }
+
+    void name_current_thread(const std::string &name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        thread_names_[rtc::CurrentThreadId()] = name;
+    }
+
+    // Start recording. At most |max_events| are kept, later ones are
+    // dropped.
+    void start(size_t max_events = 1 << 20) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        events_.clear();
+        max_events_ = max_events;
+        enabled_ = true;
+        for (auto &category : categories_) {
+            category.second.enabled = 1;
+        }
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        enabled_ = false;
+        for (auto &category : categories_) {
+            category.second.enabled = 0;
+        }
+    }
+
+    Json::Value to_json() const {
+        const int pid = getpid();
+        Json::Value json;
+        json["displayTimeUnit"] = "ms";
+        Json::Value &events = json["traceEvents"];
+        events = Json::Value(Json::arrayValue);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto &thread_name : thread_names_) {
+            Json::Value event;
+            event["name"] = "thread_name";
+            event["ph"] = "M";
+            event["pid"] = pid;
+            event["tid"] = Json::Int64(thread_name.first);
+            event["args"]["name"] = thread_name.second;
+            events.append(event);
+        }
+        for (const Event &recorded : events_) {
+            Json::Value event;
+            event["name"] = recorded.name;
+            event["cat"] = *recorded.category;
+            event["ph"] = std::string(1, recorded.phase);
+            event["ts"] = Json::Int64(recorded.time_us);
+            event["pid"] = pid;
+            event["tid"] = Json::Int64(recorded.thread_id);
+            if (recorded.id != 0) {
+                event["id"] = Json::UInt64(recorded.id);
+            }
+            if (!recorded.args.isNull()) {
+                event["args"] = recorded.args;
+            }
+            events.append(event);
+        }
+        return json;
+    }
+
+    // Stop recording and write the trace to |path|.
+    void stop_and_write(const std::string &path) {
+        stop();
+        std::ofstream(path) << JsonToString(to_json()) << std::endl;
+    }
+
+private:
+    struct Event {
+        char phase;
+        const std::string *category;
+        std::string name;
+        int64_t time_us;
+        rtc::PlatformThreadId thread_id;
+        unsigned long long id;
+        Json::Value args;
+    };
+
+    ChromeTracer() {
+        webrtc::SetupEventTracer(&ChromeTracer::GetCategoryEnabled,
+                                 &ChromeTracer::AddTraceEvent);
+    }
+
+    // Each TRACE_EVENT* call site caches the address of the enabled flag of
+    // its category, and AddTraceEvent() gets it back to find the category
+    // name. Map nodes keep both addresses stable.
+    static const unsigned char *GetCategoryEnabled(const char *name) {
+        ChromeTracer &tracer = Instance();
+        std::lock_guard<std::mutex> lock(tracer.mutex_);
+        auto it = tracer.categories_.find(name);
+        if (it == tracer.categories_.end()) {
+            it = tracer.categories_.emplace(name, Category()).first;
+            it->second.enabled = tracer.enabled_ ? 1 : 0;
+            it->second.name = &it->first;
+        }
+        return &it->second.enabled;
+    }
+
+    static void AddTraceEvent(char phase,
+                              const unsigned char *category_enabled,
+                              const char *name,
+                              unsigned long long id,
+                              int num_args,
+                              const char **arg_names,
+                              const unsigned char *arg_types,
+                              const unsigned long long *arg_values,
+                              unsigned char flags) {
+        ChromeTracer &tracer = Instance();
+        if (!tracer.enabled_) {
+            return;
+        }
+        Event event;
+        event.phase = phase;
+        // |enabled| is the first member of Category.
+        event.category =
+                reinterpret_cast<const Category *>(category_enabled)->name;
+        event.name = name;
+        event.time_us = rtc::TimeMicros();
+        event.thread_id = rtc::CurrentThreadId();
+        event.id = id;
+        for (int i = 0; i < num_args; ++i) {
+            event.args[arg_names[i]] = ArgToJson(arg_types[i], arg_values[i]);
+        }
+
+        std::lock_guard<std::mutex> lock(tracer.mutex_);
+        if (tracer.events_.size() < tracer.max_events_) {
+            tracer.events_.push_back(std::move(event));
+        }
+    }
+
+    static Json::Value ArgToJson(unsigned char type, unsigned long long value) {
+        webrtc::trace_event_internal::TraceValueUnion arg;
+        arg.as_uint = value;
+        switch (type) {
+            case TRACE_VALUE_TYPE_BOOL:
+                return arg.as_bool;
+            case TRACE_VALUE_TYPE_UINT:
+                return Json::UInt64(arg.as_uint);
+            case TRACE_VALUE_TYPE_INT:
+                return Json::Int64(arg.as_int);
+            case TRACE_VALUE_TYPE_DOUBLE:
+                return arg.as_double;
+            case TRACE_VALUE_TYPE_STRING:
+            case TRACE_VALUE_TYPE_COPY_STRING:
+                return arg.as_string;
+            default:
+                return Json::UInt64(value);
+        }
+    }
+
+    struct Category {
+        // Must stay the first member, see AddTraceEvent().
+        unsigned char enabled = 0;
+        const std::string *name = nullptr;
+    };
+
+    mutable std::mutex mutex_;
+    std::atomic<bool> enabled_{false};
+    size_t max_events_ = 0;
+    std::map<std::string, Category> categories_;
+    std::map<rtc::PlatformThreadId, std::string> thread_names_;
+    std::vector<Event> events_;
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <json/json.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct TraceEvent {
+    std::string name;
+    // Monotonic time of the peer that recorded the event.
+    int64_t time_us;
+};
+
+// Time of the first event called |name|, or -1 if it was not recorded.
+inline int64_t FindTraceEvent(const std::vector<TraceEvent> &events,
+                              const std::string &name) {
+    for (const TraceEvent &event : events) {
+        if (event.name == name) {
+            return event.time_us;
+        }
+    }
+    return -1;
+}
+
+// Timestamps of the signaling and state transitions of one Connection. Events
+// are recorded from the main thread and the WebRTC signaling thread.
+class ConnectionTrace {
+public:
+    static int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+    }
+
+    void record(const std::string &name) {
+        const int64_t now = Now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        events_.push_back(TraceEvent{name, now});
+    }
+
+    std::vector<TraceEvent> events() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return events_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<TraceEvent> events_;
+};
+
+inline Json::Value TraceEventsToJson(const std::vector<TraceEvent> &events) {
+    Json::Value json(Json::arrayValue);
+    for (const TraceEvent &event : events) {
+        Json::Value event_json;
+        event_json["name"] = event.name;
+        event_json["time_us"] = Json::Int64(event.time_us);
+        json.append(event_json);
+    }
+    return json;
+}
+
+inline std::vector<TraceEvent> TraceEventsFromJson(const Json::Value &json) {
+    std::vector<TraceEvent> events;
+    for (const Json::Value &event_json : json) {
+        events.push_back(TraceEvent{event_json.get("name", "").asString(),
+                                    event_json.get("time_us", 0).asInt64()});
+    }
+    return events;
+}
+
+// Estimate the offset of the remote clock against the local one from one
+// request/response exchange, NTP style: the local peer sent at |local_send|
+// and received the reply at |local_receive|, the remote peer received at
+// |remote_receive| and replied at |remote_send|. A remote timestamp maps to
+// the local clock as remote_time - offset. Returns 0 if any of the
+// timestamps is missing.
+inline int64_t EstimateClockOffset(int64_t local_send,
+                                   int64_t remote_receive,
+                                   int64_t remote_send,
+                                   int64_t local_receive) {
+    if (local_send < 0 || remote_receive < 0 || remote_send < 0 ||
+        local_receive < 0) {
+        return 0;
+    }
+    return ((remote_receive - local_send) + (remote_send - local_receive)) / 2;
+}
+
+// Merge the traces of both peers into one timeline on the local clock.
+// Times are relative to the earliest event.
+inline Json::Value CombineTraces(const std::string &local_name,
+                                 const std::vector<TraceEvent> &local_events,
+                                 const std::string &remote_name,
+                                 const std::vector<TraceEvent> &remote_events,
+                                 int64_t clock_offset_us) {
+    struct Entry {
+        int64_t time_us;
+        const std::string *peer;
+        const std::string *name;
+    };
+    std::vector<Entry> entries;
+    for (const TraceEvent &event : local_events) {
+        entries.push_back(Entry{event.time_us, &local_name, &event.name});
+    }
+    for (const TraceEvent &event : remote_events) {
+        entries.push_back(Entry{event.time_us - clock_offset_us, &remote_name,
+                                &event.name});
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry &a, const Entry &b) {
+                         return a.time_us < b.time_us;
+                     });
+
+    Json::Value json;
+    json["clock_offset_us"] = Json::Int64(clock_offset_us);
+    json["events"] = Json::Value(Json::arrayValue);
+    for (const Entry &entry : entries) {
+        Json::Value event_json;
+        event_json["peer"] = *entry.peer;
+        event_json["name"] = *entry.name;
+        event_json["time_us"] =
+                Json::Int64(entry.time_us - entries.front().time_us);
+        json["events"].append(event_json);
+    }
+    return json;
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Multishot recvmsg, the newest interface used here, came with the uapi
+// headers of Linux 6.0. Older headers leave IoUring out.
+#ifdef IORING_RECV_MULTISHOT
+
+// Minimal io_uring: the submission and completion queues mapped from the
+// kernel, driven by the raw system calls so no liburing is needed. Not
+// thread-safe; one thread submits and reaps.
+class IoUring {
+public:
+    IoUring() = default;
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    ~IoUring() {
+        if (sqes_ != MAP_FAILED) {
+            ::munmap(sqes_, sqes_size_);
+        }
+        if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+            ::munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_ != MAP_FAILED) {
+            ::munmap(sq_ring_, sq_ring_size_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    // Returns false with errno set, e.g. to ENOSYS or EPERM where io_uring
+    // is not available.
+    bool init(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd_ = static_cast<int>(
+                ::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) {
+            return false;
+        }
+        sq_ring_size_ =
+                params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ =
+                params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_size_ = cq_ring_size_ =
+                    std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) {
+            return false;
+        }
+        cq_ring_ = single_mmap ? sq_ring_
+                               : ::mmap(nullptr, cq_ring_size_,
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, fd_,
+                                        IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            return false;
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes_ == MAP_FAILED) {
+            return false;
+        }
+
+        char *sq = static_cast<char *>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        // Submission entries are used in ring order, so the indirection
+        // array is the identity.
+        unsigned *array =
+                reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        for (unsigned i = 0; i < params.sq_entries; ++i) {
+            array[i] = i;
+        }
+        sqe_tail_ = *sq_tail_;
+
+        char *cq = static_cast<char *>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    int fd() const { return fd_; }
+
+    // A cleared submission entry, or null when the queue is full until the
+    // next submit().
+    io_uring_sqe *get_sqe() {
+        const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head > sq_mask_) {
+            return nullptr;
+        }
+        io_uring_sqe *sqe = &static_cast<io_uring_sqe *>(sqes_)[sqe_tail_ &
+                                                                sq_mask_];
+        ++sqe_tail_;
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Entries taken by get_sqe() the kernel has not consumed yet.
+    unsigned pending() const {
+        return sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    }
+
+    // Hand the pending entries to the kernel and wait for |wait| completions.
+    // Returns the number of entries consumed, or -1 with errno set.
+    int submit(unsigned wait = 0) {
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+        const unsigned to_submit = pending();
+        if (to_submit == 0 && wait == 0) {
+            return 0;
+        }
+        return static_cast<int>(::syscall(
+                __NR_io_uring_enter, fd_, to_submit, wait,
+                wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+    }
+
+    // Call |f| with each available completion. Returns how many there were.
+    template <typename F>
+    unsigned reap(F f) {
+        unsigned head = *cq_head_;
+        unsigned count = 0;
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            const io_uring_cqe cqe = cqes_[head & cq_mask_];
+            // Release the slot before |f| may submit more work.
+            __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+            f(cqe);
+            ++count;
+        }
+        return count;
+    }
+
+    // Receive datagrams on |fd| until cancelled, each into a buffer of
+    // |group|. Every datagram completes with IORING_CQE_F_MORE while the
+    // request stays armed. |header| describes the layout of the buffers and
+    // must outlive the request.
+    static void prepare_recvmsg_multishot(io_uring_sqe *sqe,
+                                          int fd,
+                                          msghdr *header,
+                                          uint16_t group,
+                                          uint64_t user_data) {
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uintptr_t>(header);
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = group;
+        sqe->user_data = user_data;
+    }
+
+private:
+    int fd_ = -1;
+    void *sq_ring_ = MAP_FAILED;
+    void *cq_ring_ = MAP_FAILED;
+    void *sqes_ = MAP_FAILED;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    size_t sqes_size_ = 0;
+
+    unsigned *sq_head_ = nullptr;
+    unsigned *sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sqe_tail_ = 0;
+
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe *cqes_ = nullptr;
+};
+
+// Receive buffers provided to a ring as one buffer group
+// (IORING_OP_PROVIDE_BUFFERS). The kernel picks a free buffer for each
+// received datagram, and the reader hands it back with recycle() once
+// consumed. Destroy after the IoUring, whose requests may still write to
+// the buffers.
+class IoUringBufferGroup {
+public:
+    // Provide |count| buffers of |size| bytes as |group|. Returns false when
+    // the kernel refuses them.
+    bool init(IoUring &uring, uint16_t group, unsigned count, size_t size) {
+        group_ = group;
+        size_ = size;
+        buffers_.resize(count * size);
+        io_uring_sqe *sqe = uring.get_sqe();
+        if (sqe == nullptr) {
+            return false;
+        }
+        prepare_provide(sqe, 0, count);
+        sqe->flags = 0;
+        sqe->user_data = 0;
+        if (uring.submit(1) < 0) {
+            return false;
+        }
+        int result = -1;
+        uring.reap([&](const io_uring_cqe &cqe) {
+            if (cqe.user_data == 0) {
+                result = cqe.res;
+            }
+        });
+        return result >= 0;
+    }
+
+    char *buffer(uint16_t id) { return &buffers_[id * size_]; }
+    size_t size() const { return size_; }
+
+    // Queue buffer |id| for reuse; publish() hands it to the kernel.
+    void recycle(uint16_t id) { recycled_.push_back(id); }
+
+    // Provide the recycled buffers again, one submission entry per run of
+    // consecutive ids. Successful entries complete silently; failures
+    // complete with user_data 0.
+    void publish(IoUring &uring) {
+        if (recycled_.empty()) {
+            return;
+        }
+        std::sort(recycled_.begin(), recycled_.end());
+        size_t begin = 0;
+        while (begin < recycled_.size()) {
+            size_t end = begin + 1;
+            while (end < recycled_.size() &&
+                   recycled_[end] == recycled_[end - 1] + 1) {
+                ++end;
+            }
+            io_uring_sqe *sqe = uring.get_sqe();
+            if (sqe == nullptr) {
+                uring.submit();
+                continue;
+            }
+            prepare_provide(sqe, recycled_[begin],
+                            static_cast<unsigned>(end - begin));
+            begin = end;
+        }
+        recycled_.clear();
+    }
+
+private:
+    void prepare_provide(io_uring_sqe *sqe, uint16_t first, unsigned count) {
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = static_cast<int>(count);
+        sqe->addr = reinterpret_cast<uintptr_t>(buffer(first));
+        sqe->len = static_cast<uint32_t>(size_);
+        sqe->off = first;
+        sqe->buf_group = group_;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        sqe->user_data = 0;
+    }
+
+    uint16_t group_ = 0;
+    size_t size_ = 0;
+    std::vector<char> buffers_;
+    std::vector<uint16_t> recycled_;
+};
+
+#endif
@@ -0,0 +1,571 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <rtc_base/physical_socket_server.h>
+#include <rtc_base/socket_address.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "util/batching_socket_server.h"
+#include "util/io_uring.h"
+#include "util/native_udp_socket.h"
+
+struct IoUringConfig {
+    // Submission queue entries; the completion queue gets twice as many.
+    unsigned ring_entries = 1024;
+
+    // Receive buffers shared by all UDP sockets of the server. A buffer
+    // holds the io_uring_recvmsg_out header, the source address and the
+    // datagram, so 2048 bytes leave room for any WebRTC packet.
+    unsigned buffer_count = 1024;
+    size_t buffer_size = 2048;
+
+    // Sends in flight per socket before SendTo() returns EWOULDBLOCK.
+    size_t max_pending_sends = 256;
+};
+
+// Counters of one IoUringSocketServer, only touched on its thread.
+struct IoUringStats {
+    // Batches of completions reaped, one per wake-up of the thread by the
+    // ring.
+    uint64_t completion_batches = 0;
+    uint64_t datagrams_received = 0;
+    // io_uring_enter() calls, each submitting every queued request.
+    uint64_t submit_calls = 0;
+    uint64_t datagrams_sent = 0;
+    uint64_t send_drops = 0;
+    // Datagrams a socket did not read while it was signaled, or truncated
+    // to the buffer size.
+    uint64_t receive_drops = 0;
+};
+
+#ifdef IORING_RECV_MULTISHOT
+
+class IoUringSocketServer;
+
+// UDP socket served by the io_uring of its IoUringSocketServer: one
+// multishot recvmsg request receives all its datagrams into the server's
+// provided buffers, and SendTo() queues a sendmsg request the server
+// submits with the others of the loop iteration. Neither costs a system
+// call of its own.
+class IoUringUdpSocket : public NativeUdpSocket {
+public:
+    IoUringUdpSocket(IoUringSocketServer *server, uint64_t id)
+        : server_(server), id_(id) {}
+
+    ~IoUringUdpSocket() override { Close(); }
+
+    bool Create(int family);
+
+    int SendTo(const void *data,
+               size_t size,
+               const rtc::SocketAddress &address) override;
+
+    int RecvFrom(void *data,
+                 size_t size,
+                 rtc::SocketAddress *address,
+                 int64_t *timestamp) override;
+
+    int Close() override;
+
+private:
+    friend class IoUringSocketServer;
+
+    // A datagram in a provided buffer.
+    struct Received {
+        uint16_t buffer;
+        const char *payload;
+        size_t size;
+        sockaddr_storage address;
+    };
+
+    IoUringSocketServer *const server_;
+    const uint64_t id_;
+    std::deque<Received> received_;
+    size_t pending_sends_ = 0;
+    bool write_blocked_ = false;
+};
+
+// PhysicalSocketServer whose UDP sockets run on io_uring, see
+// IoUringUdpSocket. TCP sockets are PhysicalSocketServer's own. The ring's
+// file descriptor is one more dispatcher of the epoll loop, readable while
+// completions are queued, so the thread still sleeps in the base Wait() and
+// wakes up for tasks as before.
+//
+// Needs Linux 6.0 for multishot recvmsg, and its headers to be built; use
+// CreateIoUringSocketServer() to fall back to epoll otherwise.
+class IoUringSocketServer : public rtc::PhysicalSocketServer {
+public:
+    explicit IoUringSocketServer(const IoUringConfig &config = IoUringConfig())
+        : config_(config), completions_(this) {
+        if (!ring_.init(config.ring_entries) ||
+            !buffers_.init(ring_, kBufferGroup, config.buffer_count,
+                           config.buffer_size)) {
+            throw std::runtime_error("Failed to set up io_uring: " +
+                                     std::string(std::strerror(errno)));
+        }
+        receive_header_.msg_namelen = sizeof(sockaddr_storage);
+        Add(&completions_);
+    }
+
+    ~IoUringSocketServer() override { Remove(&completions_); }
+
+    // Whether the kernel runs multishot recvmsg with provided buffers.
+    // Probed once by receiving a datagram over loopback.
+    static bool Supported() {
+        static const bool supported = Probe();
+        return supported;
+    }
+
+    rtc::AsyncSocket *CreateAsyncSocket(int family, int type) override {
+        if (type != SOCK_DGRAM) {
+            return rtc::PhysicalSocketServer::CreateAsyncSocket(family, type);
+        }
+        IoUringUdpSocket *socket = new IoUringUdpSocket(this, next_id_++);
+        if (!socket->Create(family)) {
+            delete socket;
+            return nullptr;
+        }
+        return socket;
+    }
+
+    bool Wait(int cms, bool process_io) override {
+        if (process_io) {
+            submit();
+        }
+        return rtc::PhysicalSocketServer::Wait(cms, process_io);
+    }
+
+    // Read on the thread of the socket server.
+    const IoUringStats &stats() const { return stats_; }
+
+private:
+    friend class IoUringUdpSocket;
+
+    // Makes the ring one more descriptor of the epoll loop.
+    class CompletionDispatcher : public rtc::Dispatcher {
+    public:
+        explicit CompletionDispatcher(IoUringSocketServer *server)
+            : server_(server) {}
+
+        uint32_t GetRequestedEvents() override { return rtc::DE_READ; }
+        void OnPreEvent(uint32_t events) override {}
+        void OnEvent(uint32_t events, int error) override {
+            server_->process_completions();
+        }
+        int GetDescriptor() override { return server_->ring_.fd(); }
+        bool IsDescriptorClosed() override { return false; }
+
+    private:
+        IoUringSocketServer *const server_;
+    };
+
+    // A sendmsg request in flight, which owns what the kernel reads.
+    struct Send {
+        uint64_t socket_id = 0;
+        std::vector<char> data;
+        sockaddr_storage address;
+        iovec iov;
+        msghdr header;
+    };
+
+    // user_data of a request: the socket id or send slot, and its kind.
+    // user_data 0 is left to IoUringBufferGroup.
+    enum Kind : uint64_t { kReceive = 1, kSend = 2, kCancel = 3 };
+    static uint64_t UserData(uint64_t index, Kind kind) {
+        return index << 2 | kind;
+    }
+
+    static constexpr uint16_t kBufferGroup = 1;
+
+    static bool Probe() {
+        msghdr header = {};
+        header.msg_namelen = sizeof(sockaddr_storage);
+        IoUringBufferGroup buffers;
+        IoUring ring;
+        if (!ring.init(4) || !buffers.init(ring, kBufferGroup, 2, 256)) {
+            return false;
+        }
+        const int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return false;
+        }
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        bool supported = false;
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&address), length) ==
+                    0 &&
+            ::getsockname(fd, reinterpret_cast<sockaddr *>(&address),
+                          &length) == 0 &&
+            // Not empty: an empty datagram ends a multishot request.
+            ::sendto(fd, "x", 1, 0, reinterpret_cast<sockaddr *>(&address),
+                     length) == 1) {
+            // The datagram is already queued, so the request completes
+            // when submitted: with IORING_CQE_F_MORE if multishot works,
+            // with -EINVAL otherwise.
+            IoUring::prepare_recvmsg_multishot(ring.get_sqe(), fd, &header,
+                                               kBufferGroup, 1);
+            if (ring.submit(1) >= 0) {
+                ring.reap([&](const io_uring_cqe &cqe) {
+                    if (cqe.user_data == 1 && cqe.res >= 0 &&
+                        (cqe.flags & IORING_CQE_F_MORE)) {
+                        supported = true;
+                    }
+                });
+            }
+        }
+        // Closing the ring cancels the request.
+        ::close(fd);
+        return supported;
+    }
+
+    // A free submission entry, submitting the queued ones if needed.
+    io_uring_sqe *get_sqe() {
+        io_uring_sqe *sqe = ring_.get_sqe();
+        if (sqe == nullptr) {
+            submit();
+            sqe = ring_.get_sqe();
+        }
+        return sqe;
+    }
+
+    void submit() {
+        queue_cancels();
+        if (ring_.pending() == 0) {
+            return;
+        }
+        ++stats_.submit_calls;
+        ring_.submit();
+    }
+
+    bool arm_receive(IoUringUdpSocket *socket) {
+        io_uring_sqe *sqe = get_sqe();
+        if (sqe == nullptr) {
+            return false;
+        }
+        IoUring::prepare_recvmsg_multishot(sqe, socket->fd_, &receive_header_,
+                                           kBufferGroup,
+                                           UserData(socket->id_, kReceive));
+        return true;
+    }
+
+    bool add_socket(IoUringUdpSocket *socket) {
+        if (!arm_receive(socket)) {
+            return false;
+        }
+        sockets_[socket->id_] = socket;
+        return true;
+    }
+
+    // Queue the cancellation of the receive request of socket |id|.
+    bool cancel_receive(uint64_t id) {
+        io_uring_sqe *sqe = ring_.get_sqe();
+        if (sqe == nullptr) {
+            return false;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = UserData(id, kReceive);
+        sqe->user_data = UserData(id, kCancel);
+        return true;
+    }
+
+    // Cancellations the full submission queue did not take yet. Until then
+    // the receive request holds the closed socket's file and port.
+    void queue_cancels() {
+        while (!pending_cancels_.empty() &&
+               cancel_receive(pending_cancels_.back())) {
+            pending_cancels_.pop_back();
+        }
+    }
+
+    void remove_socket(IoUringUdpSocket *socket) {
+        if (!cancel_receive(socket->id_)) {
+            // Retried by each submit(), once the kernel consumed entries.
+            pending_cancels_.push_back(socket->id_);
+        }
+        // Requests hold the file once submitted, so the queued sends still
+        // leave after the descriptor is closed.
+        submit();
+        for (const IoUringUdpSocket::Received &received : socket->received_) {
+            buffers_.recycle(received.buffer);
+        }
+        socket->received_.clear();
+        sockets_.erase(socket->id_);
+    }
+
+    IoUringUdpSocket *find_socket(uint64_t id) {
+        auto it = sockets_.find(id);
+        return it == sockets_.end() ? nullptr : it->second;
+    }
+
+    bool send(IoUringUdpSocket *socket,
+              const void *data,
+              size_t size,
+              const rtc::SocketAddress &address) {
+        io_uring_sqe *sqe = get_sqe();
+        if (sqe == nullptr) {
+            return false;
+        }
+        size_t slot;
+        if (free_sends_.empty()) {
+            slot = sends_.size();
+            sends_.emplace_back(new Send());
+        } else {
+            slot = free_sends_.back();
+            free_sends_.pop_back();
+        }
+        Send &send = *sends_[slot];
+        send.socket_id = socket->id_;
+        const char *bytes = static_cast<const char *>(data);
+        send.data.assign(bytes, bytes + size);
+        std::memset(&send.header, 0, sizeof(send.header));
+        send.header.msg_namelen = static_cast<socklen_t>(
+                address.ToSockAddrStorage(&send.address));
+        send.header.msg_name = &send.address;
+        send.iov.iov_base = send.data.data();
+        send.iov.iov_len = send.data.size();
+        send.header.msg_iov = &send.iov;
+        send.header.msg_iovlen = 1;
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = socket->fd_;
+        sqe->addr = reinterpret_cast<uintptr_t>(&send.header);
+        sqe->len = 1;
+        sqe->user_data = UserData(slot, kSend);
+        ++socket->pending_sends_;
+        return true;
+    }
+
+    void process_completions() {
+        ++stats_.completion_batches;
+        std::vector<uint64_t> readable;
+        std::vector<uint64_t> writable;
+        std::vector<uint64_t> rearm;
+        ring_.reap([&](const io_uring_cqe &cqe) {
+            const uint64_t index = cqe.user_data >> 2;
+            switch (cqe.user_data & 3) {
+                case kReceive:
+                    on_receive(cqe, index, &readable, &rearm);
+                    break;
+                case kSend:
+                    on_send(cqe, index, &writable);
+                    break;
+                default:
+                    // Cancellations, failed buffer hand-backs.
+                    break;
+            }
+        });
+        // Buffers first, so the re-armed requests find them.
+        buffers_.publish(ring_);
+        for (uint64_t id : rearm) {
+            if (IoUringUdpSocket *socket = find_socket(id)) {
+                arm_receive(socket);
+            }
+        }
+
+        for (uint64_t id : readable) {
+            IoUringUdpSocket *socket = find_socket(id);
+            while (socket != nullptr && !socket->received_.empty()) {
+                const size_t before = socket->received_.size();
+                socket->SignalReadEvent(socket);
+                // The slot may have closed or deleted the socket.
+                socket = find_socket(id);
+                if (socket != nullptr && socket->received_.size() == before) {
+                    // Not read; UDP drops it rather than stall the loop.
+                    stats_.receive_drops += before;
+                    for (const IoUringUdpSocket::Received &received :
+                         socket->received_) {
+                        buffers_.recycle(received.buffer);
+                    }
+                    socket->received_.clear();
+                }
+            }
+        }
+        for (uint64_t id : writable) {
+            if (IoUringUdpSocket *socket = find_socket(id)) {
+                socket->SignalWriteEvent(socket);
+            }
+        }
+        // Answers to the batch leave together.
+        buffers_.publish(ring_);
+        submit();
+    }
+
+    void on_receive(const io_uring_cqe &cqe,
+                    uint64_t id,
+                    std::vector<uint64_t> *readable,
+                    std::vector<uint64_t> *rearm) {
+        IoUringUdpSocket *socket = find_socket(id);
+        if (socket != nullptr && !(cqe.flags & IORING_CQE_F_MORE) &&
+            cqe.res != -ECANCELED) {
+            // Out of buffers, an empty datagram or an error ended the
+            // request.
+            rearm->push_back(id);
+        }
+        if (!(cqe.flags & IORING_CQE_F_BUFFER)) {
+            return;
+        }
+        const uint16_t buffer =
+                static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        char *data = buffers_.buffer(buffer);
+        io_uring_recvmsg_out out;
+        std::memcpy(&out, data, sizeof(out));
+        if (socket == nullptr || cqe.res < 0 || (out.flags & MSG_TRUNC)) {
+            if (socket != nullptr && cqe.res >= 0) {
+                ++stats_.receive_drops;
+            }
+            buffers_.recycle(buffer);
+            return;
+        }
+        IoUringUdpSocket::Received received;
+        received.buffer = buffer;
+        std::memset(&received.address, 0, sizeof(received.address));
+        std::memcpy(&received.address, data + sizeof(out),
+                    std::min<size_t>(out.namelen, sizeof(received.address)));
+        received.payload =
+                data + sizeof(out) + receive_header_.msg_namelen +
+                receive_header_.msg_controllen;
+        received.size = out.payloadlen;
+        if (socket->received_.empty()) {
+            readable->push_back(id);
+        }
+        socket->received_.push_back(received);
+        ++stats_.datagrams_received;
+    }
+
+    void on_send(const io_uring_cqe &cqe,
+                 uint64_t slot,
+                 std::vector<uint64_t> *writable) {
+        Send &send = *sends_[slot];
+        if (cqe.res < 0) {
+            ++stats_.send_drops;
+        } else {
+            ++stats_.datagrams_sent;
+        }
+        IoUringUdpSocket *socket = find_socket(send.socket_id);
+        if (socket != nullptr) {
+            --socket->pending_sends_;
+            if (socket->write_blocked_ &&
+                socket->pending_sends_ <= config_.max_pending_sends / 2) {
+                socket->write_blocked_ = false;
+                writable->push_back(send.socket_id);
+            }
+        }
+        free_sends_.push_back(slot);
+    }
+
+    const IoUringConfig config_;
+    IoUringStats stats_;
+    // What the kernel reads and writes for requests in flight is declared
+    // before the ring, which must be closed first.
+    // Layout of the receive buffers: the source address, no control data.
+    msghdr receive_header_ = {};
+    IoUringBufferGroup buffers_;
+    std::vector<std::unique_ptr<Send>> sends_;
+    std::vector<size_t> free_sends_;
+    IoUring ring_;
+    CompletionDispatcher completions_;
+    std::unordered_map<uint64_t, IoUringUdpSocket *> sockets_;
+    std::vector<uint64_t> pending_cancels_;
+    uint64_t next_id_ = 1;
+};
+
+inline bool IoUringUdpSocket::Create(int family) {
+    if (!open(family)) {
+        return false;
+    }
+    // io_uring waits for readiness itself; on a nonblocking socket a full
+    // send buffer would fail the send instead.
+    ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) & ~O_NONBLOCK);
+    if (!server_->add_socket(this)) {
+        error_ = EBUSY;
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    return true;
+}
+
+inline int IoUringUdpSocket::SendTo(const void *data,
+                                    size_t size,
+                                    const rtc::SocketAddress &address) {
+    if (pending_sends_ >= server_->config_.max_pending_sends ||
+        !server_->send(this, data, size, address)) {
+        write_blocked_ = true;
+        error_ = EWOULDBLOCK;
+        return -1;
+    }
+    return static_cast<int>(size);
+}
+
+inline int IoUringUdpSocket::RecvFrom(void *data,
+                                      size_t size,
+                                      rtc::SocketAddress *address,
+                                      int64_t *timestamp) {
+    if (timestamp != nullptr) {
+        *timestamp = -1;
+    }
+    if (received_.empty()) {
+        // The multishot request takes every datagram as it arrives.
+        error_ = EWOULDBLOCK;
+        return -1;
+    }
+    const Received received = received_.front();
+    received_.pop_front();
+    const size_t copied = std::min(size, received.size);
+    std::memcpy(data, received.payload, copied);
+    if (address != nullptr) {
+        rtc::SocketAddressFromSockAddrStorage(received.address, address);
+    }
+    server_->buffers_.recycle(received.buffer);
+    return static_cast<int>(copied);
+}
+
+inline int IoUringUdpSocket::Close() {
+    if (fd_ < 0) {
+        return 0;
+    }
+    server_->remove_socket(this);
+    ::close(fd_);
+    fd_ = -1;
+    return 0;
+}
+
+#endif
+
+// Whether IoUringSocketServer is built and the kernel runs it.
+inline bool IoUringSupported() {
+#ifdef IORING_RECV_MULTISHOT
+    return IoUringSocketServer::Supported();
+#else
+    return false;
+#endif
+}
+
+// The io_uring socket server where it is supported, otherwise the
+// epoll-based BatchingSocketServer.
+inline std::unique_ptr<rtc::SocketServer> CreateIoUringSocketServer(
+        const IoUringConfig &config = IoUringConfig()) {
+#ifdef IORING_RECV_MULTISHOT
+    if (IoUringSocketServer::Supported()) {
+        return std::unique_ptr<rtc::SocketServer>(
+                new IoUringSocketServer(config));
+    }
+#endif
+    return std::unique_ptr<rtc::SocketServer>(new BatchingSocketServer());
+}
@@ -5,15 +5,18 @@
 #include <memory>
 #include <string>
 
-inline std::string JsonToString(const Json::Value json) {
-    return Json::writeString(Json::StreamWriterBuilder(), json);
+inline std::string JsonToString(const Json::Value &json) {
+    static const Json::StreamWriterBuilder builder;
+    return Json::writeString(builder, json);
 }
 
+// The reader is built once per thread and reused, since constructing a
+// CharReaderBuilder and CharReader costs more than parsing a small message.
 inline Json::Value StringToJson(const std::string &json_str) {
+    thread_local const std::unique_ptr<Json::CharReader> reader(
+            Json::CharReaderBuilder().newCharReader());
     Json::Value json;
     std::string err;
-    Json::CharReaderBuilder builder;
-    const std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
     if (!reader->parse(json_str.c_str(), json_str.c_str() + json_str.length(),
                        &json, &err)) {
         throw std::runtime_error("Failed to parse string to json, error: " +
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+// Heap bytes attributed to one owner, e.g. one WebRTCManager. Allocations are
+// charged to the account that is current on the allocating thread (see
+// ScopedMemoryAccount) and credited back to the same account when freed,
+// whichever thread frees them.
+//
+// Counting needs the operator new/delete of util/memory_accounting_hooks.h,
+// which a program opts into by including it in one translation unit. Without
+// it Enabled() is false and no account is created.
+class MemoryAccount {
+public:
+    // Accounts live until the process exits, since memory they were charged
+    // for can be freed after their owner is gone. They are built in malloc()
+    // memory, out of reach of the hooks' operator new.
+    static MemoryAccount *Create(const std::string &name) {
+        MemoryAccount *account = New(name);
+        std::lock_guard<std::mutex> lock(RegistryMutex());
+        Registry().push_back(account);
+        return account;
+    }
+
+    static bool Enabled() { return EnabledFlag(); }
+
+    // Called by the hooks.
+    static bool Enable() {
+        EnabledFlag() = true;
+        return true;
+    }
+
+    // Account charged on this thread, null for none.
+    static MemoryAccount *&Current() {
+        static thread_local MemoryAccount *current = nullptr;
+        return current;
+    }
+
+    // Memory allocated while no account was current.
+    static MemoryAccount &Unattributed() {
+        static MemoryAccount *unattributed = New("unattributed");
+        return *unattributed;
+    }
+
+    // Bytes of every account created by Create().
+    static int64_t TotalBytes() {
+        int64_t total = 0;
+        std::lock_guard<std::mutex> lock(RegistryMutex());
+        for (const MemoryAccount *account : Registry()) {
+            total += account->bytes();
+        }
+        return total;
+    }
+
+    void charge(int64_t size) {
+        bytes_.fetch_add(size, std::memory_order_relaxed);
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void credit(int64_t size) {
+        bytes_.fetch_sub(size, std::memory_order_relaxed);
+        allocations_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    int64_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+    int64_t allocations() const {
+        return allocations_.load(std::memory_order_relaxed);
+    }
+
+    const std::string name;
+
+private:
+    MemoryAccount(const std::string &name_) : name(name_) {}
+
+    static MemoryAccount *New(const std::string &name) {
+        void *memory = std::malloc(sizeof(MemoryAccount));
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return new (memory) MemoryAccount(name);
+    }
+
+    static bool &EnabledFlag() {
+        static bool enabled = false;
+        return enabled;
+    }
+
+    static std::mutex &RegistryMutex() {
+        static std::mutex *mutex = new std::mutex();
+        return *mutex;
+    }
+
+    static std::vector<MemoryAccount *> &Registry() {
+        static std::vector<MemoryAccount *> *registry =
+                new std::vector<MemoryAccount *>();
+        return *registry;
+    }
+
+    std::atomic<int64_t> bytes_{0};
+    std::atomic<int64_t> allocations_{0};
+};
+
+// Make |account| current on this thread for the lifetime of the scope. A null
+// account leaves the current one unchanged.
+class ScopedMemoryAccount {
+public:
+    ScopedMemoryAccount(MemoryAccount *account)
+        : previous_(MemoryAccount::Current()) {
+        if (account != nullptr) {
+            MemoryAccount::Current() = account;
+        }
+    }
+
+    ~ScopedMemoryAccount() { MemoryAccount::Current() = previous_; }
+
+private:
+    MemoryAccount *previous_;
+};
+
+// Resident set size of the process, from /proc/self/statm. 0 if unavailable.
+inline int64_t CurrentRssBytes() {
+    std::ifstream statm("/proc/self/statm");
+    int64_t size_pages = 0;
+    int64_t resident_pages = 0;
+    if (!(statm >> size_pages >> resident_pages)) {
+        return 0;
+    }
+    return resident_pages * sysconf(_SC_PAGESIZE);
+}
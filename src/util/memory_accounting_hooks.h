@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "util/memory_accounting.h"
+
+// Replacement operator new/delete that charge every C++ heap allocation to
+// the current MemoryAccount. Include in exactly one translation unit of a
+// program to turn the accounting on.
+//
+// Each block carries a 16-byte header with its size and account, which keeps
+// the default alignment and inflates the footprint being measured, so only
+// instrumentation builds should include this. Memory from malloc() itself,
+// e.g. in usrsctp and BoringSSL, is not seen; compare with CurrentRssBytes().
+
+namespace memory_accounting_internal {
+
+struct alignas(16) Header {
+    MemoryAccount *account;
+    size_t size;
+};
+
+static const bool kEnabled = MemoryAccount::Enable();
+
+// Set while an allocation looks up its account, so that the allocations of
+// the lookup itself, e.g. the name of the unattributed account while it is
+// created, are not charged, instead of re-entering it.
+inline bool &InAllocate() {
+    static thread_local bool in_allocate = false;
+    return in_allocate;
+}
+
+inline void *Allocate(size_t size) {
+    Header *header = static_cast<Header *>(std::malloc(sizeof(Header) + size));
+    if (header == nullptr) {
+        return nullptr;
+    }
+    MemoryAccount *account = nullptr;
+    if (!InAllocate()) {
+        InAllocate() = true;
+        account = MemoryAccount::Current();
+        if (account == nullptr) {
+            account = &MemoryAccount::Unattributed();
+        }
+        InAllocate() = false;
+    }
+    header->account = account;
+    header->size = size;
+    if (account != nullptr) {
+        account->charge(size);
+    }
+    return header + 1;
+}
+
+inline void Free(void *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    Header *header = static_cast<Header *>(ptr) - 1;
+    if (header->account != nullptr) {
+        header->account->credit(header->size);
+    }
+    std::free(header);
+}
+
+}  // namespace memory_accounting_internal
+
+void *operator new(size_t size) {
+    void *ptr = memory_accounting_internal::Allocate(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    return memory_accounting_internal::Allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return memory_accounting_internal::Allocate(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    memory_accounting_internal::Free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    memory_accounting_internal::Free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    memory_accounting_internal::Free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    memory_accounting_internal::Free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+    memory_accounting_internal::Free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+    memory_accounting_internal::Free(ptr);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <thread>
+
+#ifndef ASIO_STANDALONE
+#define ASIO_STANDALONE  // Use ASIO standalone lib instead of boost.
+#endif
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/server.hpp>
+
+// Plain HTTP endpoint for Prometheus scrapes, served by websocketpp on its own
+// thread. GET /metrics returns the output of |render|.
+class MetricsHttpServer {
+    using HttpServer = websocketpp::server<websocketpp::config::asio>;
+
+public:
+    MetricsHttpServer(std::function<std::string()> render) : render_(render) {}
+
+    ~MetricsHttpServer() { stop(); }
+
+    void start(uint16_t port) {
+        server_.clear_access_channels(websocketpp::log::alevel::all);
+        server_.set_http_handler([this](websocketpp::connection_hdl hdl) {
+            HttpServer::connection_ptr con = server_.get_con_from_hdl(hdl);
+            if (con->get_resource() != "/metrics") {
+                con->set_status(websocketpp::http::status_code::not_found);
+                return;
+            }
+            con->append_header("Content-Type", "text/plain; version=0.0.4");
+            con->set_body(render_());
+            con->set_status(websocketpp::http::status_code::ok);
+        });
+        server_.init_asio();
+        server_.set_reuse_addr(true);
+        server_.listen(port);
+        server_.start_accept();
+        thread_ = std::thread([this]() { server_.run(); });
+    }
+
+    void stop() {
+        if (!thread_.joinable()) {
+            return;
+        }
+        server_.stop_listening();
+        server_.stop();
+        thread_.join();
+    }
+
+private:
+    std::function<std::string()> render_;
+    HttpServer server_;
+    std::thread thread_;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <rtc_base/async_socket.h>
+#include <rtc_base/socket_address.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+
+#include "util/socket_options.h"
+
+// Part of a rtc::AsyncSocket over a native nonblocking UDP socket that does
+// not depend on how datagrams are received and sent: addresses, options and
+// errors. Subclasses implement SendTo(), RecvFrom() and Close().
+class NativeUdpSocket : public rtc::AsyncSocket {
+public:
+    rtc::SocketAddress GetLocalAddress() const override {
+        sockaddr_storage storage = {};
+        socklen_t length = sizeof(storage);
+        rtc::SocketAddress address;
+        if (::getsockname(fd_, reinterpret_cast<sockaddr *>(&storage),
+                          &length) == 0) {
+            rtc::SocketAddressFromSockAddrStorage(storage, &address);
+        }
+        return address;
+    }
+
+    rtc::SocketAddress GetRemoteAddress() const override {
+        return remote_address_;
+    }
+
+    int Bind(const rtc::SocketAddress &address) override {
+        sockaddr_storage storage = {};
+        const size_t length = address.ToSockAddrStorage(&storage);
+        return check(::bind(fd_, reinterpret_cast<sockaddr *>(&storage),
+                            static_cast<socklen_t>(length)));
+    }
+
+    int Connect(const rtc::SocketAddress &address) override {
+        sockaddr_storage storage = {};
+        const size_t length = address.ToSockAddrStorage(&storage);
+        if (check(::connect(fd_, reinterpret_cast<sockaddr *>(&storage),
+                            static_cast<socklen_t>(length))) < 0) {
+            return -1;
+        }
+        remote_address_ = address;
+        return 0;
+    }
+
+    int Send(const void *data, size_t size) override {
+        if (remote_address_.IsNil()) {
+            error_ = ENOTCONN;
+            return -1;
+        }
+        return SendTo(data, size, remote_address_);
+    }
+
+    int Recv(void *data, size_t size, int64_t *timestamp) override {
+        return RecvFrom(data, size, nullptr, timestamp);
+    }
+
+    int Listen(int backlog) override {
+        error_ = EOPNOTSUPP;
+        return -1;
+    }
+
+    rtc::AsyncSocket *Accept(rtc::SocketAddress *address) override {
+        error_ = EOPNOTSUPP;
+        return nullptr;
+    }
+
+    int GetError() const override { return error_; }
+    void SetError(int error) override { error_ = error; }
+
+    ConnState GetState() const override {
+        return remote_address_.IsNil() ? CS_CLOSED : CS_CONNECTED;
+    }
+
+    int GetOption(Option option, int *value) override {
+        return check(GetSocketOption(fd_, family_, option, value));
+    }
+
+    int SetOption(Option option, int value) override {
+        return check(SetSocketOption(fd_, family_, option, value));
+    }
+
+protected:
+    // Create the native socket.
+    bool open(int family) {
+        fd_ = ::socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) {
+            error_ = errno;
+            return false;
+        }
+        family_ = family;
+        return true;
+    }
+
+    int check(int result) {
+        if (result < 0) {
+            error_ = errno;
+        }
+        return result;
+    }
+
+    int fd_ = -1;
+    int family_ = AF_INET;
+    int error_ = 0;
+    rtc::SocketAddress remote_address_;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <string>
+
+// Why a WebRTCManager operation failed.
+enum class OperationErrorCode {
+    kOk,
+    // The remote SDP or candidate does not parse.
+    kInvalidSdp,
+    kInvalidCandidate,
+    // WebRTC refused to create the PeerConnection.
+    kPeerConnectionFailed,
+    // Creating, or setting, a session description failed.
+    kCreateDescriptionFailed,
+    kSetDescriptionFailed,
+    // The PeerConnection rejected a remote candidate.
+    kAddCandidateFailed,
+    // The operation's deadline passed.
+    kTimeout,
+    // The network path did not come back within the ICE restarts.
+    kIceRestartFailed,
+    // The session failed or quit before the operation completed.
+    kCancelled,
+};
+
+inline const char *OperationErrorCodeName(OperationErrorCode code) {
+    switch (code) {
+        case OperationErrorCode::kOk:
+            return "ok";
+        case OperationErrorCode::kInvalidSdp:
+            return "invalid_sdp";
+        case OperationErrorCode::kInvalidCandidate:
+            return "invalid_candidate";
+        case OperationErrorCode::kPeerConnectionFailed:
+            return "peer_connection_failed";
+        case OperationErrorCode::kCreateDescriptionFailed:
+            return "create_description_failed";
+        case OperationErrorCode::kSetDescriptionFailed:
+            return "set_description_failed";
+        case OperationErrorCode::kAddCandidateFailed:
+            return "add_candidate_failed";
+        case OperationErrorCode::kTimeout:
+            return "timeout";
+        case OperationErrorCode::kIceRestartFailed:
+            return "ice_restart_failed";
+        case OperationErrorCode::kCancelled:
+            return "cancelled";
+    }
+    return "unknown";
+}
+
+struct OperationError {
+    OperationErrorCode code = OperationErrorCode::kOk;
+    std::string message;
+
+    OperationError() = default;
+    OperationError(OperationErrorCode code_, const std::string &message_)
+        : code(code_), message(message_) {}
+
+    bool ok() const { return code == OperationErrorCode::kOk; }
+
+    // Whether the session cannot go on after the error. A rejected remote
+    // candidate only loses that candidate.
+    bool fatal() const {
+        return !ok() && code != OperationErrorCode::kInvalidCandidate &&
+               code != OperationErrorCode::kAddCandidateFailed;
+    }
+
+    std::string ToString() const {
+        std::string string = OperationErrorCodeName(code);
+        if (!message.empty()) {
+            string += ": " + message;
+        }
+        return string;
+    }
+};
+
+// One operation in flight, completed once by whichever comes first: its
+// success, its failure, its deadline or the cancellation of the session.
+// Thread-safe.
+class Operation {
+public:
+    explicit Operation(const std::string &name) : name_(name) {}
+
+    const std::string &name() const { return name_; }
+
+    // The outcome. Call once.
+    std::future<OperationError> future() { return promise_.get_future(); }
+
+    // Returns false when the operation had already completed.
+    bool complete(const OperationError &error = OperationError()) {
+        if (done_.exchange(true)) {
+            return false;
+        }
+        promise_.set_value(error);
+        return true;
+    }
+
+    bool done() const { return done_; }
+
+private:
+    const std::string name_;
+    std::promise<OperationError> promise_;
+    std::atomic<bool> done_{false};
+};
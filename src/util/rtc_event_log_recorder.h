@@ -0,0 +1,162 @@
+#pragma once
+
+#include <api/peer_connection_interface.h>
+#include <api/rtc_event_log_output.h>
+#include <api/rtc_event_log_output_file.h>
+#include <rtc_base/task_utils/repeating_task.h>
+#include <rtc_base/thread.h>
+#include <rtc_base/time_utils.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+
+struct RtcEventLogConfig {
+    // Files are written to <directory>/<prefix>.<index>.rtclog.
+    std::string directory = ".";
+    std::string prefix = "webrtc";
+
+    // A file is closed and the next one opened once it reaches 3/4 of
+    // |max_file_bytes| or gets older than |max_file_age_ms|. The last quarter
+    // is headroom for the events written before the next check; a file never
+    // grows past |max_file_bytes|.
+    size_t max_file_bytes = 8 << 20;
+    int64_t max_file_age_ms = 10 * 60 * 1000;
+
+    // Only the newest |max_files| files are kept, which bounds the disk use
+    // of one connection to max_files * max_file_bytes.
+    size_t max_files = 4;
+
+    // Events are buffered and encoded once per period. Longer periods cost
+    // less CPU and fewer writes, but lose more events on a crash.
+    int64_t output_period_ms = 5000;
+};
+
+// Runtime switch for the client and server: the RtcEventLog is recorded when
+// RTC_EVENT_LOG_DIR names a directory. Returns false when it is unset.
+inline bool RtcEventLogConfigFromEnv(const std::string &prefix,
+                                     RtcEventLogConfig *config) {
+    const char *directory = std::getenv("RTC_EVENT_LOG_DIR");
+    if (directory == nullptr || *directory == '\0') {
+        return false;
+    }
+    config->directory = directory;
+    config->prefix = prefix;
+    return true;
+}
+
+// Records the RtcEventLog of one PeerConnection into rotating files. Every
+// file holds a complete log, from StartRtcEventLog() to StopRtcEventLog(), so
+// each can be parsed on its own with webrtc::ParsedRtcEventLog.
+//
+// All the work runs on |thread|, the signaling thread of the connection.
+class RtcEventLogRecorder {
+public:
+    RtcEventLogRecorder(
+            const RtcEventLogConfig &config,
+            rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection,
+            rtc::Thread *thread)
+        : config_(config),
+          peer_connection_(peer_connection),
+          thread_(thread) {}
+
+    ~RtcEventLogRecorder() { stop(); }
+
+    // Returns false if the log could not be started, e.g. because the
+    // PeerConnectionFactory has no RtcEventLogFactory.
+    bool start() {
+        return thread_->Invoke<bool>(RTC_FROM_HERE, [this]() {
+            if (!open_next_file()) {
+                return false;
+            }
+            rotation_task_ = webrtc::RepeatingTaskHandle::DelayedStart(
+                    thread_, webrtc::TimeDelta::Millis(kCheckIntervalMs),
+                    [this]() {
+                        rotate_if_needed();
+                        return webrtc::TimeDelta::Millis(kCheckIntervalMs);
+                    });
+            return true;
+        });
+    }
+
+    // Flush and close the current file.
+    void stop() {
+        thread_->Invoke<void>(RTC_FROM_HERE, [this]() {
+            if (!rotation_task_.Running()) {
+                return;
+            }
+            rotation_task_.Stop();
+            peer_connection_->StopRtcEventLog();
+        });
+    }
+
+private:
+    // Counts the bytes written to the current file.
+    class CountingOutput : public webrtc::RtcEventLogOutput {
+    public:
+        CountingOutput(const std::string &path,
+                       size_t max_bytes,
+                       std::shared_ptr<std::atomic<size_t>> bytes_written)
+            : file_(path, max_bytes), bytes_written_(bytes_written) {}
+
+        bool IsActive() const override { return file_.IsActive(); }
+
+        bool Write(const std::string &output) override {
+            *bytes_written_ += output.size();
+            return file_.Write(output);
+        }
+
+    private:
+        webrtc::RtcEventLogOutputFile file_;
+        std::shared_ptr<std::atomic<size_t>> bytes_written_;
+    };
+
+    void rotate_if_needed() {
+        if (*bytes_written_ < config_.max_file_bytes / 4 * 3 &&
+            rtc::TimeMillis() - file_opened_ms_ < config_.max_file_age_ms) {
+            return;
+        }
+        // StopRtcEventLog() writes the pending events before returning.
+        peer_connection_->StopRtcEventLog();
+        open_next_file();
+    }
+
+    bool open_next_file() {
+        const std::string path = config_.directory + "/" + config_.prefix +
+                                 "." + std::to_string(next_index_++) +
+                                 ".rtclog";
+        bytes_written_ = std::make_shared<std::atomic<size_t>>(0);
+        file_opened_ms_ = rtc::TimeMillis();
+        if (!peer_connection_->StartRtcEventLog(
+                    std::unique_ptr<webrtc::RtcEventLogOutput>(
+                            new CountingOutput(path, config_.max_file_bytes,
+                                               bytes_written_)),
+                    config_.output_period_ms)) {
+            std::cout << "Error on StartRtcEventLog: " << path << std::endl;
+            return false;
+        }
+        files_.push_back(path);
+        while (files_.size() > config_.max_files) {
+            std::remove(files_.front().c_str());
+            files_.pop_front();
+        }
+        return true;
+    }
+
+    static constexpr int64_t kCheckIntervalMs = 1000;
+
+    const RtcEventLogConfig config_;
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection_;
+    rtc::Thread *const thread_;
+
+    // Only touched on |thread_|.
+    webrtc::RepeatingTaskHandle rotation_task_;
+    std::shared_ptr<std::atomic<size_t>> bytes_written_;
+    int64_t file_opened_ms_ = 0;
+    int next_index_ = 0;
+    std::deque<std::string> files_;
+};
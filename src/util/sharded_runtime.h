@@ -0,0 +1,183 @@
+#pragma once
+
+#include <pthread.h>
+#include <rtc_base/socket_server.h>
+#include <rtc_base/thread.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/thread_config.h"
+#include "util/thread_group.h"
+#include "util/webrtc_manager.h"
+
+struct ShardedRuntimeConfig {
+    // Number of shards; 0 for one per CPU.
+    int shards = 0;
+
+    // Spread the shards round-robin over the NUMA nodes, each shard's
+    // threads on one node.
+    bool numa = true;
+
+    // Applied to the threads of every shard, see RtcThreadGroup.
+    ThreadConfig thread_config;
+
+    // Socket server of the shards' network threads; PhysicalSocketServer
+    // when empty.
+    std::function<std::unique_ptr<rtc::SocketServer>()> create_socket_server;
+};
+
+// Load of one shard at the time of the sample.
+struct ShardLoad {
+    int shard = 0;
+    int numa_node = -1;
+    // Sessions attached and not detached yet.
+    size_t sessions = 0;
+    // Sessions ever attached.
+    uint64_t sessions_total = 0;
+    // CPU time of the shard's network thread, the first to saturate.
+    double network_cpu_seconds = 0;
+};
+
+// One shard: network, worker and signaling threads with the
+// PeerConnectionFactory every session on the shard shares.
+class RtcShard {
+public:
+    RtcShard(int index, int numa_node, const ShardedRuntimeConfig &config)
+        : index_(index),
+          threads_("shard" + std::to_string(index), numa_node,
+                   config.thread_config, config.create_socket_server) {
+        threads_.network_thread()->Invoke<void>(RTC_FROM_HERE, [this]() {
+            if (pthread_getcpuclockid(pthread_self(), &network_clock_) != 0) {
+                network_clock_ = -1;
+            }
+        });
+        factory_ = WebRTCManager::CreateFactory(threads_.network_thread(),
+                                                threads_.worker_thread(),
+                                                threads_.signaling_thread());
+        if (factory_ == nullptr) {
+            throw std::runtime_error("Failed to create the factory of shard " +
+                                     std::to_string(index));
+        }
+    }
+
+    // Run |manager| on the shard. Call before manager.init().
+    void attach(WebRTCManager &manager) {
+        threads_.attach(manager);
+        manager.external_peer_connection_factory = factory_;
+        ++sessions_total_;
+    }
+
+    // Forget a session attached before, once its manager quit.
+    void detach() { threads_.detach(); }
+
+    size_t sessions() const { return threads_.connections(); }
+
+    ShardLoad load() const {
+        ShardLoad load;
+        load.shard = index_;
+        load.numa_node = threads_.numa_node();
+        load.sessions = threads_.connections();
+        load.sessions_total = sessions_total_;
+        timespec ts;
+        if (network_clock_ != clockid_t(-1) &&
+            clock_gettime(network_clock_, &ts) == 0) {
+            load.network_cpu_seconds = ts.tv_sec + ts.tv_nsec / 1e9;
+        }
+        return load;
+    }
+
+private:
+    const int index_;
+    RtcThreadGroup threads_;
+    // Released before the threads stop.
+    rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory_;
+    clockid_t network_clock_ = -1;
+    std::atomic<uint64_t> sessions_total_{0};
+};
+
+// N independent shards, so that no single network thread carries every
+// session of a many-core server. Each new session goes to the shard with the
+// fewest sessions. Outlives the managers attached.
+class ShardedRuntime {
+public:
+    ShardedRuntime(
+            const ShardedRuntimeConfig &config = ShardedRuntimeConfig()) {
+        int shards = config.shards;
+        if (shards <= 0) {
+            shards = std::max(1u, std::thread::hardware_concurrency());
+        }
+        const std::vector<int> nodes =
+                config.numa ? NumaNodes() : std::vector<int>{-1};
+        for (int i = 0; i < shards; ++i) {
+            shards_.emplace_back(
+                    new RtcShard(i, nodes[i % nodes.size()], config));
+        }
+    }
+
+    // Run |manager| on the least loaded shard. Returns the shard, to detach()
+    // the session from once the manager quit.
+    RtcShard &attach(WebRTCManager &manager) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        RtcShard *least = shards_.front().get();
+        for (const std::unique_ptr<RtcShard> &shard : shards_) {
+            if (shard->sessions() < least->sessions()) {
+                least = shard.get();
+            }
+        }
+        least->attach(manager);
+        return *least;
+    }
+
+    std::vector<ShardLoad> load() const {
+        std::vector<ShardLoad> loads;
+        for (const std::unique_ptr<RtcShard> &shard : shards_) {
+            loads.push_back(shard->load());
+        }
+        return loads;
+    }
+
+    // load() in the Prometheus text format, labelled by shard.
+    std::string render() const {
+        const std::vector<ShardLoad> loads = load();
+        std::ostringstream out;
+        out << "# HELP webrtc_shard_sessions Sessions on the shard.\n"
+            << "# TYPE webrtc_shard_sessions gauge\n";
+        for (const ShardLoad &load : loads) {
+            out << "webrtc_shard_sessions{shard=\"" << load.shard
+                << "\",numa_node=\"" << load.numa_node << "\"} "
+                << load.sessions << "\n";
+        }
+        out << "# HELP webrtc_shard_sessions_total Sessions ever attached to "
+               "the shard.\n"
+            << "# TYPE webrtc_shard_sessions_total counter\n";
+        for (const ShardLoad &load : loads) {
+            out << "webrtc_shard_sessions_total{shard=\"" << load.shard
+                << "\"} " << load.sessions_total << "\n";
+        }
+        out << "# HELP webrtc_shard_network_cpu_seconds_total CPU time of "
+               "the shard's network thread.\n"
+            << "# TYPE webrtc_shard_network_cpu_seconds_total counter\n";
+        for (const ShardLoad &load : loads) {
+            out << "webrtc_shard_network_cpu_seconds_total{shard=\""
+                << load.shard << "\"} " << load.network_cpu_seconds << "\n";
+        }
+        return out.str();
+    }
+
+    size_t size() const { return shards_.size(); }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<RtcShard>> shards_;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <json/json.h>
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#include "util/binary_signaling.h"
+#include "util/json_utils.h"
+
+// Convert a parsed JSON signaling message into its typed form. The JSON
+// object is only walked once, whatever the message type.
+inline SignalingMessage JsonToSignalingMessage(const Json::Value &json) {
+    const std::string type = json.get("type", "").asString();
+    SignalingMessage message;
+    if (type == "offer") {
+        message.type = SignalingMessage::kOffer;
+        message.sdp = json.get("sdp", "").asString();
+        message.accepts_binary = json.get("binary", false).asBool();
+        message.accepts_trace = json.get("trace", false).asBool();
+    } else if (type == "answer") {
+        message.type = SignalingMessage::kAnswer;
+        message.sdp = json.get("answer", "").asString();
+    } else if (type == "ice") {
+        message.type = SignalingMessage::kIce;
+        message.ices.push_back(Ice::FromJson(json));
+    } else if (type == "ice_batch") {
+        message.type = SignalingMessage::kIceBatch;
+        message.ices = Ice::FromJsonBatch(json);
+    } else if (type == "trace") {
+        message.type = SignalingMessage::kTrace;
+        message.trace = TraceEventsFromJson(json["events"]);
+    } else {
+        throw std::runtime_error("Unkown json message type: " + type);
+    }
+    return message;
+}
+
+// Parses every incoming signaling message exactly once, JSON or binary, and
+// hands the typed result to the handler registered for its type. Messages
+// without a handler are rejected.
+class SignalingDispatcher {
+public:
+    using Handler = std::function<void(const SignalingMessage &)>;
+
+    void on_offer(Handler f) { on_offer_ = f; }
+
+    void on_answer(Handler f) { on_answer_ = f; }
+
+    // Receives both single "ice" messages and "ice_batch" messages.
+    void on_ice(Handler f) { on_ice_ = f; }
+
+    void on_trace(Handler f) { on_trace_ = f; }
+
+    void dispatch_text(const std::string &payload) {
+        dispatch(JsonToSignalingMessage(StringToJson(payload)));
+    }
+
+    void dispatch_binary(const std::string &payload) {
+        dispatch(DecodeSignalingMessage(payload));
+    }
+
+    void dispatch(const SignalingMessage &message) {
+        const Handler *handler = nullptr;
+        switch (message.type) {
+            case SignalingMessage::kOffer:
+                handler = &on_offer_;
+                break;
+            case SignalingMessage::kAnswer:
+                handler = &on_answer_;
+                break;
+            case SignalingMessage::kIce:
+            case SignalingMessage::kIceBatch:
+                handler = &on_ice_;
+                break;
+            case SignalingMessage::kTrace:
+                handler = &on_trace_;
+                break;
+        }
+        if (handler == nullptr || !*handler) {
+            throw std::runtime_error("Unexpected signaling message type: " +
+                                     std::to_string(message.type));
+        }
+        (*handler)(message);
+    }
+
+private:
+    Handler on_offer_;
+    Handler on_answer_;
+    Handler on_ice_;
+    Handler on_trace_;
+};
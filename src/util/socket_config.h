@@ -0,0 +1,294 @@
+#pragma once
+
+#include <api/packet_socket_factory.h>
+#include <dirent.h>
+#include <rtc_base/async_packet_socket.h>
+#include <rtc_base/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// Options applied to every socket a PeerConnection opens. Zero or negative
+// values keep the system defaults.
+struct SocketConfig {
+    // SO_RCVBUF / SO_SNDBUF in bytes. Linux doubles the value for its
+    // bookkeeping and caps it at net.core.rmem_max / wmem_max.
+    int receive_buffer_size = 0;
+    int send_buffer_size = 0;
+
+    // DiffServ code point of every packet, e.g. 46 (EF) or 34 (AF41).
+    int dscp = -1;
+
+    // Local ports to bind, inclusive.
+    int min_port = 0;
+    int max_port = 0;
+
+    bool has_socket_options() const {
+        return receive_buffer_size > 0 || send_buffer_size > 0 || dscp >= 0;
+    }
+
+    bool has_port_range() const { return min_port > 0 && max_port > 0; }
+};
+
+// PacketSocketFactory applying a SocketConfig's options to the sockets of
+// |factory|, and remembering the local ports of its UDP sockets to find
+// their drop counters.
+class ConfiguredPacketSocketFactory : public rtc::PacketSocketFactory {
+public:
+    ConfiguredPacketSocketFactory(
+            std::unique_ptr<rtc::PacketSocketFactory> factory,
+            const SocketConfig &config)
+        : factory_(std::move(factory)), config_(config) {}
+
+    rtc::AsyncPacketSocket *CreateUdpSocket(const rtc::SocketAddress &address,
+                                            uint16_t min_port,
+                                            uint16_t max_port) override {
+        rtc::AsyncPacketSocket *socket =
+                factory_->CreateUdpSocket(address, min_port, max_port);
+        if (socket != nullptr) {
+            configure(socket);
+            std::lock_guard<std::mutex> lock(mutex_);
+            udp_ports_.insert(socket->GetLocalAddress().port());
+        }
+        return socket;
+    }
+
+    rtc::AsyncPacketSocket *CreateServerTcpSocket(
+            const rtc::SocketAddress &local_address,
+            uint16_t min_port,
+            uint16_t max_port,
+            int opts) override {
+        return configure(factory_->CreateServerTcpSocket(
+                local_address, min_port, max_port, opts));
+    }
+
+    rtc::AsyncPacketSocket *CreateClientTcpSocket(
+            const rtc::SocketAddress &local_address,
+            const rtc::SocketAddress &remote_address,
+            const rtc::ProxyInfo &proxy_info,
+            const std::string &user_agent,
+            const rtc::PacketSocketTcpOptions &tcp_options) override {
+        return configure(factory_->CreateClientTcpSocket(
+                local_address, remote_address, proxy_info, user_agent,
+                tcp_options));
+    }
+
+    rtc::AsyncResolverInterface *CreateAsyncResolver() override {
+        return factory_->CreateAsyncResolver();
+    }
+
+    // Local ports of the UDP sockets created so far, including closed ones.
+    std::set<uint16_t> udp_ports() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return udp_ports_;
+    }
+
+private:
+    rtc::AsyncPacketSocket *configure(rtc::AsyncPacketSocket *socket) {
+        if (socket == nullptr) {
+            return nullptr;
+        }
+        if (config_.receive_buffer_size > 0) {
+            socket->SetOption(rtc::Socket::OPT_RCVBUF,
+                              config_.receive_buffer_size);
+        }
+        if (config_.send_buffer_size > 0) {
+            socket->SetOption(rtc::Socket::OPT_SNDBUF,
+                              config_.send_buffer_size);
+        }
+        if (config_.dscp >= 0) {
+            socket->SetOption(rtc::Socket::OPT_DSCP, config_.dscp);
+        }
+        return socket;
+    }
+
+    std::unique_ptr<rtc::PacketSocketFactory> factory_;
+    const SocketConfig config_;
+    mutable std::mutex mutex_;
+    std::set<uint16_t> udp_ports_;
+};
+
+// Datagrams the kernel dropped for lack of socket buffer space.
+struct UdpDrops {
+    // Receive drops of this process's UDP sockets (the "drops" column of
+    // /proc/net/udp), including those closed since the counter was created.
+    uint64_t socket_drops = 0;
+    // RcvbufErrors and SndbufErrors of /proc/net/snmp, for the whole network
+    // namespace.
+    uint64_t receive_buffer_errors = 0;
+    uint64_t send_buffer_errors = 0;
+};
+
+// Samples UdpDrops. The kernel forgets the drops of a socket when it is
+// closed, so the last value seen of each socket is kept to count
+// monotonically. Thread-safe.
+class UdpDropCounter {
+public:
+    // Count only the sockets bound to |ports|, or all of this process's UDP
+    // sockets when null.
+    UdpDrops sample(const std::set<uint16_t> *ports = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const std::set<uint64_t> inodes = OwnSocketInodes();
+        std::map<uint64_t, uint64_t> open;
+        for (const char *path : {"/proc/net/udp", "/proc/net/udp6"}) {
+            ReadSocketDrops(path, inodes, ports, &open);
+        }
+        // Sockets gone since the last sample keep their last count.
+        for (const auto &entry : last_) {
+            if (open.find(entry.first) == open.end()) {
+                closed_drops_ += entry.second;
+            }
+        }
+        last_ = open;
+
+        UdpDrops drops;
+        drops.socket_drops = closed_drops_;
+        for (const auto &entry : open) {
+            drops.socket_drops += entry.second;
+        }
+        ReadSnmpBufferErrors(&drops);
+        return drops;
+    }
+
+private:
+    // Inodes of the sockets among this process's file descriptors.
+    static std::set<uint64_t> OwnSocketInodes() {
+        std::set<uint64_t> inodes;
+        DIR *dir = opendir("/proc/self/fd");
+        if (dir == nullptr) {
+            return inodes;
+        }
+        while (dirent *entry = readdir(dir)) {
+            char target[64];
+            const std::string path =
+                    std::string("/proc/self/fd/") + entry->d_name;
+            const ssize_t length =
+                    readlink(path.c_str(), target, sizeof(target) - 1);
+            if (length <= 0) {
+                continue;
+            }
+            target[length] = '\0';
+            unsigned long long inode;
+            if (sscanf(target, "socket:[%llu]", &inode) == 1) {
+                inodes.insert(inode);
+            }
+        }
+        closedir(dir);
+        return inodes;
+    }
+
+    // Adds the drops of the matching sockets in |path| by inode.
+    static void ReadSocketDrops(const char *path,
+                                const std::set<uint64_t> &inodes,
+                                const std::set<uint16_t> *ports,
+                                std::map<uint64_t, uint64_t> *drops) {
+        std::ifstream table(path);
+        std::string line;
+        std::getline(table, line);  // Header.
+        while (std::getline(table, line)) {
+            // sl local_address rem_address st tx_queue:rx_queue tr:tm->when
+            // retrnsmt uid timeout inode ref pointer drops
+            std::istringstream fields(line);
+            std::string slot, local, remote, state, queues, timer, retransmits;
+            uint64_t uid, timeout, inode, ref;
+            std::string pointer;
+            uint64_t socket_drops;
+            if (!(fields >> slot >> local >> remote >> state >> queues >>
+                  timer >> retransmits >> uid >> timeout >> inode >> ref >>
+                  pointer >> socket_drops)) {
+                continue;
+            }
+            if (inodes.find(inode) == inodes.end()) {
+                continue;
+            }
+            const size_t colon = local.rfind(':');
+            const uint16_t port = static_cast<uint16_t>(
+                    std::stoul(local.substr(colon + 1), nullptr, 16));
+            if (ports != nullptr && ports->find(port) == ports->end()) {
+                continue;
+            }
+            (*drops)[inode] = socket_drops;
+        }
+    }
+
+    static void ReadSnmpBufferErrors(UdpDrops *drops) {
+        std::ifstream snmp("/proc/net/snmp");
+        std::string names;
+        std::string values;
+        while (std::getline(snmp, names) && std::getline(snmp, values)) {
+            if (names.compare(0, 4, "Udp:") != 0) {
+                continue;
+            }
+            std::istringstream name_stream(names);
+            std::istringstream value_stream(values);
+            std::string name;
+            std::string value;
+            while (name_stream >> name && value_stream >> value) {
+                if (name == "RcvbufErrors") {
+                    drops->receive_buffer_errors = std::stoull(value);
+                } else if (name == "SndbufErrors") {
+                    drops->send_buffer_errors = std::stoull(value);
+                }
+            }
+            return;
+        }
+    }
+
+    std::mutex mutex_;
+    std::map<uint64_t, uint64_t> last_;
+    uint64_t closed_drops_ = 0;
+};
+
+// Runtime settings for the client and server: WEBRTC_RCVBUF and
+// WEBRTC_SNDBUF in bytes, WEBRTC_DSCP and WEBRTC_PORT_RANGE as min-max.
+// Throws std::runtime_error on an invalid port range, which the client and
+// server report from main().
+inline SocketConfig SocketConfigFromEnv() {
+    SocketConfig config;
+    if (const char *value = std::getenv("WEBRTC_RCVBUF")) {
+        config.receive_buffer_size = std::atoi(value);
+    }
+    if (const char *value = std::getenv("WEBRTC_SNDBUF")) {
+        config.send_buffer_size = std::atoi(value);
+    }
+    if (const char *value = std::getenv("WEBRTC_DSCP")) {
+        config.dscp = std::atoi(value);
+    }
+    if (const char *value = std::getenv("WEBRTC_PORT_RANGE")) {
+        if (sscanf(value, "%d-%d", &config.min_port, &config.max_port) != 2 ||
+            config.min_port < 1 || config.max_port < config.min_port ||
+            config.max_port > 65535) {
+            throw std::runtime_error(
+                    std::string("Invalid WEBRTC_PORT_RANGE: ") + value);
+        }
+    }
+    return config;
+}
+
+// UdpDrops in the Prometheus text format.
+inline std::string RenderUdpDrops(const UdpDrops &drops) {
+    std::ostringstream out;
+    out << "# HELP webrtc_udp_socket_drops_total Datagrams dropped by the "
+           "connection's UDP sockets for lack of receive buffer space.\n"
+        << "# TYPE webrtc_udp_socket_drops_total counter\n"
+        << "webrtc_udp_socket_drops_total " << drops.socket_drops << "\n"
+        << "# HELP udp_receive_buffer_errors_total RcvbufErrors of the host.\n"
+        << "# TYPE udp_receive_buffer_errors_total counter\n"
+        << "udp_receive_buffer_errors_total " << drops.receive_buffer_errors
+        << "\n"
+        << "# HELP udp_send_buffer_errors_total SndbufErrors of the host.\n"
+        << "# TYPE udp_send_buffer_errors_total counter\n"
+        << "udp_send_buffer_errors_total " << drops.send_buffer_errors
+        << "\n";
+    return out.str();
+}
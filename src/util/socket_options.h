@@ -0,0 +1,82 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <rtc_base/socket.h>
+#include <sys/socket.h>
+
+// rtc::Socket options on a native socket of |family|, translated the way
+// PhysicalSocket does. Return -1 with errno set on failure, or without it for
+// options that are not socket options (OPT_RTP_SENDTIME_EXTN_ID).
+
+inline bool TranslateSocketOption(rtc::Socket::Option option,
+                                  int family,
+                                  int *level,
+                                  int *name) {
+    const bool ipv6 = family == AF_INET6;
+    switch (option) {
+        case rtc::Socket::OPT_DONTFRAGMENT:
+            *level = ipv6 ? IPPROTO_IPV6 : IPPROTO_IP;
+            *name = ipv6 ? IPV6_MTU_DISCOVER : IP_MTU_DISCOVER;
+            return true;
+        case rtc::Socket::OPT_RCVBUF:
+            *level = SOL_SOCKET;
+            *name = SO_RCVBUF;
+            return true;
+        case rtc::Socket::OPT_SNDBUF:
+            *level = SOL_SOCKET;
+            *name = SO_SNDBUF;
+            return true;
+        case rtc::Socket::OPT_NODELAY:
+            *level = IPPROTO_TCP;
+            *name = TCP_NODELAY;
+            return true;
+        case rtc::Socket::OPT_IPV6_V6ONLY:
+            *level = IPPROTO_IPV6;
+            *name = IPV6_V6ONLY;
+            return true;
+        case rtc::Socket::OPT_DSCP:
+            *level = ipv6 ? IPPROTO_IPV6 : IPPROTO_IP;
+            *name = ipv6 ? IPV6_TCLASS : IP_TOS;
+            return true;
+        default:
+            return false;
+    }
+}
+
+inline int GetSocketOption(int fd,
+                           int family,
+                           rtc::Socket::Option option,
+                           int *value) {
+    int level;
+    int name;
+    if (!TranslateSocketOption(option, family, &level, &name)) {
+        return -1;
+    }
+    socklen_t length = sizeof(*value);
+    if (::getsockopt(fd, level, name, value, &length) < 0) {
+        return -1;
+    }
+    if (option == rtc::Socket::OPT_DSCP) {
+        *value >>= 2;
+    }
+    return 0;
+}
+
+inline int SetSocketOption(int fd,
+                           int family,
+                           rtc::Socket::Option option,
+                           int value) {
+    int level;
+    int name;
+    if (!TranslateSocketOption(option, family, &level, &name)) {
+        return -1;
+    }
+    if (option == rtc::Socket::OPT_DONTFRAGMENT) {
+        value = value ? IP_PMTUDISC_DO : IP_PMTUDISC_DONT;
+    } else if (option == rtc::Socket::OPT_DSCP) {
+        // DSCP is the upper six bits of the TOS / traffic class byte.
+        value <<= 2;
+    }
+    return ::setsockopt(fd, level, name, &value, sizeof(value));
+}
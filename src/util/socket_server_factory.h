@@ -0,0 +1,42 @@
+#pragma once
+
+#include <rtc_base/socket_server.h>
+
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "util/batching_socket_server.h"
+#include "util/busy_poll_socket_server.h"
+#include "util/io_uring_socket_server.h"
+
+// Runtime switch for the client and server: WEBRTC_SOCKET_SERVER=io_uring,
+// =batching or =busy_poll picks the socket server of the network thread,
+// the latter spinning for WEBRTC_BUSY_POLL_US. Empty, i.e.
+// PhysicalSocketServer, otherwise.
+inline std::function<std::unique_ptr<rtc::SocketServer>()>
+SocketServerFactoryFromEnv() {
+    const char *value = std::getenv("WEBRTC_SOCKET_SERVER");
+    const std::string name = value != nullptr ? value : "";
+    if (name == "busy_poll") {
+        BusyPollConfig config;
+        if (const char *spin_us = std::getenv("WEBRTC_BUSY_POLL_US")) {
+            config.spin_us = std::atoi(spin_us);
+        }
+        return [config]() {
+            return std::unique_ptr<rtc::SocketServer>(
+                    new BusyPollSocketServer(config));
+        };
+    }
+    if (name == "io_uring") {
+        return []() { return CreateIoUringSocketServer(); };
+    }
+    if (name == "batching") {
+        return []() {
+            return std::unique_ptr<rtc::SocketServer>(
+                    new BatchingSocketServer());
+        };
+    }
+    return nullptr;
+}
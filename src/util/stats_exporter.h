@@ -0,0 +1,320 @@
+#pragma once
+
+#include <api/peer_connection_interface.h>
+#include <api/stats/rtc_stats_collector_callback.h>
+#include <api/stats/rtc_stats_report.h>
+#include <api/stats/rtcstats_objects.h>
+#include <rtc_base/thread.h>
+#include <rtc_base/time_utils.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The candidate pair in use by the first transport that has selected one, or
+// null.
+inline const webrtc::RTCIceCandidatePairStats *FindSelectedCandidatePair(
+        const webrtc::RTCStatsReport &report) {
+    for (const webrtc::RTCTransportStats *transport :
+         report.GetStatsOfType<webrtc::RTCTransportStats>()) {
+        if (!transport->selected_candidate_pair_id.is_defined()) {
+            continue;
+        }
+        const webrtc::RTCStats *pair =
+                report.Get(*transport->selected_candidate_pair_id);
+        if (pair != nullptr) {
+            return &pair->cast_to<webrtc::RTCIceCandidatePairStats>();
+        }
+    }
+    return nullptr;
+}
+
+// The fields of one RTCStatsReport that are exported. Negative values are
+// not reported by WebRTC yet.
+struct ConnectionStats {
+    std::string candidate_pair_state;
+    double round_trip_time_s = -1;
+    double available_outgoing_bitrate_bps = -1;
+    uint64_t transport_bytes_sent = 0;
+    uint64_t transport_bytes_received = 0;
+    uint64_t data_channel_messages_sent = 0;
+    uint64_t data_channel_messages_received = 0;
+    uint64_t data_channel_bytes_sent = 0;
+    uint64_t data_channel_bytes_received = 0;
+
+    static ConnectionStats FromReport(const webrtc::RTCStatsReport &report) {
+        ConnectionStats stats;
+        const webrtc::RTCIceCandidatePairStats *pair =
+                FindSelectedCandidatePair(report);
+        if (pair != nullptr) {
+            stats.candidate_pair_state = pair->state.ValueOrDefault("");
+            stats.round_trip_time_s =
+                    pair->current_round_trip_time.ValueOrDefault(-1);
+            stats.available_outgoing_bitrate_bps =
+                    pair->available_outgoing_bitrate.ValueOrDefault(-1);
+            stats.transport_bytes_sent = pair->bytes_sent.ValueOrDefault(0);
+            stats.transport_bytes_received =
+                    pair->bytes_received.ValueOrDefault(0);
+        }
+        for (const webrtc::RTCDataChannelStats *channel :
+             report.GetStatsOfType<webrtc::RTCDataChannelStats>()) {
+            stats.data_channel_messages_sent +=
+                    channel->messages_sent.ValueOrDefault(0);
+            stats.data_channel_messages_received +=
+                    channel->messages_received.ValueOrDefault(0);
+            stats.data_channel_bytes_sent +=
+                    channel->bytes_sent.ValueOrDefault(0);
+            stats.data_channel_bytes_received +=
+                    channel->bytes_received.ValueOrDefault(0);
+        }
+        return stats;
+    }
+};
+
+// Polls GetStats() of every registered PeerConnection at a fixed interval and
+// keeps the last ConnectionStats of each, rendered on demand in the
+// Prometheus text format.
+//
+// Polling is asynchronous: a tick starts the GetStats() requests, the
+// reports are reduced to ConnectionStats on the signaling threads, and a
+// connection whose previous request is still pending is skipped. A request
+// unanswered for kPendingTimeoutIntervals intervals, e.g. because the
+// connection closed meanwhile, is given up. Scrapes read the cached values
+// and never wait for WebRTC.
+class StatsExporter {
+public:
+    StatsExporter(uint32_t interval_ms)
+        : interval_ms_(interval_ms),
+          state_(std::make_shared<State>()),
+          poll_thread_(rtc::Thread::Create()) {
+        poll_thread_->SetName("stats_exporter", nullptr);
+    }
+
+    ~StatsExporter() { stop(); }
+
+    // |name| labels the metrics of the connection. Remove the connection
+    // before closing it.
+    void add(const std::string &name,
+             rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc) {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->connections[name].peer_connection = pc;
+    }
+
+    void remove(const std::string &name) {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->connections.erase(name);
+    }
+
+    void start() {
+        poll_thread_->Start();
+        poll_thread_->PostTask(RTC_FROM_HERE, [this]() { poll(); });
+    }
+
+    // Stop polling and release every connection.
+    void stop() {
+        poll_thread_->Stop();
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->connections.clear();
+    }
+
+    std::string render() const {
+        struct Metric {
+            const char *name;
+            const char *type;
+            const char *help;
+            double (*value)(const ConnectionStats &);
+        };
+        static const Metric kMetrics[] = {
+                {"webrtc_candidate_pair_round_trip_time_seconds", "gauge",
+                 "currentRoundTripTime of the selected candidate pair.",
+                 [](const ConnectionStats &s) { return s.round_trip_time_s; }},
+                {"webrtc_candidate_pair_available_outgoing_bitrate_bps",
+                 "gauge",
+                 "availableOutgoingBitrate of the selected candidate pair.",
+                 [](const ConnectionStats &s) {
+                     return s.available_outgoing_bitrate_bps;
+                 }},
+                {"webrtc_candidate_pair_bytes_sent_total", "counter",
+                 "Bytes sent on the selected candidate pair.",
+                 [](const ConnectionStats &s) {
+                     return double(s.transport_bytes_sent);
+                 }},
+                {"webrtc_candidate_pair_bytes_received_total", "counter",
+                 "Bytes received on the selected candidate pair.",
+                 [](const ConnectionStats &s) {
+                     return double(s.transport_bytes_received);
+                 }},
+                {"webrtc_data_channel_messages_sent_total", "counter",
+                 "Messages sent on all DataChannels.",
+                 [](const ConnectionStats &s) {
+                     return double(s.data_channel_messages_sent);
+                 }},
+                {"webrtc_data_channel_messages_received_total", "counter",
+                 "Messages received on all DataChannels.",
+                 [](const ConnectionStats &s) {
+                     return double(s.data_channel_messages_received);
+                 }},
+                {"webrtc_data_channel_bytes_sent_total", "counter",
+                 "Payload bytes sent on all DataChannels.",
+                 [](const ConnectionStats &s) {
+                     return double(s.data_channel_bytes_sent);
+                 }},
+                {"webrtc_data_channel_bytes_received_total", "counter",
+                 "Payload bytes received on all DataChannels.",
+                 [](const ConnectionStats &s) {
+                     return double(s.data_channel_bytes_received);
+                 }},
+        };
+
+        std::map<std::string, ConnectionStats> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            for (const auto &entry : state_->connections) {
+                if (entry.second.has_stats) {
+                    snapshot.emplace(entry.first, entry.second.stats);
+                }
+            }
+        }
+
+        std::ostringstream out;
+        // Keep byte counters exact.
+        out.precision(15);
+        out << "# HELP webrtc_connections Connections with stats.\n"
+            << "# TYPE webrtc_connections gauge\n"
+            << "webrtc_connections " << snapshot.size() << "\n";
+        for (const Metric &metric : kMetrics) {
+            out << "# HELP " << metric.name << " " << metric.help << "\n"
+                << "# TYPE " << metric.name << " " << metric.type << "\n";
+            for (const auto &entry : snapshot) {
+                const double value = metric.value(entry.second);
+                if (value < 0) {
+                    continue;
+                }
+                out << metric.name << "{connection=\""
+                    << EscapeLabel(entry.first) << "\"} " << value << "\n";
+            }
+        }
+        out << "# HELP webrtc_candidate_pair_state State of the selected "
+               "candidate pair.\n"
+            << "# TYPE webrtc_candidate_pair_state gauge\n";
+        for (const auto &entry : snapshot) {
+            if (entry.second.candidate_pair_state.empty()) {
+                continue;
+            }
+            out << "webrtc_candidate_pair_state{connection=\""
+                << EscapeLabel(entry.first) << "\",state=\""
+                << entry.second.candidate_pair_state << "\"} 1\n";
+        }
+        return out.str();
+    }
+
+private:
+    struct Entry {
+        rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection;
+        bool pending = false;
+        // Start of the pending request, and its number; only the answer to
+        // the latest request clears |pending|.
+        int64_t pending_since_ms = 0;
+        uint64_t request = 0;
+        bool has_stats = false;
+        ConnectionStats stats;
+    };
+
+    // Shared with the pending callbacks, which may outlive the exporter.
+    struct State {
+        std::mutex mutex;
+        std::map<std::string, Entry> connections;
+    };
+
+    class Callback : public webrtc::RTCStatsCollectorCallback {
+    public:
+        Callback(std::shared_ptr<State> state,
+                 const std::string &name,
+                 uint64_t request)
+            : state_(state), name_(name), request_(request) {}
+
+        void OnStatsDelivered(
+                const rtc::scoped_refptr<const webrtc::RTCStatsReport> &report)
+                override {
+            const ConnectionStats stats = ConnectionStats::FromReport(*report);
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            const auto it = state_->connections.find(name_);
+            if (it == state_->connections.end()) {
+                return;
+            }
+            if (it->second.request == request_) {
+                it->second.pending = false;
+            }
+            it->second.has_stats = true;
+            it->second.stats = stats;
+        }
+
+    private:
+        std::shared_ptr<State> state_;
+        const std::string name_;
+        const uint64_t request_;
+    };
+
+    static constexpr int64_t kPendingTimeoutIntervals = 5;
+
+    void poll() {
+        struct Request {
+            std::string name;
+            uint64_t request;
+            rtc::scoped_refptr<webrtc::PeerConnectionInterface>
+                    peer_connection;
+        };
+        std::vector<Request> to_poll;
+        const int64_t now_ms = rtc::TimeMillis();
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            for (auto &entry : state_->connections) {
+                Entry &connection = entry.second;
+                if (!connection.peer_connection ||
+                    (connection.pending &&
+                     now_ms - connection.pending_since_ms <
+                             kPendingTimeoutIntervals * interval_ms_)) {
+                    continue;
+                }
+                connection.pending = true;
+                connection.pending_since_ms = now_ms;
+                ++connection.request;
+                to_poll.push_back({entry.first, connection.request,
+                                   connection.peer_connection});
+            }
+        }
+        // The proxy runs GetStats() on the signaling thread of each
+        // connection and waits for it; the report arrives later, on that
+        // thread.
+        for (const Request &request : to_poll) {
+            request.peer_connection->GetStats(
+                    new rtc::RefCountedObject<Callback>(state_, request.name,
+                                                        request.request));
+        }
+        poll_thread_->PostDelayedTask(
+                RTC_FROM_HERE, [this]() { poll(); }, interval_ms_);
+    }
+
+    static std::string EscapeLabel(const std::string &value) {
+        std::string escaped;
+        for (const char c : value) {
+            if (c == '\\' || c == '"') {
+                escaped += '\\';
+                escaped += c;
+            } else if (c == '\n') {
+                escaped += "\\n";
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    const uint32_t interval_ms_;
+    std::shared_ptr<State> state_;
+    std::unique_ptr<rtc::Thread> poll_thread_;
+};
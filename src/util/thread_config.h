@@ -0,0 +1,203 @@
+#pragma once
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <rtc_base/thread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Placement of one of the threads WebRTCManager::init() starts. The
+// defaults leave the thread as the system starts it.
+struct ThreadConfig {
+    // Shown by top -H, perf and gdb; Linux keeps the first 15 characters.
+    // WebRTCManager names its threads after itself when empty.
+    std::string name;
+
+    // CPUs the thread may run on; empty for any.
+    std::vector<int> cpus;
+
+    // NUMA node to run the thread on and allocate its memory from. Without
+    // |cpus| the thread may run on any CPU of the node. Best effort: a node
+    // the kernel does not list, e.g. node 0 without NUMA support, leaves the
+    // thread where it is.
+    int numa_node = -1;
+
+    // SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO or SCHED_RR; -1 keeps
+    // the policy. The real-time ones need CAP_SYS_NICE.
+    int policy = -1;
+
+    // 1 to 99 with SCHED_FIFO and SCHED_RR, otherwise the nice value, from
+    // -20 to 19. Lowering it needs CAP_SYS_NICE.
+    int priority = 0;
+};
+
+// Parses a CPU list like "0-3,8,10-11", the format of taskset -c and
+// /sys/devices/system/cpu/online.
+inline std::vector<int> ParseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        int first = -1;
+        int last = -1;
+        const int fields = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (fields == 1) {
+            last = first;
+        }
+        if (fields < 1 || range.find_first_not_of("0123456789-") !=
+                                  std::string::npos ||
+            first < 0 || last < first || last >= CPU_SETSIZE) {
+            throw std::runtime_error("Invalid CPU list: " + list);
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// Online NUMA nodes, {0} where the kernel reports none.
+inline std::vector<int> NumaNodes() {
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string list;
+    if (!std::getline(online, list) || list.empty()) {
+        return {0};
+    }
+    return ParseCpuList(list);
+}
+
+// CPUs of NUMA node |node|; empty when it does not exist.
+inline std::vector<int> NumaNodeCpus(int node) {
+    std::ifstream cpulist("/sys/devices/system/node/node" +
+                          std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!std::getline(cpulist, list)) {
+        return {};
+    }
+    return ParseCpuList(list);
+}
+
+// Policy named |name|: other, batch, idle, fifo or rr.
+inline int ParseSchedulingPolicy(const std::string &name) {
+    if (name == "other") {
+        return SCHED_OTHER;
+    } else if (name == "batch") {
+        return SCHED_BATCH;
+    } else if (name == "idle") {
+        return SCHED_IDLE;
+    } else if (name == "fifo") {
+        return SCHED_FIFO;
+    } else if (name == "rr") {
+        return SCHED_RR;
+    }
+    throw std::runtime_error("Unknown scheduling policy: " + name);
+}
+
+// Apply |config| to the calling thread. Returns an error message, empty on
+// success.
+inline std::string ConfigureCurrentThread(const ThreadConfig &config) {
+    std::vector<int> cpus = config.cpus;
+    if (config.numa_node >= 0) {
+        if (cpus.empty()) {
+            cpus = NumaNodeCpus(config.numa_node);
+        }
+        // Best effort: kernels without NUMA support refuse the policy, and
+        // their memory is local anyway.
+        std::vector<unsigned long> nodes(config.numa_node / 64 + 1);
+        nodes[config.numa_node / 64] |= 1ul << (config.numa_node % 64);
+        ::syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes.data(),
+                  nodes.size() * 64 + 1);
+    }
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            CPU_SET(cpu, &set);
+        }
+        const int error =
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (error != 0) {
+            return std::string("CPU affinity: ") + strerror(error);
+        }
+    }
+    const bool real_time =
+            config.policy == SCHED_FIFO || config.policy == SCHED_RR;
+    if (config.policy >= 0) {
+        sched_param param;
+        param.sched_priority = real_time ? config.priority : 0;
+        const int error =
+                pthread_setschedparam(pthread_self(), config.policy, &param);
+        if (error != 0) {
+            return std::string("scheduling policy: ") + strerror(error);
+        }
+    }
+    if (!real_time && config.priority != 0) {
+        // The nice value of a thread is set through its thread id.
+        if (setpriority(PRIO_PROCESS, ::syscall(SYS_gettid),
+                        config.priority) != 0) {
+            return std::string("nice value: ") + strerror(errno);
+        }
+    }
+    return "";
+}
+
+// Apply |config| to the running |thread|, from within it.
+inline void ConfigureThread(rtc::Thread *thread, const ThreadConfig &config) {
+    const std::string error = thread->Invoke<std::string>(
+            RTC_FROM_HERE,
+            [&config]() { return ConfigureCurrentThread(config); });
+    if (!error.empty()) {
+        throw std::runtime_error("Failed to configure thread " +
+                                 thread->name() + ": " + error);
+    }
+}
+
+// Name |thread| after |config| or |default_name|, start it and apply
+// |config|.
+inline void StartThread(rtc::Thread *thread,
+                        const ThreadConfig &config,
+                        const std::string &default_name) {
+    thread->SetName(config.name.empty() ? default_name : config.name,
+                    nullptr);
+    thread->Start();
+    ConfigureThread(thread, config);
+}
+
+// Runtime settings for the client and server, e.g. for the network thread
+// with |prefix| WEBRTC_NETWORK: WEBRTC_NETWORK_NAME, WEBRTC_NETWORK_CPUS (a
+// CPU list), WEBRTC_NETWORK_NUMA_NODE, WEBRTC_NETWORK_POLICY (other, batch,
+// idle, fifo or rr) and WEBRTC_NETWORK_PRIORITY.
+inline ThreadConfig ThreadConfigFromEnv(const std::string &prefix) {
+    ThreadConfig config;
+    if (const char *value = std::getenv((prefix + "_NAME").c_str())) {
+        config.name = value;
+    }
+    if (const char *value = std::getenv((prefix + "_CPUS").c_str())) {
+        config.cpus = ParseCpuList(value);
+    }
+    if (const char *value = std::getenv((prefix + "_NUMA_NODE").c_str())) {
+        config.numa_node = std::atoi(value);
+    }
+    if (const char *value = std::getenv((prefix + "_POLICY").c_str())) {
+        config.policy = ParseSchedulingPolicy(value);
+    }
+    if (const char *value = std::getenv((prefix + "_PRIORITY").c_str())) {
+        config.priority = std::atoi(value);
+    }
+    return config;
+}
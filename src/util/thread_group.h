@@ -0,0 +1,125 @@
+#pragma once
+
+#include <rtc_base/socket_server.h>
+#include <rtc_base/thread.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "util/thread_config.h"
+#include "util/webrtc_manager.h"
+
+// Network, worker and signaling threads shared by several WebRTCManagers.
+// With a NUMA node, all three run on that node and allocate from its
+// memory, so a connection's packets, crypto and callbacks never cross
+// nodes. Outlives the managers attached.
+class RtcThreadGroup {
+public:
+    // |config| is applied to the three threads, with |numa_node| and the
+    // names derived from |name|. |create_socket_server| works as
+    // WebRTCManager::create_socket_server.
+    RtcThreadGroup(const std::string &name,
+                   int numa_node = -1,
+                   const ThreadConfig &config = ThreadConfig(),
+                   std::function<std::unique_ptr<rtc::SocketServer>()>
+                           create_socket_server = nullptr)
+        : numa_node_(numa_node) {
+        network_thread_ = create_socket_server
+                                  ? std::unique_ptr<rtc::Thread>(
+                                            new rtc::Thread(
+                                                    create_socket_server()))
+                                  : rtc::Thread::CreateWithSocketServer();
+        worker_thread_ = rtc::Thread::Create();
+        signaling_thread_ = rtc::Thread::Create();
+        ThreadConfig placed = config;
+        placed.numa_node = numa_node;
+        placed.name.clear();
+        StartThread(network_thread_.get(), placed, name + "_network");
+        StartThread(worker_thread_.get(), placed, name + "_worker");
+        StartThread(signaling_thread_.get(), placed, name + "_signaling");
+    }
+
+    ~RtcThreadGroup() {
+        signaling_thread_->Stop();
+        worker_thread_->Stop();
+        network_thread_->Stop();
+    }
+
+    // Run |manager| on the group's threads. Call before manager.init().
+    void attach(WebRTCManager &manager) {
+        manager.external_network_thread = network_thread_.get();
+        manager.external_worker_thread = worker_thread_.get();
+        manager.external_signaling_thread = signaling_thread_.get();
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++connections_;
+    }
+
+    // Forget a manager attached before, once it quit.
+    void detach() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --connections_;
+    }
+
+    size_t connections() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return connections_;
+    }
+
+    int numa_node() const { return numa_node_; }
+    rtc::Thread *network_thread() { return network_thread_.get(); }
+    rtc::Thread *worker_thread() { return worker_thread_.get(); }
+    rtc::Thread *signaling_thread() { return signaling_thread_.get(); }
+
+private:
+    const int numa_node_;
+    std::unique_ptr<rtc::Thread> network_thread_;
+    std::unique_ptr<rtc::Thread> worker_thread_;
+    std::unique_ptr<rtc::Thread> signaling_thread_;
+    mutable std::mutex mutex_;
+    size_t connections_ = 0;
+};
+
+// One RtcThreadGroup per NUMA node of the host. Each connection goes to the
+// node with the fewest, keeping its threads together while spreading the
+// connections over the nodes.
+class NumaThreadGroups {
+public:
+    NumaThreadGroups(const std::string &name,
+                     const ThreadConfig &config = ThreadConfig(),
+                     std::function<std::unique_ptr<rtc::SocketServer>()>
+                             create_socket_server = nullptr) {
+        for (int node : NumaNodes()) {
+            groups_.emplace_back(new RtcThreadGroup(
+                    name + std::to_string(node), node, config,
+                    create_socket_server));
+        }
+    }
+
+    // Run |manager| on the least loaded node. Returns its group, to
+    // detach() the manager from once it quit.
+    RtcThreadGroup &attach(WebRTCManager &manager) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        RtcThreadGroup *group =
+                std::min_element(groups_.begin(), groups_.end(),
+                                 [](const std::unique_ptr<RtcThreadGroup> &a,
+                                    const std::unique_ptr<RtcThreadGroup> &b) {
+                                     return a->connections() <
+                                            b->connections();
+                                 })
+                        ->get();
+        group->attach(manager);
+        return *group;
+    }
+
+    const std::vector<std::unique_ptr<RtcThreadGroup>> &groups() const {
+        return groups_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<RtcThreadGroup>> groups_;
+};
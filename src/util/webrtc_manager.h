@@ -1,30 +1,59 @@
 #pragma once
 #include <api/create_peerconnection_factory.h>
+#include <api/rtc_event_log/rtc_event_log_factory.h>
+#include <api/task_queue/default_task_queue_factory.h>
+#include <malloc.h>
+#include <p2p/base/basic_packet_socket_factory.h>
+#include <p2p/base/port_allocator.h>
+#include <p2p/client/basic_port_allocator.h>
+#include <rtc_base/network.h>
 #include <rtc_base/ssl_adapter.h>
+#include <rtc_base/task_utils/repeating_task.h>
 #include <rtc_base/thread.h>
 #include <system_wrappers/include/field_trial.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
 #include <exception>
+#include <future>
 #include <iostream>
-
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/chrome_tracer.h"
+#include "util/connection_trace.h"
 #include "util/json_utils.h"
+#include "util/memory_accounting.h"
+#include "util/operation.h"
+#include "util/rtc_event_log_recorder.h"
+#include "util/socket_config.h"
+#include "util/thread_config.h"
 
 struct Ice {
     std::string candidate;
     std::string sdp_mid;
     int sdp_mline_index;
 
-    std::string ToJsonString() const {
+    Json::Value ToJson() const {
         Json::Value json;
         json["type"] = "ice";
         json["candidate"] = this->candidate;
         json["sdpMid"] = this->sdp_mid;
         json["sdpMLineIndex"] = this->sdp_mline_index;
-        return JsonToString(json);
+        return json;
     }
 
-    static Ice FromJsonString(const std::string &json_str) {
-        const Json::Value json = StringToJson(json_str);
+    std::string ToJsonString() const { return JsonToString(ToJson()); }
+
+    static Ice FromJson(const Json::Value &json) {
         const std::string type = json.get("type", "").asString();
         if (type == "ice") {
             const std::string candidate = json.get("candidate", "").asString();
@@ -42,6 +71,118 @@ struct Ice {
             throw std::runtime_error("Unkown json message type: " + type);
         }
     }
+
+    static Ice FromJsonString(const std::string &json_str) {
+        return FromJson(StringToJson(json_str));
+    }
+
+    // A batch of candidates is sent as one "ice_batch" message whose
+    // "candidates" array holds regular "ice" objects.
+    static std::string ToJsonString(const std::vector<Ice> &ices) {
+        Json::Value json;
+        json["type"] = "ice_batch";
+        json["candidates"] = Json::Value(Json::arrayValue);
+        for (const Ice &ice : ices) {
+            json["candidates"].append(ice.ToJson());
+        }
+        return JsonToString(json);
+    }
+
+    static std::vector<Ice> FromJsonBatch(const Json::Value &json) {
+        const std::string type = json.get("type", "").asString();
+        if (type != "ice_batch") {
+            throw std::runtime_error("Unkown json message type: " + type);
+        }
+        std::vector<Ice> ices;
+        for (const Json::Value &candidate : json["candidates"]) {
+            ices.push_back(FromJson(candidate));
+        }
+        return ices;
+    }
+};
+
+// Settings of a connection while it is idle, see
+// WebRTCManager::enable_idle_mode(). Both peers should use the same values,
+// since each one expects the other's checks within its receiving timeout.
+struct IdleConfig {
+    // Time without DataChannel traffic before the connection goes idle.
+    int quiet_period_ms = 60000;
+
+    // Interval of the ICE checks on the selected pair, and the time without
+    // any packet before the pair is no longer receiving.
+    int ping_interval_ms = 10000;
+    int receiving_timeout_ms = 30000;
+
+    // Backup candidate pairs are checked this rarely, so they become
+    // unwritable, then inactive, and are pruned.
+    int backup_ping_interval_ms = 300000;
+
+    // Refresh interval of the STUN bindings behind server-reflexive
+    // candidates.
+    int stun_keepalive_interval_ms = 300000;
+
+    // Shortest time between two malloc_trim() calls of the process. Each
+    // walks the whole heap, and connections often go idle together.
+    int trim_interval_ms = 10000;
+};
+
+// malloc_trim(0), unless the process trimmed less than |interval_ms| ago.
+inline void TrimHeap(int interval_ms) {
+    static std::atomic<int64_t> last_trim_ms{-1};
+    const int64_t now_ms = rtc::TimeMillis();
+    int64_t last_ms = last_trim_ms.load();
+    if ((last_ms >= 0 && now_ms - last_ms < interval_ms) ||
+        !last_trim_ms.compare_exchange_strong(last_ms, now_ms)) {
+        return;
+    }
+    malloc_trim(0);
+}
+
+// Recovery of a connection whose network path breaks, see
+// WebRTCManager::enable_ice_restart().
+struct IceRestartConfig {
+    // Time without any packet on the selected pair before ICE reports the
+    // connection disconnected. WebRTC's default is 2500.
+    int receiving_timeout_ms = 1000;
+
+    // Time a disconnected connection gets to come back by itself before the
+    // offerer restarts ICE. A failed connection restarts at once.
+    int disconnected_grace_ms = 500;
+
+    // Time each restart gets to reconnect before the next one, and the
+    // restarts before the session fails with kIceRestartFailed. An attempt
+    // sends no new offer while the previous one awaits its answer.
+    int attempt_timeout_ms = 5000;
+    int max_attempts = 5;
+};
+
+// Path losses of a connection and their recovery. Durations are -1 when
+// unknown.
+struct IceRecoveryStats {
+    // ICE reported the connection disconnected or failed.
+    uint64_t path_losses = 0;
+    // Of those, paths back by themselves or after a restart.
+    uint64_t recoveries = 0;
+    // ICE restarts sent by the offerer.
+    uint64_t restarts = 0;
+    // Of the last loss: time since the last DataChannel message received
+    // when ICE reported it, the detection time under continuous traffic.
+    int64_t last_detection_ms = -1;
+    // Of the last recovery: time since the loss, and since the offerer's
+    // first restart.
+    int64_t last_recovery_ms = -1;
+    int64_t last_restart_ms = -1;
+
+    Json::Value ToJson() const {
+        Json::Value json;
+        json["path_losses"] = Json::UInt64(path_losses);
+        json["recoveries"] = Json::UInt64(recoveries);
+        json["restarts"] = Json::UInt64(restarts);
+        json["last_detection_ms"] = Json::Int64(last_detection_ms);
+        json["last_recovery_ms"] = Json::Int64(last_recovery_ms);
+        json["last_restart_ms"] = Json::Int64(last_restart_ms);
+        return json;
+    }
 };
 
 class Connection {
@@ -54,27 +195,134 @@ public:
     std::function<void(const std::string &)> on_sdp;
     std::function<void()> on_accept_ice;
     std::function<void(const Ice &)> on_ice;
+    std::function<void(const std::vector<Ice> &)> on_ice_batch;
     std::function<void()> on_success;
     std::function<void(const std::string &)> on_message;
+    // Called with true when the connection goes idle, false when it resumes.
+    std::function<void(bool)> on_idle_change;
+    // Called when the DataChannel has closed.
+    std::function<void()> on_close;
+    // Called when the DataChannel has sent queued data, with the previous
+    // buffered amount.
+    std::function<void(uint64_t)> on_buffered_amount_change;
+    // Called once when an error fails the session, see fail().
+    std::function<void(const OperationError &)> on_error;
+    // Called with false when the network path is lost, true once it is
+    // back. Only with ICE restart enabled.
+    std::function<void(bool)> on_path_change;
 
     // When the status of the DataChannel changes, determine if the connection
     // is complete.
     void on_state_change() {
+        TRACE_EVENT0("webrtc_manager", "Connection::on_state_change");
         std::cout << "on_state_change state: " << data_channel->state()
                   << std::endl;
+        trace.record(std::string("data_channel_state(") +
+                     webrtc::DataChannelInterface::DataStateString(
+                             data_channel->state()) +
+                     ")");
         if (data_channel->state() == webrtc::DataChannelInterface::kOpen &&
             on_success) {
+            TRACE_EVENT0("app", "on_success");
             on_success();
         }
+        if (data_channel->state() == webrtc::DataChannelInterface::kClosed) {
+            closed = true;
+            notify_drain();
+            if (on_close) {
+                TRACE_EVENT0("app", "on_close");
+                on_close();
+            }
+        }
+    }
+
+    // Wake up WebRTCManager::drain() to check |buffered_amount| and
+    // |closed|.
+    void notify_drain() {
+        std::lock_guard<std::mutex> lock(drain_mutex);
+        drain_cv.notify_all();
+    }
+
+    // Track a new operation until finish() or fail(). Cancelled at once when
+    // the session already failed.
+    std::shared_ptr<Operation> begin_operation(const std::string &name) {
+        std::shared_ptr<Operation> operation =
+                std::make_shared<Operation>(name);
+        std::lock_guard<std::mutex> lock(operations_mutex);
+        operations.erase(
+                std::remove_if(operations.begin(), operations.end(),
+                               [](const std::shared_ptr<Operation> &pending) {
+                                   return pending->done();
+                               }),
+                operations.end());
+        if (failed) {
+            operation->complete(OperationError(OperationErrorCode::kCancelled,
+                                               "the session failed"));
+        } else {
+            operations.push_back(operation);
+        }
+        return operation;
+    }
+
+    // Complete |operation| with |error|, unless its deadline or the session
+    // completed it first. A fatal error fails the session.
+    void finish(const std::shared_ptr<Operation> &operation,
+                const OperationError &error) {
+        if (!operation->complete(error) || error.ok()) {
+            return;
+        }
+        std::cout << name << ":" << std::this_thread::get_id() << ":"
+                  << operation->name() << " failed: " << error.ToString()
+                  << std::endl;
+        trace.record("operation_failed(" + operation->name() + ")");
+        if (error.fatal()) {
+            fail(error);
+        }
+    }
+
+    // Give up on the session: cancel the operations in flight, close the
+    // PeerConnection to release its sockets and pending work, and report
+    // |error| to on_error. Other sessions on the same threads go on.
+    void fail(const OperationError &error) {
+        if (failed.exchange(true)) {
+            return;
+        }
+        cancel_operations(OperationError(OperationErrorCode::kCancelled,
+                                         error.ToString()));
+        trace.record("session_failed");
+        if (peer_connection) {
+            peer_connection->Close();
+        }
+        if (on_error) {
+            TRACE_EVENT0("app", "on_error");
+            on_error(error);
+        }
+    }
+
+    void cancel_operations(const OperationError &error) {
+        std::vector<std::shared_ptr<Operation>> pending;
+        {
+            std::lock_guard<std::mutex> lock(operations_mutex);
+            pending.swap(operations);
+        }
+        for (const std::shared_ptr<Operation> &operation : pending) {
+            operation->complete(error);
+        }
     }
 
     // After the SDP is successfully created, it is set as a LocalDescription
-    // and displayed as a string to be passed to the other party.
-    void on_success_csd(webrtc::SessionDescriptionInterface *desc) {
-        peer_connection->SetLocalDescription(ssdo, desc);
+    // and displayed as a string to be passed to the other party. Setting it
+    // completes |operation|.
+    void on_success_csd(webrtc::SessionDescriptionInterface *desc,
+                        const std::shared_ptr<Operation> &operation) {
+        TRACE_EVENT0("webrtc_manager", "Connection::on_success_csd");
+        trace.record("create_description_success");
+        peer_connection->SetLocalDescription(
+                new rtc::RefCountedObject<SSDO>(*this, operation, true), desc);
 
         std::string sdp;
         desc->ToString(&sdp);
+        TRACE_EVENT0("app", "on_sdp");
         on_sdp(sdp);
     }
 
@@ -84,7 +332,222 @@ public:
         candidate->ToString(&ice.candidate);
         ice.sdp_mid = candidate->sdp_mid();
         ice.sdp_mline_index = candidate->sdp_mline_index();
-        on_ice(ice);
+        trace.record("local_ice_candidate");
+        if (!on_ice_batch) {
+            TRACE_EVENT0("app", "on_ice");
+            on_ice(ice);
+            return;
+        }
+
+        // Coalesce candidates gathered within the batch window. The first
+        // candidate of a batch arms the flush timer on the signaling thread,
+        // where all the observer callbacks run.
+        pending_ice.push_back(ice);
+        if (pending_ice.size() == 1) {
+            rtc::Thread::Current()->PostDelayedTask(
+                    RTC_FROM_HERE,
+                    [this]() {
+                        ScopedMemoryAccount scope(memory_account);
+                        flush_ice();
+                    },
+                    ice_batch_window_ms);
+        }
+    }
+
+    // Record DataChannel traffic. Leaves idle mode when called on the
+    // signaling thread; send() posts exit_idle() there instead.
+    void on_activity() {
+        last_activity_ms = rtc::TimeMillis();
+        if (idle && rtc::Thread::Current() == signaling_thread) {
+            exit_idle();
+        }
+    }
+
+    // Enter idle mode if the quiet period has passed. Runs on the signaling
+    // thread.
+    void check_idle() {
+        if (idle || !idle_config || !peer_connection || !data_channel ||
+            data_channel->state() != webrtc::DataChannelInterface::kOpen ||
+            rtc::TimeMillis() - last_activity_ms <
+                    idle_config->quiet_period_ms) {
+            return;
+        }
+        active_configuration = peer_connection->GetConfiguration();
+        webrtc::PeerConnectionInterface::RTCConfiguration idle_configuration =
+                active_configuration;
+        idle_configuration.ice_check_interval_strong_connectivity =
+                idle_config->ping_interval_ms;
+        idle_configuration.ice_connection_receiving_timeout =
+                idle_config->receiving_timeout_ms;
+        idle_configuration.ice_backup_candidate_pair_ping_interval =
+                idle_config->backup_ping_interval_ms;
+        idle_configuration.stun_candidate_keepalive_interval =
+                idle_config->stun_keepalive_interval_ms;
+        const webrtc::RTCError error =
+                peer_connection->SetConfiguration(idle_configuration);
+        if (!error.ok()) {
+            std::cout << name << ":" << std::this_thread::get_id() << ":"
+                      << "Error on SetConfiguration for idle mode." << std::endl
+                      << error.message() << std::endl;
+            return;
+        }
+        idle = true;
+        trace.record("idle");
+
+        // Release what the connection caches, and hand the freed pages back
+        // to the system.
+        std::vector<Ice>().swap(pending_ice);
+        if (on_idle_change) {
+            TRACE_EVENT0("app", "on_idle_change");
+            on_idle_change(true);
+        }
+        TrimHeap(idle_config->trim_interval_ms);
+    }
+
+    // Restore the configuration in use before idle mode. Stays idle if it
+    // fails, so the next activity tries again. Runs on the signaling thread.
+    void exit_idle() {
+        if (!idle) {
+            return;
+        }
+        const webrtc::RTCError error =
+                peer_connection->SetConfiguration(active_configuration);
+        if (!error.ok()) {
+            std::cout << name << ":" << std::this_thread::get_id() << ":"
+                      << "Error on SetConfiguration for active mode."
+                      << std::endl
+                      << error.message() << std::endl;
+            return;
+        }
+        idle = false;
+        trace.record("active");
+        if (on_idle_change) {
+            TRACE_EVENT0("app", "on_idle_change");
+            on_idle_change(false);
+        }
+    }
+
+    // ICE reported the connection disconnected, or |ice_failed|. The offerer
+    // restarts ICE once the grace period passes, the answerer waits for its
+    // new offer. Runs on the signaling thread.
+    void on_path_lost(bool ice_failed) {
+        if (!ice_restart_config || failed) {
+            return;
+        }
+        if (path_lost_ms < 0) {
+            path_lost_ms = rtc::TimeMillis();
+            trace.record("path_lost");
+            {
+                std::lock_guard<std::mutex> lock(ice_recovery_mutex);
+                ++ice_recovery.path_losses;
+                ice_recovery.last_detection_ms =
+                        last_receive_ms >= 0 ? path_lost_ms - last_receive_ms
+                                             : -1;
+            }
+            if (on_path_change) {
+                TRACE_EVENT0("app", "on_path_change");
+                on_path_change(false);
+            }
+        }
+        // Restarts already running see the connection fail in between.
+        if (!offerer || restart_started_ms >= 0) {
+            return;
+        }
+        restart_task.Stop();
+        restart_task = webrtc::RepeatingTaskHandle::DelayedStart(
+                signaling_thread,
+                webrtc::TimeDelta::Millis(
+                        ice_failed ? 0
+                                   : ice_restart_config->disconnected_grace_ms),
+                [this]() { return restart_ice(); });
+    }
+
+    // ICE reported the connection connected again. Runs on the signaling
+    // thread.
+    void on_path_restored() {
+        if (path_lost_ms < 0) {
+            return;
+        }
+        restart_task.Stop();
+        const int64_t now_ms = rtc::TimeMillis();
+        IceRecoveryStats stats;
+        {
+            std::lock_guard<std::mutex> lock(ice_recovery_mutex);
+            ++ice_recovery.recoveries;
+            ice_recovery.last_recovery_ms = now_ms - path_lost_ms;
+            ice_recovery.last_restart_ms = restart_started_ms >= 0
+                                                   ? now_ms - restart_started_ms
+                                                   : -1;
+            stats = ice_recovery;
+        }
+        path_lost_ms = -1;
+        restart_started_ms = -1;
+        restart_attempts = 0;
+        trace.record("path_restored");
+        std::cout << name << ":" << std::this_thread::get_id() << ":"
+                  << "ice_recovery " << JsonToString(stats.ToJson())
+                  << std::endl;
+        if (on_path_change) {
+            TRACE_EVENT0("app", "on_path_change");
+            on_path_change(true);
+        }
+    }
+
+    // Send an offer with new ICE credentials through on_sdp, so both peers
+    // gather and check new candidates on the same PeerConnection, and the
+    // DataChannel carries on. Repeated by |restart_task| until the path is
+    // back. Runs on the signaling thread.
+    webrtc::TimeDelta restart_ice() {
+        if (restart_attempts >= ice_restart_config->max_attempts) {
+            restart_task.Stop();
+            fail(OperationError(OperationErrorCode::kIceRestartFailed,
+                                "no path after " +
+                                        std::to_string(restart_attempts) +
+                                        " ICE restarts"));
+            return webrtc::TimeDelta::Zero();
+        }
+        ++restart_attempts;
+        // A new offer would leave the answer to the previous one stale, and
+        // setting it would then fail the session. Wait for it instead; the
+        // attempt still counts.
+        if (peer_connection->signaling_state() ==
+            webrtc::PeerConnectionInterface::kHaveLocalOffer) {
+            std::cout << name << ":" << std::this_thread::get_id() << ":"
+                      << "ice_restart(" << restart_attempts
+                      << "): awaiting answer" << std::endl;
+            return webrtc::TimeDelta::Millis(
+                    ice_restart_config->attempt_timeout_ms);
+        }
+        if (restart_started_ms < 0) {
+            restart_started_ms = rtc::TimeMillis();
+        }
+        {
+            std::lock_guard<std::mutex> lock(ice_recovery_mutex);
+            ++ice_recovery.restarts;
+        }
+        std::cout << name << ":" << std::this_thread::get_id() << ":"
+                  << "ice_restart(" << restart_attempts << ")" << std::endl;
+        trace.record("ice_restart(" + std::to_string(restart_attempts) + ")");
+        webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
+        options.ice_restart = true;
+        peer_connection->CreateOffer(
+                new rtc::RefCountedObject<CSDO>(*this,
+                                                begin_operation("ice_restart")),
+                options);
+        return webrtc::TimeDelta::Millis(
+                ice_restart_config->attempt_timeout_ms);
+    }
+
+    // Hand the pending candidates over as one batch. Called when the batch
+    // window expires and when gathering completes.
+    void flush_ice() {
+        if (pending_ice.empty()) {
+            return;
+        }
+        std::vector<Ice> batch;
+        batch.swap(pending_ice);
+        TRACE_EVENT0("app", "on_ice_batch");
+        on_ice_batch(batch);
     }
 
     class PCO : public webrtc::PeerConnectionObserver {
@@ -96,9 +559,13 @@ public:
 
         void OnSignalingChange(webrtc::PeerConnectionInterface::SignalingState
                                        new_state) override {
+            TRACE_EVENT0("webrtc_manager",
+                         "PeerConnectionObserver::SignalingChange");
             std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
                       << "PeerConnectionObserver::SignalingChange(" << new_state
                       << ")" << std::endl;
+            parent.trace.record("signaling_state(" +
+                                std::to_string(new_state) + ")");
         };
 
         void OnAddStream(rtc::scoped_refptr<webrtc::MediaStreamInterface>
@@ -115,6 +582,9 @@ public:
 
         void OnDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface>
                                    data_channel) override {
+            TRACE_EVENT0("webrtc_manager",
+                         "PeerConnectionObserver::DataChannel");
+            ScopedMemoryAccount scope(parent.memory_account);
             std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
                       << "PeerConnectionObserver::DataChannel(" << data_channel
                       << ", " << parent.data_channel.get() << ")" << std::endl;
@@ -125,6 +595,8 @@ public:
         };
 
         void OnRenegotiationNeeded() override {
+            TRACE_EVENT0("webrtc_manager",
+                         "PeerConnectionObserver::RenegotiationNeeded");
             std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
                       << "PeerConnectionObserver::RenegotiationNeeded"
                       << std::endl;
@@ -133,21 +605,53 @@ public:
         void OnIceConnectionChange(
                 webrtc::PeerConnectionInterface::IceConnectionState new_state)
                 override {
+            TRACE_EVENT0("webrtc_manager",
+                         "PeerConnectionObserver::IceConnectionChange");
             std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
                       << "PeerConnectionObserver::IceConnectionChange("
                       << new_state << ")" << std::endl;
+            parent.trace.record("ice_connection_state(" +
+                                std::to_string(new_state) + ")");
+            switch (new_state) {
+                case webrtc::PeerConnectionInterface::
+                        kIceConnectionDisconnected:
+                    parent.on_path_lost(false);
+                    break;
+                case webrtc::PeerConnectionInterface::kIceConnectionFailed:
+                    parent.on_path_lost(true);
+                    break;
+                case webrtc::PeerConnectionInterface::kIceConnectionConnected:
+                case webrtc::PeerConnectionInterface::kIceConnectionCompleted:
+                    parent.on_path_restored();
+                    break;
+                default:
+                    break;
+            }
         };
 
         void OnIceGatheringChange(
                 webrtc::PeerConnectionInterface::IceGatheringState new_state)
                 override {
+            TRACE_EVENT0("webrtc_manager",
+                         "PeerConnectionObserver::IceGatheringChange");
+            ScopedMemoryAccount scope(parent.memory_account);
             std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
                       << "PeerConnectionObserver::IceGatheringChange("
                       << new_state << ")" << std::endl;
+            parent.trace.record("ice_gathering_state(" +
+                                std::to_string(new_state) + ")");
+            if (new_state == webrtc::PeerConnectionInterface::
+                                     kIceGatheringComplete &&
+                parent.on_ice_batch) {
+                parent.flush_ice();
+            }
         };
 
         void OnIceCandidate(
                 const webrtc::IceCandidateInterface *candidate) override {
+            TRACE_EVENT0("webrtc_manager",
+                         "PeerConnectionObserver::IceCandidate");
+            ScopedMemoryAccount scope(parent.memory_account);
             std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
                       << "PeerConnectionObserver::IceCandidate" << std::endl;
             parent.on_ice_candidate(candidate);
@@ -162,6 +666,8 @@ public:
         DCO(Connection &parent) : parent(parent) {}
 
         void OnStateChange() override {
+            TRACE_EVENT0("webrtc_manager", "DataChannelObserver::StateChange");
+            ScopedMemoryAccount scope(parent.memory_account);
             std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
                       << "DataChannelObserver::StateChange" << std::endl;
             parent.on_state_change();
@@ -169,82 +675,203 @@ public:
 
         // Message receipt.
         void OnMessage(const webrtc::DataBuffer &buffer) override {
-            std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
-                      << "DataChannelObserver::Message" << std::endl;
+            TRACE_EVENT0("webrtc_manager", "DataChannelObserver::Message");
+            ScopedMemoryAccount scope(parent.memory_account);
+            parent.on_activity();
+            parent.last_receive_ms = rtc::TimeMillis();
+            if (parent.verbose) {
+                std::cout << parent.name << ":" << std::this_thread::get_id()
+                          << ":"
+                          << "DataChannelObserver::Message" << std::endl;
+            }
             if (parent.on_message) {
+                TRACE_EVENT0("app", "on_message");
                 parent.on_message(std::string(buffer.data.data<char>(),
                                               buffer.data.size()));
             }
         };
 
         void OnBufferedAmountChange(uint64_t previous_amount) override {
-            std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
-                      << "DataChannelObserver::BufferedAmountChange("
-                      << previous_amount << ")" << std::endl;
+            TRACE_EVENT0("webrtc_manager",
+                         "DataChannelObserver::BufferedAmountChange");
+            if (parent.verbose) {
+                std::cout << parent.name << ":" << std::this_thread::get_id()
+                          << ":"
+                          << "DataChannelObserver::BufferedAmountChange("
+                          << previous_amount << ")" << std::endl;
+            }
+            if (parent.draining) {
+                parent.buffered_amount = parent.data_channel->buffered_amount();
+                parent.notify_drain();
+            }
+            if (parent.on_buffered_amount_change) {
+                TRACE_EVENT0("app", "on_buffered_amount_change");
+                parent.on_buffered_amount_change(previous_amount);
+            }
         };
     };
 
+    // Observers of one operation each, which they complete.
     class CSDO : public webrtc::CreateSessionDescriptionObserver {
     private:
         Connection &parent;
+        const std::shared_ptr<Operation> operation;
 
     public:
-        CSDO(Connection &parent) : parent(parent) {}
+        CSDO(Connection &parent, std::shared_ptr<Operation> operation)
+            : parent(parent), operation(operation) {}
 
         void OnSuccess(webrtc::SessionDescriptionInterface *desc) override {
+            TRACE_EVENT0("webrtc_manager",
+                         "CreateSessionDescriptionObserver::OnSuccess");
+            if (operation->done()) {
+                // Timed out or cancelled; the session is over.
+                delete desc;
+                return;
+            }
+            ScopedMemoryAccount scope(parent.memory_account);
             std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
                       << "CreateSessionDescriptionObserver::OnSuccess"
                       << std::endl;
-            parent.on_success_csd(desc);
+            parent.on_success_csd(desc, operation);
         };
 
         void OnFailure(webrtc::RTCError error) override {
+            TRACE_EVENT0("webrtc_manager",
+                         "CreateSessionDescriptionObserver::OnFailure");
             std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
                       << "CreateSessionDescriptionObserver::OnFailure"
                       << std::endl
                       << error.message() << std::endl;
+            parent.finish(operation,
+                          OperationError(
+                                  OperationErrorCode::kCreateDescriptionFailed,
+                                  error.message()));
         };
     };
 
+    // Completes its operation on success when |last| is set, i.e. when no
+    // further step follows.
     class SSDO : public webrtc::SetSessionDescriptionObserver {
     private:
         Connection &parent;
+        const std::shared_ptr<Operation> operation;
+        const bool last;
 
     public:
-        SSDO(Connection &parent) : parent(parent) {}
+        SSDO(Connection &parent,
+             std::shared_ptr<Operation> operation,
+             bool last)
+            : parent(parent), operation(operation), last(last) {}
 
         void OnSuccess() override {
+            TRACE_EVENT0("webrtc_manager",
+                         "SetSessionDescriptionObserver::OnSuccess");
+            if (operation->done()) {
+                return;
+            }
+            ScopedMemoryAccount scope(parent.memory_account);
             std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
                       << "SetSessionDescriptionObserver::OnSuccess"
                       << std::endl;
+            parent.trace.record("set_description_success");
+            if (last) {
+                parent.finish(operation, OperationError());
+            }
             if (parent.on_accept_ice) {
+                TRACE_EVENT0("app", "on_accept_ice");
                 parent.on_accept_ice();
             }
         };
 
         void OnFailure(webrtc::RTCError error) override {
+            TRACE_EVENT0("webrtc_manager",
+                         "SetSessionDescriptionObserver::OnFailure");
             std::cout << parent.name << ":" << std::this_thread::get_id() << ":"
                       << "SetSessionDescriptionObserver::OnFailure" << std::endl
                       << error.message() << std::endl;
+            parent.finish(operation,
+                          OperationError(
+                                  OperationErrorCode::kSetDescriptionFailed,
+                                  error.message()));
         };
     };
 
     PCO pco;
     DCO dco;
-    rtc::scoped_refptr<CSDO> csdo;
-    rtc::scoped_refptr<SSDO> ssdo;
+
+    // Candidates waiting for the batch window to expire. Only touched on the
+    // signaling thread.
+    std::vector<Ice> pending_ice;
+    uint32_t ice_batch_window_ms = 0;
+
+    // Timestamps of the signaling and state transitions.
+    ConnectionTrace trace;
+
+    // Log every DataChannel message. Benchmarks turn this off.
+    bool verbose = true;
+
+    // Charged with the allocations of the observer callbacks, when memory
+    // accounting is enabled. Set by WebRTCManager.
+    MemoryAccount *memory_account = nullptr;
+
+    // Operations in flight, see begin_operation(). |failed| is set once an
+    // error failed the session.
+    std::mutex operations_mutex;
+    std::vector<std::shared_ptr<Operation>> operations;
+    std::atomic<bool> failed{false};
+
+    // Idle mode, set up by WebRTCManager::enable_idle_mode(). Apart from
+    // |last_activity_ms| and |idle|, only touched on |signaling_thread|.
+    rtc::Thread *signaling_thread = nullptr;
+    std::unique_ptr<IdleConfig> idle_config;
+    webrtc::RepeatingTaskHandle idle_task;
+    webrtc::PeerConnectionInterface::RTCConfiguration active_configuration;
+    std::atomic<int64_t> last_activity_ms{0};
+    std::atomic<bool> idle{false};
+
+    // Path recovery, set up by WebRTCManager::enable_ice_restart(). Apart
+    // from |ice_recovery|, guarded by |ice_recovery_mutex|, and the atomics,
+    // only touched on |signaling_thread|.
+    std::unique_ptr<IceRestartConfig> ice_restart_config;
+    std::atomic<bool> offerer{false};
+    std::atomic<int64_t> last_receive_ms{-1};
+    int64_t path_lost_ms = -1;
+    int64_t restart_started_ms = -1;
+    int restart_attempts = 0;
+    webrtc::RepeatingTaskHandle restart_task;
+    std::mutex ice_recovery_mutex;
+    IceRecoveryStats ice_recovery;
+
+    // Drain, set up by WebRTCManager::drain(). The observers, on the
+    // signaling thread, mirror the DataChannel's buffered amount and closing
+    // here, so the draining thread never waits on a call to that thread.
+    std::atomic<bool> draining{false};
+    std::atomic<uint64_t> buffered_amount{0};
+    std::atomic<bool> closed{false};
+    std::atomic<uint64_t> rejected_sends{0};
+    std::atomic<uint64_t> rejected_bytes{0};
+    std::mutex drain_mutex;
+    std::condition_variable drain_cv;
 
     Connection(const std::string &name_)
         : name(name_),
           pco(*this),
-          dco(*this),
-          csdo(new rtc::RefCountedObject<CSDO>(*this)),
-          ssdo(new rtc::RefCountedObject<SSDO>(*this)) {}
+          dco(*this) {}
 };
 
 class WebRTCManager {
 public:
-    WebRTCManager(const std::string name_) : name(name_), connection(name_) {}
+    WebRTCManager(const std::string name_) : name(name_), connection(name_) {
+        if (MemoryAccount::Enabled()) {
+            connection.memory_account = MemoryAccount::Create(name);
+        }
+        // Using Google's STUN server. Callers may replace the servers in
+        // |configuration| before init().
+        webrtc::PeerConnectionInterface::IceServer ice_server;
+        ice_server.uri = "stun:stun.l.google.com:19302";
+        configuration.servers.push_back(ice_server);
+    }
 
     void on_sdp(std::function<void(const std::string &)> f) {
         connection.on_sdp = f;
@@ -256,49 +883,150 @@ public:
 
     void on_ice(std::function<void(const Ice &)> f) { connection.on_ice = f; }
 
+    // Deliver local candidates in batches instead of one by one. Candidates
+    // gathered within |window_ms| of the first one are reported together;
+    // the rest of the batch is flushed as soon as gathering completes.
+    void on_ice_batch(std::function<void(const std::vector<Ice> &)> f,
+                      uint32_t window_ms = 50) {
+        connection.on_ice_batch = f;
+        connection.ice_batch_window_ms = window_ms;
+    }
+
     void on_success(std::function<void()> f) { connection.on_success = f; }
 
     void on_message(std::function<void(const std::string &)> f) {
         connection.on_message = f;
     }
 
+    void on_idle_change(std::function<void(bool)> f) {
+        connection.on_idle_change = f;
+    }
+
+    void on_close(std::function<void()> f) { connection.on_close = f; }
+
+    void on_buffered_amount_change(std::function<void(uint64_t)> f) {
+        connection.on_buffered_amount_change = f;
+    }
+
+    // Called on the signaling thread, or the thread of the failed call, when
+    // a fatal error failed the session. The PeerConnection is closed by then;
+    // call quit() to release the rest.
+    void on_error(std::function<void(const OperationError &)> f) {
+        connection.on_error = f;
+    }
+
+    void on_path_change(std::function<void(bool)> f) {
+        connection.on_path_change = f;
+    }
+
     void init() {
+        TRACE_EVENT0("webrtc_manager", "WebRTCManager::init");
+        ScopedMemoryAccount scope(connection.memory_account);
         std::cout << name << ":" << std::this_thread::get_id() << ":"
                   << "init Main thread" << std::endl;
 
-        // Using Google's STUN server.
-        webrtc::PeerConnectionInterface::IceServer ice_server;
-        ice_server.uri = "stun:stun.l.google.com:19302";
-        configuration.servers.push_back(ice_server);
+        if (external_network_thread == nullptr) {
+            if (create_socket_server) {
+                network_thread.reset(new rtc::Thread(create_socket_server()));
+            } else {
+                network_thread = rtc::Thread::CreateWithSocketServer();
+            }
+            StartThread(network_thread.get(), network_thread_config,
+                        name + "_network");
+        }
+        if (external_worker_thread == nullptr) {
+            worker_thread = rtc::Thread::Create();
+            StartThread(worker_thread.get(), worker_thread_config,
+                        name + "_worker");
+        }
+        if (external_signaling_thread == nullptr) {
+            signaling_thread = rtc::Thread::Create();
+            StartThread(signaling_thread.get(), signaling_thread_config,
+                        name + "_signaling");
+        }
+        // Threads owned by this manager only work for its connection, so all
+        // their allocations are charged to it.
+        if (connection.memory_account != nullptr) {
+            for (rtc::Thread *thread :
+                 {network_thread.get(), worker_thread.get(),
+                  signaling_thread.get()}) {
+                if (thread != nullptr) {
+                    thread->Invoke<void>(RTC_FROM_HERE, [this]() {
+                        MemoryAccount::Current() = connection.memory_account;
+                    });
+                }
+            }
+        }
+        if (socket_config.dscp >= 0) {
+            // Marks the media channels; the socket option covers the rest.
+            configuration.set_dscp(true);
+        }
+        if (!create_port_allocator && (socket_config.has_socket_options() ||
+                                       socket_config.has_port_range())) {
+            packet_socket_factory.reset(new ConfiguredPacketSocketFactory(
+                    std::unique_ptr<rtc::PacketSocketFactory>(
+                            new rtc::BasicPacketSocketFactory(
+                                    get_network_thread())),
+                    socket_config));
+            get_network_thread()->Invoke<void>(RTC_FROM_HERE, [this]() {
+                network_manager.reset(new rtc::BasicNetworkManager());
+            });
+            create_port_allocator = [this]() {
+                return std::unique_ptr<cricket::PortAllocator>(
+                        new cricket::BasicPortAllocator(
+                                network_manager.get(),
+                                packet_socket_factory.get()));
+            };
+        }
+        ChromeTracer::name_thread(get_network_thread(), name + "_network");
+        ChromeTracer::name_thread(get_worker_thread(), name + "_worker");
+        ChromeTracer::name_thread(get_signaling_thread(), name + "_signaling");
 
-        network_thread = rtc::Thread::CreateWithSocketServer();
-        network_thread->Start();
-        worker_thread = rtc::Thread::Create();
-        worker_thread->Start();
-        signaling_thread = rtc::Thread::Create();
-        signaling_thread->Start();
-        webrtc::PeerConnectionFactoryDependencies dependencies;
-        dependencies.network_thread = network_thread.get();
-        dependencies.worker_thread = worker_thread.get();
-        dependencies.signaling_thread = signaling_thread.get();
-        peer_connection_factory = webrtc::CreateModularPeerConnectionFactory(
-                std::move(dependencies));
+        if (external_peer_connection_factory) {
+            peer_connection_factory = external_peer_connection_factory;
+        } else {
+            peer_connection_factory = CreateFactory(
+                    get_network_thread(), get_worker_thread(),
+                    get_signaling_thread(), std::move(task_queue_factory),
+                    std::move(call_factory));
+        }
 
         if (peer_connection_factory.get() == nullptr) {
-            std::cout << name << ":" << std::this_thread::get_id() << ":"
-                      << "Error on CreateModularPeerConnectionFactory."
-                      << std::endl;
-            exit(EXIT_FAILURE);
+            throw std::runtime_error(
+                    "Error on CreateModularPeerConnectionFactory.");
         }
     }
 
-    void create_offer_sdp() {
+    // The signaling operations below never block and never end the process.
+    // Each returns the future of its outcome, ready once the step is done,
+    // has failed, or |timeout_ms| passed (|operation_timeout_ms| when not
+    // positive). Apart from a rejected remote candidate, a failure fails the
+    // session, see on_error(). Callers not interested may drop the future.
+
+    // Ready once the offer is set as the local description.
+    std::future<OperationError> create_offer_sdp(int timeout_ms = 0) {
+        TRACE_EVENT0("webrtc_manager", "WebRTCManager::create_offer_sdp");
+        ScopedMemoryAccount scope(connection.memory_account);
         std::cout << name << ":" << std::this_thread::get_id() << ":"
                   << "create_offer_sdp" << std::endl;
+        connection.trace.record("create_offer");
+        connection.offerer = true;
+        std::shared_ptr<Operation> operation =
+                begin_operation("create_offer", timeout_ms);
+        std::future<OperationError> future = operation->future();
+        if (operation->done()) {
+            return future;
+        }
 
-        connection.peer_connection =
-                peer_connection_factory->CreatePeerConnection(
-                        configuration, nullptr, nullptr, &connection.pco);
+        create_peer_connection();
+        if (connection.peer_connection.get() == nullptr) {
+            peer_connection_factory = nullptr;
+            connection.finish(
+                    operation,
+                    OperationError(OperationErrorCode::kPeerConnectionFailed,
+                                   "Error on CreatePeerConnection."));
+            return future;
+        }
 
         webrtc::DataChannelInit config;
 
@@ -307,119 +1035,622 @@ public:
                 "data_channel", &config);
         connection.data_channel->RegisterObserver(&connection.dco);
 
-        if (connection.peer_connection.get() == nullptr) {
-            peer_connection_factory = nullptr;
-            std::cout << name << ":" << std::this_thread::get_id() << ":"
-                      << "Error on CreatePeerConnection." << std::endl;
-            exit(EXIT_FAILURE);
-        }
         connection.peer_connection->CreateOffer(
-                connection.csdo,
+                new rtc::RefCountedObject<Connection::CSDO>(connection,
+                                                            operation),
                 webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
+        return future;
     }
 
-    void create_answer_sdp(const std::string &parameter) {
+    // Ready once the answer to |parameter| is set as the local description.
+    // A later offer, e.g. an ICE restart, is answered on the same
+    // PeerConnection.
+    std::future<OperationError> create_answer_sdp(const std::string &parameter,
+                                                  int timeout_ms = 0) {
+        TRACE_EVENT0("webrtc_manager", "WebRTCManager::create_answer_sdp");
+        ScopedMemoryAccount scope(connection.memory_account);
         std::cout << name << ":" << std::this_thread::get_id() << ":"
                   << "create_answer_sdp" << std::endl;
-
-        connection.peer_connection =
-                peer_connection_factory->CreatePeerConnection(
-                        configuration, nullptr, nullptr, &connection.pco);
+        connection.trace.record("create_answer");
+        std::shared_ptr<Operation> operation =
+                begin_operation("create_answer", timeout_ms);
+        std::future<OperationError> future = operation->future();
+        if (operation->done()) {
+            return future;
+        }
 
+        if (connection.peer_connection.get() == nullptr) {
+            create_peer_connection();
+        }
         if (connection.peer_connection.get() == nullptr) {
             peer_connection_factory = nullptr;
-            std::cout << name << ":" << std::this_thread::get_id() << ":"
-                      << "Error on CreatePeerConnection." << std::endl;
-            exit(EXIT_FAILURE);
+            connection.finish(
+                    operation,
+                    OperationError(OperationErrorCode::kPeerConnectionFailed,
+                                   "Error on CreatePeerConnection."));
+            return future;
         }
-        webrtc::SdpParseError error;
-        webrtc::SessionDescriptionInterface *session_description(
-                webrtc::CreateSessionDescription("offer", parameter, &error));
+        webrtc::SessionDescriptionInterface *session_description =
+                parse_description("offer", parameter, operation);
         if (session_description == nullptr) {
-            std::cout << name << ":" << std::this_thread::get_id() << ":"
-                      << "Error on CreateSessionDescription." << std::endl
-                      << error.line << std::endl
-                      << error.description << std::endl;
-            std::cout << name << ":" << std::this_thread::get_id() << ":"
-                      << "Offer SDP:begin" << std::endl
-                      << parameter << std::endl
-                      << "Offer SDP:end" << std::endl;
-            exit(EXIT_FAILURE);
+            return future;
         }
-        connection.peer_connection->SetRemoteDescription(connection.ssdo,
-                                                         session_description);
+        connection.peer_connection->SetRemoteDescription(
+                new rtc::RefCountedObject<Connection::SSDO>(connection,
+                                                            operation, false),
+                session_description);
         connection.peer_connection->CreateAnswer(
-                connection.csdo,
+                new rtc::RefCountedObject<Connection::CSDO>(connection,
+                                                            operation),
                 webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
+        return future;
     }
 
-    void push_reply_sdp(const std::string &parameter) {
+    // Ready once the answer |parameter| is set as the remote description.
+    std::future<OperationError> push_reply_sdp(const std::string &parameter,
+                                               int timeout_ms = 0) {
+        TRACE_EVENT0("webrtc_manager", "WebRTCManager::push_reply_sdp");
+        ScopedMemoryAccount scope(connection.memory_account);
         std::cout << name << ":" << std::this_thread::get_id() << ":"
                   << "push_reply_sdp" << std::endl;
+        connection.trace.record("push_reply_sdp");
+        std::shared_ptr<Operation> operation =
+                begin_operation("set_answer", timeout_ms);
+        std::future<OperationError> future = operation->future();
+        if (operation->done()) {
+            return future;
+        }
+        if (connection.peer_connection.get() == nullptr) {
+            connection.finish(
+                    operation,
+                    OperationError(OperationErrorCode::kPeerConnectionFailed,
+                                   "No offer was created."));
+            return future;
+        }
 
-        webrtc::SdpParseError error;
-        webrtc::SessionDescriptionInterface *session_description(
-                webrtc::CreateSessionDescription("answer", parameter, &error));
+        webrtc::SessionDescriptionInterface *session_description =
+                parse_description("answer", parameter, operation);
         if (session_description == nullptr) {
-            std::cout << name << ":" << std::this_thread::get_id() << ":"
-                      << "Error on CreateSessionDescription." << std::endl
-                      << error.line << std::endl
-                      << error.description << std::endl;
-            std::cout << name << ":" << std::this_thread::get_id() << ":"
-                      << "Answer SDP:begin" << std::endl
-                      << parameter << std::endl
-                      << "Answer SDP:end" << std::endl;
-            exit(EXIT_FAILURE);
+            return future;
         }
-        connection.peer_connection->SetRemoteDescription(connection.ssdo,
-                                                         session_description);
+        connection.peer_connection->SetRemoteDescription(
+                new rtc::RefCountedObject<Connection::SSDO>(connection,
+                                                            operation, true),
+                session_description);
+        return future;
     }
 
-    void push_ice(const Ice &ice_it) {
+    // Ready once the PeerConnection took the remote candidate. An invalid or
+    // rejected candidate is reported, not fatal.
+    std::future<OperationError> push_ice(const Ice &ice_it,
+                                         int timeout_ms = 0) {
+        TRACE_EVENT0("webrtc_manager", "WebRTCManager::push_ice");
+        ScopedMemoryAccount scope(connection.memory_account);
         std::cout << name << ":" << std::this_thread::get_id() << ":"
                   << "push_ice" << std::endl;
+        std::shared_ptr<Operation> operation =
+                begin_operation("add_ice", timeout_ms);
+        std::future<OperationError> future = operation->future();
+        add_ice_candidate(ice_it,
+                          [this, operation](const OperationError &error) {
+                              connection.finish(operation, error);
+                          });
+        return future;
+    }
 
-        webrtc::SdpParseError err_sdp;
-        webrtc::IceCandidateInterface *ice =
-                CreateIceCandidate(ice_it.sdp_mid, ice_it.sdp_mline_index,
-                                   ice_it.candidate, &err_sdp);
-        if (!err_sdp.line.empty() && !err_sdp.description.empty()) {
-            std::cout << name << ":" << std::this_thread::get_id() << ":"
-                      << "Error on CreateIceCandidate" << std::endl
-                      << err_sdp.line << std::endl
-                      << err_sdp.description << std::endl;
-            exit(EXIT_FAILURE);
+    // Ready once every candidate of |ices| is taken or rejected, with the
+    // first error.
+    std::future<OperationError> push_ice_batch(const std::vector<Ice> &ices,
+                                               int timeout_ms = 0) {
+        TRACE_EVENT0("webrtc_manager", "WebRTCManager::push_ice_batch");
+        ScopedMemoryAccount scope(connection.memory_account);
+        std::cout << name << ":" << std::this_thread::get_id() << ":"
+                  << "push_ice_batch(" << ices.size() << ")" << std::endl;
+        connection.trace.record("remote_ice_batch");
+        std::shared_ptr<Operation> operation =
+                begin_operation("add_ice_batch", timeout_ms);
+        std::future<OperationError> future = operation->future();
+        if (ices.empty()) {
+            connection.finish(operation, OperationError());
+            return future;
         }
-        connection.peer_connection->AddIceCandidate(ice);
+
+        struct Batch {
+            std::mutex mutex;
+            size_t remaining;
+            OperationError first_error;
+        };
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+        batch->remaining = ices.size();
+        for (const Ice &ice : ices) {
+            add_ice_candidate(ice, [this, operation,
+                                    batch](const OperationError &error) {
+                OperationError result;
+                {
+                    std::lock_guard<std::mutex> lock(batch->mutex);
+                    if (!error.ok() && batch->first_error.ok()) {
+                        batch->first_error = error;
+                    }
+                    if (--batch->remaining > 0) {
+                        return;
+                    }
+                    result = batch->first_error;
+                }
+                connection.finish(operation, result);
+            });
+        }
+        return future;
     }
 
-    void send(const std::string &parameter) {
-        std::cout << name << ":" << std::this_thread::get_id() << ":"
-                  << "send" << std::endl;
+    // Reduce the footprint and wakeups of the connection once it has carried
+    // no DataChannel message for |config.quiet_period_ms|: ICE checks and
+    // keepalives slow down, backup candidate pairs are pruned and cached
+    // state is released. The next message sent or received restores the
+    // previous configuration. Call after init().
+    void enable_idle_mode(const IdleConfig &config) {
+        get_signaling_thread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+            connection.idle_config.reset(new IdleConfig(config));
+            connection.signaling_thread = get_signaling_thread();
+            connection.last_activity_ms = rtc::TimeMillis();
+            connection.idle_task.Stop();
+            connection.idle_task = webrtc::RepeatingTaskHandle::Start(
+                    get_signaling_thread(), [this]() {
+                        connection.check_idle();
+                        return webrtc::TimeDelta::Millis(std::max(
+                                connection.idle_config->quiet_period_ms / 4,
+                                1000));
+                    });
+        });
+    }
+
+    // Recover from a broken network path within the session: once ICE
+    // reports the connection disconnected for |config.disconnected_grace_ms|,
+    // or failed, the offerer restarts ICE. The restart offer goes out through
+    // on_sdp and the answerer answers it with create_answer_sdp(), so both
+    // peers keep their signaling path open. The DataChannel stays open and
+    // resumes once new candidates connect. Enable on both peers, after init()
+    // and before the offer; see ice_recovery_stats().
+    void enable_ice_restart(const IceRestartConfig &config) {
+        configuration.ice_connection_receiving_timeout =
+                config.receiving_timeout_ms;
+        get_signaling_thread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+            connection.ice_restart_config.reset(new IceRestartConfig(config));
+            connection.signaling_thread = get_signaling_thread();
+        });
+    }
+
+    IceRecoveryStats ice_recovery_stats() {
+        std::lock_guard<std::mutex> lock(connection.ice_recovery_mutex);
+        return connection.ice_recovery;
+    }
 
+    // Queue |parameter| on the DataChannel. Returns false, dropping it, once
+    // drain() started.
+    bool send(const std::string &parameter) {
+        TRACE_EVENT0("webrtc_manager", "WebRTCManager::send");
+        ScopedMemoryAccount scope(connection.memory_account);
+        if (connection.verbose) {
+            std::cout << name << ":" << std::this_thread::get_id() << ":"
+                      << "send" << std::endl;
+        }
+        if (connection.draining) {
+            ++connection.rejected_sends;
+            connection.rejected_bytes += parameter.size();
+            return false;
+        }
         webrtc::DataBuffer buffer(
                 rtc::CopyOnWriteBuffer(parameter.c_str(), parameter.size()),
                 true);
+        if (connection.verbose) {
+            std::cout << name << ":" << std::this_thread::get_id() << ":"
+                      << "Send(" << connection.data_channel->state() << ")"
+                      << std::endl;
+        }
+        connection.on_activity();
+        if (connection.idle) {
+            get_signaling_thread()->PostTask(
+                    RTC_FROM_HERE, [this]() { connection.exit_idle(); });
+        }
+        return connection.data_channel->Send(buffer);
+    }
+
+    // Record the RtcEventLog of the connection into rotating files, until
+    // stop_event_log() or quit(). May be called before the PeerConnection
+    // exists; logging then starts once it is created.
+    void start_event_log(const RtcEventLogConfig &config) {
+        event_log_config.reset(new RtcEventLogConfig(config));
+        if (connection.peer_connection) {
+            start_event_log_recorder();
+        }
+    }
+
+    void stop_event_log() {
+        event_log_config.reset();
+        event_log_recorder.reset();
+    }
+
+    // Outcome of drain(). Bytes are DataChannel payload bytes.
+    struct DrainStats {
+        // Queued when the drain started.
+        uint64_t bytes_buffered = 0;
+        // Of those, handed to SCTP before the deadline.
+        uint64_t bytes_drained = 0;
+        // Still queued at the deadline, lost with the connection.
+        uint64_t bytes_dropped = 0;
+        // Sends refused since the drain started.
+        uint64_t rejected_sends = 0;
+        uint64_t rejected_bytes = 0;
+        // Whether the DataChannel finished closing before the deadline.
+        bool closed = false;
+        double duration_ms = 0;
+
+        Json::Value ToJson() const {
+            Json::Value json;
+            json["bytes_buffered"] = Json::UInt64(bytes_buffered);
+            json["bytes_drained"] = Json::UInt64(bytes_drained);
+            json["bytes_dropped"] = Json::UInt64(bytes_dropped);
+            json["rejected_sends"] = Json::UInt64(rejected_sends);
+            json["rejected_bytes"] = Json::UInt64(rejected_bytes);
+            json["closed"] = closed;
+            json["duration_ms"] = duration_ms;
+            return json;
+        }
+    };
+
+    // Shut the DataChannel down without losing queued messages: refuse new
+    // sends, wait until the queued ones are handed to SCTP, then close the
+    // channel and wait until the peer acknowledged the closing, which SCTP
+    // orders after the data. Gives up at |timeout_ms|. Call quit() after.
+    // Not on the signaling thread, which delivers the progress.
+    DrainStats drain(int timeout_ms) {
+        TRACE_EVENT0("webrtc_manager", "WebRTCManager::drain");
+        const auto start = std::chrono::steady_clock::now();
+        const auto deadline = start + std::chrono::milliseconds(timeout_ms);
+        DrainStats stats;
+        if (!connection.data_channel) {
+            connection.draining = true;
+            return stats;
+        }
+        connection.trace.record("drain_start");
+        // On the signaling thread, so no buffered amount update is missed.
+        stats.bytes_buffered = get_signaling_thread()->Invoke<uint64_t>(
+                RTC_FROM_HERE, [this]() {
+                    connection.draining = true;
+                    connection.buffered_amount =
+                            connection.data_channel->buffered_amount();
+                    return connection.buffered_amount.load();
+                });
+        {
+            std::unique_lock<std::mutex> lock(connection.drain_mutex);
+            connection.drain_cv.wait_until(lock, deadline, [this]() {
+                return connection.buffered_amount == 0 || connection.closed;
+            });
+        }
+        stats.bytes_dropped = connection.data_channel->buffered_amount();
+        stats.bytes_drained = stats.bytes_buffered > stats.bytes_dropped
+                                      ? stats.bytes_buffered -
+                                                stats.bytes_dropped
+                                      : 0;
+
+        connection.data_channel->Close();
+        {
+            std::unique_lock<std::mutex> lock(connection.drain_mutex);
+            connection.drain_cv.wait_until(lock, deadline, [this]() {
+                return connection.closed.load();
+            });
+        }
+        stats.closed = connection.closed;
+        stats.rejected_sends = connection.rejected_sends;
+        stats.rejected_bytes = connection.rejected_bytes;
+        stats.duration_ms = std::chrono::duration<double, std::milli>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count();
+        connection.trace.record("drain_done");
         std::cout << name << ":" << std::this_thread::get_id() << ":"
-                  << "Send(" << connection.data_channel->state() << ")"
-                  << std::endl;
-        connection.data_channel->Send(buffer);
+                  << "drain " << JsonToString(stats.ToJson()) << std::endl;
+        return stats;
+    }
+
+    // Memory held for the connection. |heap_bytes| is -1 unless memory
+    // accounting is enabled; with threads shared between managers it only
+    // covers the allocations made by this manager's calls and callbacks.
+    struct MemoryUsage {
+        int64_t heap_bytes = -1;
+        // DataChannel messages queued in SCTP, waiting to be sent.
+        uint64_t queued_message_bytes = 0;
+        size_t pending_ice_bytes = 0;
+        size_t trace_bytes = 0;
+    };
+
+    // Runs on the signaling thread, which owns the pending candidates.
+    MemoryUsage memory_usage() {
+        return get_signaling_thread()->Invoke<MemoryUsage>(
+                RTC_FROM_HERE, [this]() {
+                    MemoryUsage usage;
+                    if (connection.memory_account != nullptr) {
+                        usage.heap_bytes = connection.memory_account->bytes();
+                    }
+                    if (connection.data_channel) {
+                        usage.queued_message_bytes =
+                                connection.data_channel->buffered_amount();
+                    }
+                    for (const Ice &ice : connection.pending_ice) {
+                        usage.pending_ice_bytes += sizeof(Ice) +
+                                                   ice.candidate.capacity() +
+                                                   ice.sdp_mid.capacity();
+                    }
+                    for (const TraceEvent &event : connection.trace.events()) {
+                        usage.trace_bytes +=
+                                sizeof(TraceEvent) + event.name.capacity();
+                    }
+                    return usage;
+                });
+    }
+
+    // UDP drops of the connection's sockets, known when the manager applies
+    // |socket_config|; of all the process's UDP sockets otherwise.
+    UdpDrops socket_drops() {
+        if (packet_socket_factory) {
+            const std::set<uint16_t> ports = packet_socket_factory->udp_ports();
+            return drop_counter.sample(&ports);
+        }
+        return drop_counter.sample();
     }
 
     void quit() {
+        TRACE_EVENT0("webrtc_manager", "WebRTCManager::quit");
         std::cout << name << ":" << std::this_thread::get_id() << ":"
                   << "quit" << std::endl;
 
+        stop_event_log();
+        // On the signaling thread, so no deadline fires past this point.
+        get_signaling_thread()->Invoke<void>(RTC_FROM_HERE, [this]() {
+            connection.idle_task.Stop();
+            connection.restart_task.Stop();
+            connection.cancel_operations(OperationError(
+                    OperationErrorCode::kCancelled, "quit"));
+        });
+
         // Close with the thread running.
-        connection.peer_connection->Close();
+        if (connection.peer_connection) {
+            connection.peer_connection->Close();
+        }
         connection.peer_connection = nullptr;
         connection.data_channel = nullptr;
         peer_connection_factory = nullptr;
-        network_thread->Stop();
-        worker_thread->Stop();
-        signaling_thread->Stop();
+        if (network_manager) {
+            get_network_thread()->Invoke<void>(
+                    RTC_FROM_HERE, [this]() { network_manager.reset(); });
+        }
+        if (network_thread) {
+            network_thread->Stop();
+        }
+        if (worker_thread) {
+            worker_thread->Stop();
+        }
+        if (signaling_thread) {
+            signaling_thread->Stop();
+        }
     }
 
+    // A PeerConnectionFactory on the given threads, as init() creates it.
+    // |task_queue_factory| defaults to WebRTC's and |call_factory| may be
+    // null.
+    static rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>
+    CreateFactory(
+            rtc::Thread *network_thread,
+            rtc::Thread *worker_thread,
+            rtc::Thread *signaling_thread,
+            std::unique_ptr<webrtc::TaskQueueFactory> task_queue_factory =
+                    nullptr,
+            std::unique_ptr<webrtc::CallFactoryInterface> call_factory =
+                    nullptr) {
+        webrtc::PeerConnectionFactoryDependencies dependencies;
+        dependencies.network_thread = network_thread;
+        dependencies.worker_thread = worker_thread;
+        dependencies.signaling_thread = signaling_thread;
+        if (task_queue_factory == nullptr) {
+            task_queue_factory = webrtc::CreateDefaultTaskQueueFactory();
+        }
+        // The event log is idle until start_event_log().
+        dependencies.event_log_factory.reset(
+                new webrtc::RtcEventLogFactory(task_queue_factory.get()));
+        dependencies.task_queue_factory = std::move(task_queue_factory);
+        dependencies.call_factory = std::move(call_factory);
+        return webrtc::CreateModularPeerConnectionFactory(
+                std::move(dependencies));
+    }
+
+    rtc::Thread *get_network_thread() const {
+        return external_network_thread ? external_network_thread
+                                       : network_thread.get();
+    }
+
+    rtc::Thread *get_worker_thread() const {
+        return external_worker_thread ? external_worker_thread
+                                      : worker_thread.get();
+    }
+
+    rtc::Thread *get_signaling_thread() const {
+        return external_signaling_thread ? external_signaling_thread
+                                         : signaling_thread.get();
+    }
+
+private:
+    // Track a new operation of the connection, failed with kTimeout unless
+    // it completes within |timeout_ms|.
+    std::shared_ptr<Operation> begin_operation(const std::string &name,
+                                               int timeout_ms) {
+        std::shared_ptr<Operation> operation =
+                connection.begin_operation(name);
+        if (operation->done()) {
+            return operation;
+        }
+        if (timeout_ms <= 0) {
+            timeout_ms = operation_timeout_ms;
+        }
+        // Touches the connection only while the operation is pending, which
+        // quit() ends before the manager goes away.
+        get_signaling_thread()->PostDelayedTask(
+                RTC_FROM_HERE,
+                [this, operation, timeout_ms]() {
+                    if (operation->done()) {
+                        return;
+                    }
+                    connection.finish(
+                            operation,
+                            OperationError(OperationErrorCode::kTimeout,
+                                           operation->name() + " took over " +
+                                                   std::to_string(timeout_ms) +
+                                                   "ms"));
+                },
+                timeout_ms);
+        return operation;
+    }
+
+    // The session description of |type| in |sdp|, or null after failing
+    // |operation| when it does not parse.
+    webrtc::SessionDescriptionInterface *parse_description(
+            const std::string &type,
+            const std::string &sdp,
+            const std::shared_ptr<Operation> &operation) {
+        webrtc::SdpParseError error;
+        webrtc::SessionDescriptionInterface *session_description(
+                webrtc::CreateSessionDescription(type, sdp, &error));
+        if (session_description == nullptr) {
+            std::cout << name << ":" << std::this_thread::get_id() << ":"
+                      << "Error on CreateSessionDescription." << std::endl
+                      << error.line << std::endl
+                      << error.description << std::endl;
+            std::cout << name << ":" << std::this_thread::get_id() << ":"
+                      << type << " SDP:begin" << std::endl
+                      << sdp << std::endl
+                      << type << " SDP:end" << std::endl;
+            connection.finish(operation,
+                              OperationError(OperationErrorCode::kInvalidSdp,
+                                             error.line + ": " +
+                                                     error.description));
+        }
+        return session_description;
+    }
+
+    // Hand |ice| to the PeerConnection; |done| gets the outcome, on the
+    // signaling thread unless the candidate is rejected up front.
+    void add_ice_candidate(const Ice &ice,
+                           std::function<void(const OperationError &)> done) {
+        if (connection.peer_connection.get() == nullptr) {
+            done(OperationError(OperationErrorCode::kAddCandidateFailed,
+                                "No PeerConnection yet."));
+            return;
+        }
+        webrtc::SdpParseError err_sdp;
+        std::unique_ptr<webrtc::IceCandidateInterface> candidate(
+                CreateIceCandidate(ice.sdp_mid, ice.sdp_mline_index,
+                                   ice.candidate, &err_sdp));
+        if (candidate == nullptr) {
+            std::cout << name << ":" << std::this_thread::get_id() << ":"
+                      << "Error on CreateIceCandidate" << std::endl
+                      << err_sdp.line << std::endl
+                      << err_sdp.description << std::endl;
+            done(OperationError(
+                    OperationErrorCode::kInvalidCandidate,
+                    err_sdp.line + ": " + err_sdp.description));
+            return;
+        }
+        connection.peer_connection->AddIceCandidate(
+                std::move(candidate), [done](webrtc::RTCError error) {
+                    if (error.ok()) {
+                        done(OperationError());
+                    } else {
+                        done(OperationError(
+                                OperationErrorCode::kAddCandidateFailed,
+                                error.message()));
+                    }
+                });
+    }
+
+    void create_peer_connection() {
+        std::unique_ptr<cricket::PortAllocator> port_allocator;
+        if (create_port_allocator) {
+            using PortAllocatorPtr = std::unique_ptr<cricket::PortAllocator>;
+            port_allocator = get_network_thread()->Invoke<PortAllocatorPtr>(
+                    RTC_FROM_HERE, [this]() {
+                        PortAllocatorPtr allocator = create_port_allocator();
+                        if (socket_config.has_port_range()) {
+                            allocator->SetPortRange(socket_config.min_port,
+                                                    socket_config.max_port);
+                        }
+                        return allocator;
+                    });
+        }
+        connection.peer_connection =
+                peer_connection_factory->CreatePeerConnection(
+                        configuration, std::move(port_allocator), nullptr,
+                        &connection.pco);
+        if (connection.peer_connection && event_log_config) {
+            start_event_log_recorder();
+        }
+    }
+
+    void start_event_log_recorder() {
+        event_log_recorder.reset(new RtcEventLogRecorder(
+                *event_log_config, connection.peer_connection,
+                get_signaling_thread()));
+        if (!event_log_recorder->start()) {
+            event_log_recorder.reset();
+        }
+    }
+
+public:
+    // Optional dependencies, set before init().
+
+    // Threads owned by the caller, e.g. a network thread running a
+    // VirtualSocketServer shared by several managers, or threads created by
+    // a webrtc::TimeController. init() creates and owns the threads left
+    // null, the network thread with the default socket server.
+    rtc::Thread *external_network_thread = nullptr;
+    rtc::Thread *external_worker_thread = nullptr;
+    rtc::Thread *external_signaling_thread = nullptr;
+
+    // Creates the socket server of the network thread init() creates, e.g. a
+    // BatchingSocketServer. rtc::PhysicalSocketServer is used when empty.
+    // Its sockets reach the PeerConnections through the network manager and
+    // packet socket factory WebRTC builds on the network thread's socket
+    // server, so no separate factory is needed.
+    std::function<std::unique_ptr<rtc::SocketServer>()> create_socket_server;
+
+    // PeerConnectionFactory shared with other managers, created by
+    // CreateFactory() on the external threads, e.g. by a ShardedRuntime.
+    // init() creates one of its own when null.
+    rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>
+            external_peer_connection_factory;
+
+    // Factories handed over to the PeerConnectionFactory by init(). A
+    // webrtc::TimeController provides both to run the session on simulated
+    // time. WebRTC's defaults are used when null.
+    std::unique_ptr<webrtc::TaskQueueFactory> task_queue_factory;
+    std::unique_ptr<webrtc::CallFactoryInterface> call_factory;
+
+    // Creates the port allocator of each PeerConnection, on the network
+    // thread. The default allocator is used when empty.
+    std::function<std::unique_ptr<cricket::PortAllocator>()>
+            create_port_allocator;
+
+    // Socket buffer sizes, DSCP marking and port range of the
+    // PeerConnection's sockets. Options other than the port range need the
+    // default port allocator, i.e. an empty create_port_allocator.
+    SocketConfig socket_config;
+
+    // Names, placement and scheduling of the threads init() creates, e.g.
+    // the network thread of a BusyPollSocketServer on a core of its own.
+    // External threads are left as they are; see RtcThreadGroup.
+    ThreadConfig network_thread_config;
+    ThreadConfig worker_thread_config;
+    ThreadConfig signaling_thread_config;
+
+    // Deadline of the signaling operations called without their own.
+    int operation_timeout_ms = 30000;
+
 public:
     const std::string name;
     std::unique_ptr<rtc::Thread> network_thread;
@@ -429,4 +1660,52 @@ public:
             peer_connection_factory;
     webrtc::PeerConnectionInterface::RTCConfiguration configuration;
     Connection connection;
+
+    // Set while the RtcEventLog is requested.
+    std::unique_ptr<RtcEventLogConfig> event_log_config;
+    std::unique_ptr<RtcEventLogRecorder> event_log_recorder;
+
+    // Behind the port allocator applying |socket_config|, set by init(). The
+    // network manager lives on the network thread.
+    std::unique_ptr<rtc::BasicNetworkManager> network_manager;
+    std::unique_ptr<ConfiguredPacketSocketFactory> packet_socket_factory;
+    UdpDropCounter drop_counter;
 };
+
+// Runtime setting for the client and server: WEBRTC_ICE_RESTART=1 keeps the
+// signaling path open and enables WebRTCManager::enable_ice_restart() with
+// the default IceRestartConfig.
+inline bool IceRestartFromEnv() {
+    const char *value = std::getenv("WEBRTC_ICE_RESTART");
+    return value != nullptr && std::string(value) == "1";
+}
+
+// IceRecoveryStats in the Prometheus text format.
+inline std::string RenderIceRecoveryStats(const IceRecoveryStats &stats) {
+    std::ostringstream out;
+    out << "# HELP webrtc_path_losses_total Times ICE reported the "
+           "connection disconnected or failed.\n"
+        << "# TYPE webrtc_path_losses_total counter\n"
+        << "webrtc_path_losses_total " << stats.path_losses << "\n"
+        << "# HELP webrtc_path_recoveries_total Lost paths back.\n"
+        << "# TYPE webrtc_path_recoveries_total counter\n"
+        << "webrtc_path_recoveries_total " << stats.recoveries << "\n"
+        << "# HELP webrtc_ice_restarts_total ICE restarts sent.\n"
+        << "# TYPE webrtc_ice_restarts_total counter\n"
+        << "webrtc_ice_restarts_total " << stats.restarts << "\n"
+        << "# HELP webrtc_path_detection_ms Time from the last message "
+           "received to the last loss.\n"
+        << "# TYPE webrtc_path_detection_ms gauge\n"
+        << "webrtc_path_detection_ms " << stats.last_detection_ms << "\n"
+        << "# HELP webrtc_path_recovery_ms Duration of the last loss.\n"
+        << "# TYPE webrtc_path_recovery_ms gauge\n"
+        << "webrtc_path_recovery_ms " << stats.last_recovery_ms << "\n";
+    return out.str();
+}
+
+// Runtime setting for the client and server: WEBRTC_DRAIN_TIMEOUT_MS bounds
+// WebRTCManager::drain() on exit, 5 seconds by default.
+inline int DrainTimeoutMsFromEnv() {
+    const char *value = std::getenv("WEBRTC_DRAIN_TIMEOUT_MS");
+    return value != nullptr ? std::atoi(value) : 5000;
+}